@@ -0,0 +1,111 @@
+// arena.hpp
+// bump allocator for objects that are freed all at once
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace arena {
+
+// Bump allocator for objects that live and die together, such as the syntax of a program.
+// Allocation is a pointer increment. Blocks double in size as the arena fills, so n bytes take
+// O(log n) calls to the system allocator, and none once a reset arena has grown to the size of
+// its input. Nothing is freed on its own and no destructors run, so only trivially destructible
+// objects can be allocated; reset() frees all of them at once.
+class Arena {
+   private:
+    static constexpr std::size_t first_block_size = std::size_t{1} << 16U;
+
+    struct Block {
+        std::unique_ptr<std::byte[]> data;  // NOLINT
+        std::size_t size;
+    };
+
+    std::vector<Block> m_blocks{};
+    std::byte* m_next{nullptr};
+    std::size_t m_left{0};
+    std::size_t m_used{0};  // bytes handed out, including alignment padding
+
+    void add_block(std::size_t min_size) {
+        auto size = std::max(m_blocks.empty() ? first_block_size : 2 * m_blocks.back().size,
+                             min_size);
+        m_blocks.push_back(
+            Block{std::make_unique_for_overwrite<std::byte[]>(size), size});  // NOLINT
+        m_next = m_blocks.back().data.get();
+        m_left = size;
+    }
+
+   public:
+    Arena() = default;
+    // Start with a block of capacity bytes
+    explicit Arena(std::size_t capacity) { add_block(capacity); }
+
+    Arena(const Arena&) = delete;
+    auto operator=(const Arena&) -> Arena& = delete;
+    Arena(Arena&&) noexcept = default;
+    auto operator=(Arena&&) noexcept -> Arena& = default;
+    ~Arena() = default;
+
+    // size bytes aligned to align, which must be a power of two
+    auto allocate(std::size_t size, std::size_t align) -> void* {
+        auto padding = (0 - reinterpret_cast<std::uintptr_t>(m_next)) & (align - 1);
+        if (padding + size > m_left) {
+            add_block(size + align - 1);
+            padding = (0 - reinterpret_cast<std::uintptr_t>(m_next)) & (align - 1);
+        }
+        auto* allocated = m_next + padding;
+        m_next = allocated + size;
+        m_left -= padding + size;
+        m_used += padding + size;
+        return allocated;
+    }
+
+    // Uninitialised storage for count objects of type T, for the caller to construct
+    template <typename T>
+        requires std::is_trivially_destructible_v<T>
+    auto allocate(std::size_t count) -> T* {
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    template <typename T, typename... Args>
+        requires std::is_trivially_destructible_v<T>
+    auto make(Args&&... args) -> T* {
+        return std::construct_at(allocate<T>(1), std::forward<Args>(args)...);
+    }
+
+    // Copy of str that lives as long as the arena's contents
+    auto store(std::string_view str) -> std::string_view {
+        auto* chars = allocate<char>(str.size());
+        if (!str.empty()) std::memcpy(chars, str.data(), str.size());
+        return std::string_view{chars, str.size()};
+    }
+
+    // Free everything allocated so far, keeping the largest block to allocate from again
+    void reset() {
+        if (m_blocks.empty()) return;
+        std::swap(m_blocks.front(), m_blocks.back());
+        m_blocks.resize(1);
+        m_next = m_blocks.front().data.get();
+        m_left = m_blocks.front().size;
+        m_used = 0;
+    }
+
+    [[nodiscard]] auto bytes_used() const -> std::size_t { return m_used; }
+    [[nodiscard]] auto block_count() const -> std::size_t { return m_blocks.size(); }
+    [[nodiscard]] auto capacity() const -> std::size_t {
+        std::size_t capacity{0};
+        for (const auto& block : m_blocks) capacity += block.size;
+        return capacity;
+    }
+};
+
+}  // namespace arena
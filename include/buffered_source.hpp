@@ -0,0 +1,139 @@
+// buffered_source.hpp
+// input range over a file descriptor or stream buffer, read in large blocks
+
+#pragma once
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <ranges>
+#include <streambuf>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+namespace io {
+
+// Reads its input a block at a time into one buffer, reused for every block, with a sentinel byte
+// after the bytes read. Iterating is walking a pointer: the iterator only looks past the byte it
+// is on when that byte is the sentinel, which is where the buffer is refilled, so for lexing a
+// pipe or stream the end is checked once per block rather than once per byte. NUL bytes in the
+// input read as themselves. The iterator also shows the rest of its block, as a
+// lexer::BlockIterator, so that the lexer can consume runs of it at once.
+// An input range of chars, single pass, that Lexer lexes in owning mode; tokens may straddle
+// blocks. The fd or stream buffer is not owned and must outlive the range.
+class buffered_source : public std::ranges::view_interface<buffered_source> {
+   public:
+    static constexpr std::size_t default_block_size = std::size_t{1} << 16U;
+    static constexpr char sentinel = '\0';
+
+   private:
+    int m_fd{-1};
+    std::streambuf* m_streambuf{nullptr};
+    std::size_t m_block_size{default_block_size};
+    std::unique_ptr<char[]> m_buffer{};  // NOLINT: a block and its sentinel
+    const char* m_data_end{nullptr};     // where the sentinel is
+    bool m_exhausted{false};
+
+    [[noreturn]] static void fail(const char* what) {
+        throw std::system_error{errno, std::generic_category(), what};
+    }
+
+    auto read_block() -> std::size_t {
+        if (m_streambuf != nullptr) {
+            return static_cast<std::size_t>(
+                m_streambuf->sgetn(m_buffer.get(), static_cast<std::streamsize>(m_block_size)));
+        }
+        while (true) {
+            auto count = read(m_fd, m_buffer.get(), m_block_size);
+            if (count >= 0) return static_cast<std::size_t>(count);
+            if (errno != EINTR) fail("read");
+        }
+    }
+
+    // Replace the buffer with the next block, empty at the end of the input
+    auto fill() -> const char* {
+        if (!m_buffer) m_buffer = std::make_unique_for_overwrite<char[]>(m_block_size + 1);
+        auto count = m_exhausted ? 0 : read_block();
+        m_exhausted = count == 0;
+        m_data_end = m_buffer.get() + count;
+        m_buffer[count] = sentinel;
+        return m_buffer.get();
+    }
+
+    // Where to continue from pos, which is on a sentinel byte: the next block if pos is at the
+    // end of this one, or pos itself if the byte is a NUL of the input
+    auto underflow(const char* pos) -> const char* {
+        return pos == m_data_end ? fill() : pos;
+    }
+
+   public:
+    class Iterator {
+       private:
+        const char* m_pos{nullptr};
+        buffered_source* m_source{nullptr};
+
+       public:
+        using difference_type = std::ptrdiff_t;
+        using value_type = char;
+
+        Iterator() = default;
+        Iterator(const char* pos, buffered_source* source) : m_pos{pos}, m_source{source} {}
+
+        auto operator*() const -> char { return *m_pos; }
+
+        auto operator++() -> Iterator& {
+            if (*++m_pos == sentinel) [[unlikely]] {
+                m_pos = m_source->underflow(m_pos);
+            }
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+
+        // The rest of the current block, from the byte the iterator is on
+        [[nodiscard]] auto block() const -> std::string_view {
+            return {m_pos, m_source->m_data_end};
+        }
+
+        // Step past n bytes of block()
+        void skip(std::size_t n) {
+            m_pos += n;
+            if (*m_pos == sentinel) [[unlikely]] {
+                m_pos = m_source->underflow(m_pos);
+            }
+        }
+
+        // the end of the input is the sentinel after an empty block
+        auto operator==(std::default_sentinel_t /*end*/) const -> bool {
+            return *m_pos == sentinel && m_pos == m_source->m_data_end;
+        }
+    };
+
+    buffered_source() = default;
+
+    // Reads fd, which stays owned by the caller
+    explicit buffered_source(int fd, std::size_t block_size = default_block_size)
+        : m_fd{fd}, m_block_size{block_size} {}
+
+    explicit buffered_source(std::streambuf& streambuf,
+                             std::size_t block_size = default_block_size)
+        : m_streambuf{&streambuf}, m_block_size{block_size} {}
+
+    buffered_source(const buffered_source&) = delete;
+    auto operator=(const buffered_source&) -> buffered_source& = delete;
+    buffered_source(buffered_source&&) noexcept = default;
+    auto operator=(buffered_source&&) noexcept -> buffered_source& = default;
+    ~buffered_source() = default;
+
+    // Reads the first block; a single pass range, so call once
+    auto begin() -> Iterator { return Iterator{fill(), this}; }
+    static auto end() -> std::default_sentinel_t { return std::default_sentinel; }
+};
+
+static_assert(std::input_iterator<buffered_source::Iterator>);
+static_assert(std::ranges::view<buffered_source> && std::ranges::input_range<buffered_source>);
+
+}  // namespace io
@@ -0,0 +1,137 @@
+// bytecode.hpp
+// instruction format and compiled functions of the VM
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bytecode {
+
+// Operands are local slots, capture, global, constant and function indices, argument counts,
+// jump targets as instruction indices, or for push_fixnum the fixnum itself.
+enum class Op : uint8_t {
+    push_fixnum,
+    push_constant,
+    push_unspecified,
+    pop,
+    load_local,
+    store_local,
+    make_box,  // box the local slot, for a variable defined after closures can see it
+    load_boxed,
+    store_boxed,
+    load_captured,
+    load_captured_boxed,
+    load_global,
+    store_global,
+    jump,
+    jump_if_false,
+    make_closure,
+    call,
+    tail_call,
+    return_,
+    add,
+    sub,
+    mul,
+    quotient,
+    remainder,
+    num_eq,
+    lt,
+    gt,
+    le,
+    ge,
+    cons,
+    car,
+    cdr,
+    is_pair,
+    is_null,
+    list,  // of the top operand values, the first deepest
+    op_count
+};
+
+inline constexpr std::array<std::string_view, static_cast<std::size_t>(Op::op_count)> op_names{
+    "push_fixnum", "push_constant", "push_unspecified", "pop", "load_local", "store_local",
+    "make_box", "load_boxed", "store_boxed", "load_captured", "load_captured_boxed", "load_global",
+    "store_global", "jump", "jump_if_false", "make_closure", "call", "tail_call", "return", "add",
+    "sub", "mul", "quotient", "remainder", "=", "<", ">", "<=", ">=", "cons", "car", "cdr",
+    "pair?", "null?", "list",
+};
+
+// An instruction is a single 32-bit word: the opcode in the low byte and a 24-bit operand above
+// it, so that the code of a function is one dense array and decoding is a mask and a shift
+using Instruction = uint32_t;
+
+// Fixnums are 63 bits, the low bit of a value's word being its tag
+inline constexpr int64_t min_fixnum = -(int64_t{1} << 62U);
+inline constexpr int64_t max_fixnum = (int64_t{1} << 62U) - 1;
+
+inline constexpr uint32_t max_operand = (uint32_t{1} << 24U) - 1;
+inline constexpr int64_t min_immediate = -(int64_t{1} << 23U);
+inline constexpr int64_t max_immediate = (int64_t{1} << 23U) - 1;
+
+constexpr auto encode(Op op, uint32_t operand = 0) -> Instruction {
+    return static_cast<uint32_t>(op) | (operand << 8U);
+}
+
+constexpr auto op_of(Instruction instruction) -> Op {
+    return static_cast<Op>(instruction & 0xFFU);
+}
+
+constexpr auto operand_of(Instruction instruction) -> uint32_t { return instruction >> 8U; }
+
+// The operand of push_fixnum, sign extended from 24 bits
+constexpr auto immediate_of(Instruction instruction) -> int64_t {
+    return static_cast<int64_t>(static_cast<int32_t>(instruction) >> 8);
+}
+
+static_assert(op_of(encode(Op::call, 3)) == Op::call && operand_of(encode(Op::call, 3)) == 3);
+static_assert(immediate_of(encode(Op::push_fixnum, static_cast<uint32_t>(-5) & max_operand)) == -5);
+
+// Where a closure takes a captured value from when it is made: a local slot of the function
+// making it, or one of that function's own captures
+struct Capture {
+    bool from_local;
+    uint32_t index;
+};
+
+struct Function {
+    std::string name{};
+    uint32_t arity{0};
+    uint32_t frame_size{0};  // local slots, the arguments first
+    uint32_t max_stack{0};   // operand stack depth above the local slots
+    std::vector<Instruction> code{};
+    std::vector<int64_t> constants{};  // fixnums too wide for push_fixnum
+    std::vector<Capture> captures{};
+};
+
+// Functions of a compiled program, the entry point running its top level forms in order and
+// returning the value of the last
+struct Program {
+    std::vector<Function> functions{};
+    std::vector<std::string> globals{};  // names, by index
+    uint32_t entry{0};
+};
+
+// One instruction per line, jump targets by index
+inline auto disassemble(const Function& function) -> std::string {
+    std::string out = std::format("{} (arity {}, frame {}, stack {}):\n", function.name,
+                                  function.arity, function.frame_size, function.max_stack);
+    for (std::size_t i = 0; i < function.code.size(); i++) {
+        auto instruction = function.code[i];
+        auto op = op_of(instruction);
+        auto name = op_names[static_cast<std::size_t>(op)];
+        if (op == Op::push_fixnum) {
+            out += std::format("{:5} {} {}\n", i, name, immediate_of(instruction));
+        } else {
+            out += std::format("{:5} {} {}\n", i, name, operand_of(instruction));
+        }
+    }
+    return out;
+}
+
+}  // namespace bytecode
@@ -0,0 +1,519 @@
+// compiler.hpp
+// compiling datums to bytecode
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <format>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "bytecode.hpp"
+#include "reader.hpp"
+#include "symbol_table.hpp"
+
+namespace compiler {
+
+struct CompileError {
+    std::string message;
+};
+
+namespace detail {
+
+using bytecode::Op;
+using reader::Datum;
+
+// Procedures compiled to an instruction of their own where they are called, unless the program
+// defines a global of the same name
+struct Primitive {
+    std::string_view name;
+    Op op;
+    int arity;  // or any_arity
+};
+
+inline constexpr int any_arity = -1;
+
+inline constexpr std::array<Primitive, 16> primitives{{
+    {"+", Op::add, any_arity},
+    {"-", Op::sub, any_arity},
+    {"*", Op::mul, any_arity},
+    {"quotient", Op::quotient, 2},
+    {"remainder", Op::remainder, 2},
+    {"=", Op::num_eq, 2},
+    {"<", Op::lt, 2},
+    {">", Op::gt, 2},
+    {"<=", Op::le, 2},
+    {">=", Op::ge, 2},
+    {"cons", Op::cons, 2},
+    {"car", Op::car, 1},
+    {"cdr", Op::cdr, 1},
+    {"pair?", Op::is_pair, 1},
+    {"null?", Op::is_null, 1},
+    {"list", Op::list, any_arity},
+}};
+
+constexpr auto primitive_named(std::string_view name) -> std::optional<Primitive> {
+    for (const auto& primitive : primitives) {
+        if (primitive.name == name) return primitive;
+    }
+    return std::nullopt;
+}
+
+// Elements of a proper list
+inline auto elements(const Datum& list) -> std::optional<std::vector<Datum>> {
+    std::vector<Datum> items{};
+    const Datum* it = &list;
+    for (; it->is_pair(); it = &it->as_pair().cdr) items.push_back(it->as_pair().car);
+    if (!it->is_nil()) return std::nullopt;
+    return items;
+}
+
+class Compiler {
+   private:
+    static constexpr uint32_t no_global = ~uint32_t{0};
+
+    struct Local {
+        symbol::Id name;
+        uint32_t slot;
+        bool boxed;
+    };
+
+    // a function being compiled, innermost last
+    struct Scope {
+        uint32_t function;  // index into m_program.functions
+        std::vector<Local> locals{};
+        std::vector<Local> captures{};  // names of the function's captures, slot being the index
+        uint32_t slots{0};               // in use
+        uint32_t depth{0};               // of the operand stack
+    };
+
+    enum class Where : uint8_t { local, captured, global };
+
+    struct Variable {
+        Where where;
+        uint32_t index;
+        bool boxed;
+    };
+
+    bytecode::Program m_program{};
+    symbol::SymbolTable m_symbols{};
+    std::vector<uint32_t> m_globals{};       // global index by symbol id
+    std::vector<bool> m_defined_globals{};  // by symbol id, from the program's top level defines
+    std::vector<Scope> m_scopes{};
+    std::optional<CompileError> m_error{};
+
+    symbol::Id m_define{m_symbols.intern("define")};
+    symbol::Id m_lambda{m_symbols.intern("lambda")};
+    symbol::Id m_if{m_symbols.intern("if")};
+    symbol::Id m_let{m_symbols.intern("let")};
+    symbol::Id m_begin{m_symbols.intern("begin")};
+
+    // Record the first error; compiling goes on, but its output is discarded
+    void error(std::string_view message, const Datum& datum) {
+        if (!m_error) m_error = CompileError{std::format("{}: {}", message, reader::write(datum))};
+    }
+
+    auto scope() -> Scope& { return m_scopes.back(); }
+    auto function() -> bytecode::Function& { return m_program.functions[scope().function]; }
+    auto here() -> uint32_t { return static_cast<uint32_t>(function().code.size()); }
+
+    auto id_of(const Datum& symbol) -> symbol::Id { return m_symbols.intern(symbol.as_symbol()); }
+
+    // Append an instruction that changes the depth of the operand stack by stack_effect
+    void emit(Op op, uint32_t operand, int stack_effect, const Datum& datum) {
+        if (operand > bytecode::max_operand) error("too large to compile", datum);
+        function().code.push_back(bytecode::encode(op, operand & bytecode::max_operand));
+        scope().depth = static_cast<uint32_t>(static_cast<int>(scope().depth) + stack_effect);
+        function().max_stack = std::max(function().max_stack, scope().depth);
+    }
+
+    void patch(uint32_t at, uint32_t target) {
+        function().code[at] = bytecode::encode(bytecode::op_of(function().code[at]), target);
+    }
+
+    auto global_index(symbol::Id name) -> uint32_t {
+        if (name >= m_globals.size()) m_globals.resize(name + 1, no_global);
+        if (m_globals[name] == no_global) {
+            m_globals[name] = static_cast<uint32_t>(m_program.globals.size());
+            m_program.globals.emplace_back(m_symbols.name(name));
+        }
+        return m_globals[name];
+    }
+
+    auto defines_global(symbol::Id name) const -> bool {
+        return name < m_defined_globals.size() && m_defined_globals[name];
+    }
+
+    // A slot for a new local of the innermost function
+    auto declare(symbol::Id name, bool boxed) -> uint32_t {
+        auto slot = scope().slots++;
+        function().frame_size = std::max(function().frame_size, scope().slots);
+        scope().locals.push_back(Local{.name = name, .slot = slot, .boxed = boxed});
+        return slot;
+    }
+
+    // Drop the locals declared since there were count of them
+    void release(std::size_t count) {
+        scope().locals.resize(count);
+        scope().slots = count == 0 ? 0 : scope().locals.back().slot + 1;
+    }
+
+    // Where name is bound as seen from the function at level, capturing it into that function
+    // and every one between it and the function binding it
+    auto resolve(std::size_t level, symbol::Id name) -> std::optional<Variable> {
+        auto& at = m_scopes[level];
+        for (const auto& local : at.locals | std::views::reverse) {
+            if (local.name == name) return Variable{Where::local, local.slot, local.boxed};
+        }
+        for (const auto& capture : at.captures) {
+            if (capture.name == name) return Variable{Where::captured, capture.slot, capture.boxed};
+        }
+        if (level == 0) return std::nullopt;
+
+        auto outer = resolve(level - 1, name);
+        if (!outer) return std::nullopt;
+        auto index = static_cast<uint32_t>(at.captures.size());
+        at.captures.push_back(Local{.name = name, .slot = index, .boxed = outer->boxed});
+        m_program.functions[at.function].captures.push_back(
+            bytecode::Capture{.from_local = outer->where == Where::local, .index = outer->index});
+        return Variable{Where::captured, index, outer->boxed};
+    }
+
+    auto resolve(symbol::Id name) -> std::optional<Variable> {
+        return resolve(m_scopes.size() - 1, name);
+    }
+
+    void compile_fixnum(int64_t n, const Datum& datum) {
+        if (n < bytecode::min_fixnum || n > bytecode::max_fixnum) {
+            return error("only fixnums are supported", datum);
+        }
+        if (n >= bytecode::min_immediate && n <= bytecode::max_immediate) {
+            emit(Op::push_fixnum, static_cast<uint32_t>(n) & bytecode::max_operand, 1, datum);
+        } else {
+            emit(Op::push_constant, static_cast<uint32_t>(function().constants.size()), 1, datum);
+            function().constants.push_back(n);
+        }
+    }
+
+    void compile_reference(const Datum& symbol) {
+        auto name = id_of(symbol);
+        if (auto variable = resolve(name)) {
+            if (variable->where == Where::local) {
+                emit(variable->boxed ? Op::load_boxed : Op::load_local, variable->index, 1, symbol);
+            } else {
+                emit(variable->boxed ? Op::load_captured_boxed : Op::load_captured,
+                     variable->index, 1, symbol);
+            }
+            return;
+        }
+        if (!defines_global(name) && primitive_named(symbol.as_symbol())) {
+            return error("primitive procedures can only be called", symbol);
+        }
+        emit(Op::load_global, global_index(name), 1, symbol);
+    }
+
+    // Expressions in order, the value of the last one left on the stack
+    void compile_sequence(std::span<const Datum> forms, bool tail, const Datum& datum) {
+        if (forms.empty()) return emit(Op::push_unspecified, 0, 1, datum);
+        for (std::size_t i = 0; i < forms.size(); i++) {
+            bool last = i + 1 == forms.size();
+            compile(forms[i], tail && last);
+            if (!last) emit(Op::pop, 0, -1, forms[i]);
+        }
+    }
+
+    // The name and value of (define name value) or (define (name params...) body...)
+    struct Definition {
+        Datum name;
+        std::optional<Datum> params{};  // for the second form
+        std::vector<Datum> rest{};       // value, or body
+    };
+
+    auto definition(std::span<const Datum> items, const Datum& datum) -> std::optional<Definition> {
+        if (items.size() >= 3 && items[1].is_pair()) {
+            const auto& signature = items[1].as_pair();
+            if (signature.car.tag() != reader::Tag::symbol) {
+                error("bad definition", datum);
+                return std::nullopt;
+            }
+            return Definition{signature.car, signature.cdr, {items.begin() + 2, items.end()}};
+        }
+        if (items.size() != 3 || items[1].tag() != reader::Tag::symbol) {
+            error("bad definition", datum);
+            return std::nullopt;
+        }
+        return Definition{items[1], std::nullopt, {items[2]}};
+    }
+
+    auto is_definition(const Datum& form) -> bool {
+        return form.is_pair() && form.as_pair().car.tag() == reader::Tag::symbol &&
+               id_of(form.as_pair().car) == m_define;
+    }
+
+    void compile_definition_value(const Definition& definition, const Datum& datum) {
+        if (definition.params) {
+            compile_function(definition.name.as_symbol(), *definition.params, definition.rest,
+                             datum);
+        } else {
+            compile(definition.rest.front(), false);
+        }
+    }
+
+    // A body: definitions first, which see each other and may refer to each other, then the
+    // expressions. Closures can capture the defined variables before they are assigned, so they
+    // live in boxes.
+    void compile_body(std::span<const Datum> forms, bool tail, const Datum& datum) {
+        auto locals = scope().locals.size();
+        std::vector<std::pair<Definition, uint32_t>> definitions{};
+        std::size_t i = 0;
+        for (; i < forms.size() && is_definition(forms[i]); i++) {
+            auto items = elements(forms[i]);
+            auto parsed = items ? definition(*items, forms[i]) : std::nullopt;
+            if (!parsed) return;
+            auto slot = declare(id_of(parsed->name), true);
+            emit(Op::make_box, slot, 0, forms[i]);
+            definitions.emplace_back(std::move(*parsed), slot);
+        }
+        for (const auto& [parsed, slot] : definitions) {
+            compile_definition_value(parsed, datum);
+            emit(Op::store_boxed, slot, -1, datum);
+        }
+        if (i == forms.size()) return error("body without an expression", datum);
+        compile_sequence(forms.subspan(i), tail, datum);
+        release(locals);
+    }
+
+    // Compile a function of the parameters, a list of symbols, and make a closure of it
+    void compile_function(std::string_view name, const Datum& params, std::span<const Datum> body,
+                          const Datum& datum) {
+        auto names = elements(params);
+        if (!names) return error("rest parameters are not supported", datum);
+        compile_function(name, std::span<const Datum>{*names}, body, datum);
+    }
+
+    void compile_function(std::string_view name, std::span<const Datum> params,
+                          std::span<const Datum> body, const Datum& datum) {
+        for (const auto& param : params) {
+            if (param.tag() != reader::Tag::symbol) return error("bad parameter list", datum);
+        }
+
+        auto index = static_cast<uint32_t>(m_program.functions.size());
+        m_program.functions.push_back(bytecode::Function{
+            .name = std::string{name}, .arity = static_cast<uint32_t>(params.size())});
+        m_scopes.push_back(Scope{.function = index});
+        for (const auto& param : params) {
+            auto id = id_of(param);
+            auto same = [id](const Local& local) { return local.name == id; };
+            if (std::ranges::any_of(scope().locals, same)) {
+                error("duplicate parameter", datum);
+            }
+            declare(id, false);
+        }
+        compile_body(body, true, datum);
+        emit(Op::return_, 0, -1, datum);
+        m_scopes.pop_back();
+
+        emit(Op::make_closure, index, 1, datum);
+    }
+
+    void compile_if(std::span<const Datum> items, bool tail, const Datum& datum) {
+        if (items.size() != 3 && items.size() != 4) return error("bad if", datum);
+        compile(items[1], false);
+        auto to_else = here();
+        emit(Op::jump_if_false, 0, -1, datum);
+        compile(items[2], tail);
+        auto to_end = here();
+        emit(Op::jump, 0, 0, datum);
+        scope().depth--;  // the branches leave their value in the same place
+
+        patch(to_else, here());
+        if (items.size() == 4) {
+            compile(items[3], tail);
+        } else {
+            emit(Op::push_unspecified, 0, 1, datum);
+        }
+        patch(to_end, here());
+    }
+
+    // (let ((name init)...) body...), or the named let (let loop ((name init)...) body...)
+    void compile_let(std::span<const Datum> items, bool tail, const Datum& datum) {
+        bool named = items.size() >= 2 && items[1].tag() == reader::Tag::symbol;
+        auto rest = items.subspan(named ? 2 : 1);
+        auto bindings = rest.empty() ? std::nullopt : elements(rest.front());
+        if (!bindings || rest.size() < 2) return error("bad let", datum);
+
+        std::vector<Datum> names{};
+        std::vector<Datum> inits{};
+        for (const auto& binding : *bindings) {
+            auto pair = elements(binding);
+            if (!pair || pair->size() != 2 || (*pair)[0].tag() != reader::Tag::symbol) {
+                return error("bad let binding", binding);
+            }
+            names.push_back((*pair)[0]);
+            inits.push_back((*pair)[1]);
+        }
+        auto body = rest.subspan(1);
+        auto locals = scope().locals.size();
+
+        if (named) {
+            // a procedure of the bindings, bound to the name within its own body only, and
+            // called with the inits
+            auto loop = declare(id_of(items[1]), true);
+            emit(Op::make_box, loop, 0, datum);
+            compile_function(items[1].as_symbol(), std::span<const Datum>{names}, body, datum);
+            emit(Op::store_boxed, loop, -1, datum);
+            emit(Op::load_boxed, loop, 1, datum);
+            scope().locals.pop_back();  // keeps the slot, hiding the name from the inits
+            for (const auto& init : inits) compile(init, false);
+            auto argc = static_cast<uint32_t>(inits.size());
+            emit(tail ? Op::tail_call : Op::call, argc, -static_cast<int>(argc), datum);
+            scope().slots = loop;
+            return;
+        }
+
+        for (const auto& init : inits) compile(init, false);
+        std::vector<uint32_t> slots{};
+        for (const auto& name : names) slots.push_back(declare(id_of(name), false));
+        for (auto slot : slots | std::views::reverse) emit(Op::store_local, slot, -1, datum);
+        compile_body(body, tail, datum);
+        release(locals);
+    }
+
+    // Call of a primitive: its operands then its instruction, or for + - and * folded left
+    void compile_primitive(Primitive primitive, std::span<const Datum> args, const Datum& datum) {
+        auto op = primitive.op;
+        if (op == Op::list) {
+            for (const auto& arg : args) compile(arg, false);
+            auto count = static_cast<int>(args.size());
+            return emit(Op::list, static_cast<uint32_t>(count), 1 - count, datum);
+        }
+        if (primitive.arity != any_arity) {
+            if (args.size() != static_cast<std::size_t>(primitive.arity)) {
+                return error(primitive.arity == 1 ? "expects one argument"
+                                                  : "expects two arguments",
+                             datum);
+            }
+            for (const auto& arg : args) compile(arg, false);
+            return emit(op, 0, 1 - primitive.arity, datum);
+        }
+        if (args.empty()) {
+            if (op == Op::sub) return error("- expects at least one argument", datum);
+            return emit(Op::push_fixnum, op == Op::mul ? 1 : 0, 1, datum);
+        }
+        if (op == Op::sub && args.size() == 1) emit(Op::push_fixnum, 0, 1, datum);
+        compile(args.front(), false);
+        if (op == Op::sub && args.size() == 1) emit(Op::sub, 0, -1, datum);
+        for (const auto& arg : args.subspan(1)) {
+            compile(arg, false);
+            emit(op, 0, -1, datum);
+        }
+    }
+
+    void compile_form(const Datum& datum, bool tail) {
+        auto items = elements(datum);
+        if (!items) return error("not a proper list", datum);
+        const auto& head = items->front();
+
+        if (head.tag() == reader::Tag::symbol) {
+            auto name = id_of(head);
+            if (name == m_define) return error("definition in expression context", datum);
+            if (name == m_lambda) {
+                if (items->size() < 3) return error("bad lambda", datum);
+                return compile_function("lambda", (*items)[1], std::span{*items}.subspan(2),
+                                        datum);
+            }
+            if (name == m_if) return compile_if(*items, tail, datum);
+            if (name == m_let) return compile_let(*items, tail, datum);
+            if (name == m_begin) {
+                return compile_sequence(std::span{*items}.subspan(1), tail, datum);
+            }
+            auto primitive = primitive_named(head.as_symbol());
+            if (primitive && !defines_global(name) && !resolve(name)) {
+                return compile_primitive(*primitive, std::span{*items}.subspan(1), datum);
+            }
+        }
+
+        for (const auto& item : *items) compile(item, false);
+        auto argc = static_cast<uint32_t>(items->size() - 1);
+        emit(tail ? Op::tail_call : Op::call, argc, -static_cast<int>(argc), datum);
+    }
+
+    void compile(const Datum& datum, bool tail) {
+        switch (datum.tag()) {
+            case reader::Tag::integer:
+                return compile_fixnum(datum.as_integer(), datum);
+            case reader::Tag::symbol:
+                return compile_reference(datum);
+            case reader::Tag::pair:
+                return compile_form(datum, tail);
+            case reader::Tag::nil:
+                return error("empty combination", datum);
+            case reader::Tag::vector:
+                return error("vectors are not supported", datum);
+            case reader::Tag::rational:
+            case reader::Tag::real:
+            case reader::Tag::big:
+                return error("only fixnums are supported", datum);
+        }
+    }
+
+   public:
+    auto compile_program(std::span<const Datum> forms)
+        -> std::expected<bytecode::Program, CompileError> {
+        // globals defined anywhere at the top level shadow primitives everywhere
+        for (const auto& form : forms) {
+            auto items = is_definition(form) ? elements(form) : std::nullopt;
+            auto parsed = items ? definition(*items, form) : std::nullopt;
+            if (!parsed) continue;
+            auto name = id_of(parsed->name);
+            if (name >= m_defined_globals.size()) m_defined_globals.resize(name + 1);
+            m_defined_globals[name] = true;
+            global_index(name);
+        }
+
+        m_program.entry = 0;
+        m_program.functions.push_back(bytecode::Function{.name = "top-level"});
+        m_scopes.push_back(Scope{.function = 0});
+        Datum none{};
+        if (forms.empty()) emit(Op::push_unspecified, 0, 1, none);
+        for (std::size_t i = 0; i < forms.size(); i++) {
+            bool last = i + 1 == forms.size();
+            if (is_definition(forms[i])) {
+                auto items = elements(forms[i]);
+                auto parsed = items ? definition(*items, forms[i]) : std::nullopt;
+                if (!parsed) break;
+                compile_definition_value(*parsed, forms[i]);
+                emit(Op::store_global, global_index(id_of(parsed->name)), -1, forms[i]);
+                if (last) emit(Op::push_unspecified, 0, 1, forms[i]);
+            } else {
+                compile(forms[i], last);
+                if (!last) emit(Op::pop, 0, -1, forms[i]);
+            }
+        }
+        emit(Op::return_, 0, -1, none);
+        m_scopes.pop_back();
+
+        if (m_error) return std::unexpected(std::move(*m_error));
+        return std::move(m_program);
+    }
+};
+
+}  // namespace detail
+
+// Compile top level forms into a program running them in order. Supported are define, lambda,
+// if, let (named let too), begin, and fixnum arithmetic and comparison.
+inline auto compile(std::span<const reader::Datum> forms)
+    -> std::expected<bytecode::Program, CompileError> {
+    return detail::Compiler{}.compile_program(forms);
+}
+
+}  // namespace compiler
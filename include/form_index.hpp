@@ -0,0 +1,245 @@
+// form_index.hpp
+// byte ranges of the top-level forms of a source, found without lexing it
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "simd_scan.hpp"
+
+namespace lexer {
+
+namespace detail {
+
+// Bits at and above pos, none once pos is past the block
+constexpr auto bits_from(std::size_t pos) -> uint64_t {
+    return pos < scan::structural_block_size ? ~uint64_t{0} << pos : 0;
+}
+
+// Bits in [first, last)
+constexpr auto bits_between(std::size_t first, std::size_t last) -> uint64_t {
+    return bits_from(first) & ~bits_from(last);
+}
+
+// Each bit the parity of the bits up to and including it
+constexpr auto prefix_xor(uint64_t bits) -> uint64_t {
+    for (unsigned shift = 1; shift < 64; shift *= 2) bits ^= bits << shift;
+    return bits;
+}
+
+// FormScanner
+// Walks a source block by block, from the masks of scan::classify_block, and reports the span of
+// each top-level form as it closes. The bytes of strings, comments and escapes are resolved first,
+// carrying across blocks, so that the parens left are structural; depth is then tracked by
+// counting those, and a block that cannot close the open list is skipped on its popcounts alone.
+class FormScanner {
+   private:
+    // carried from one block to the next
+    bool m_in_string{false};
+    bool m_in_comment{false};
+    bool m_escape_next{false};
+    bool m_form_open{false};
+    std::size_t m_depth{0};
+    std::size_t m_form_start{0};
+
+    // The structural bytes the parens and whitespace of the block leave
+    struct Layout {
+        uint64_t open;
+        uint64_t close;
+        uint64_t space;
+    };
+
+    // Strings run from a quote to the next unescaped one, a comment from a ; outside a string to
+    // the end of its line, and a backslash outside either escapes the byte after it, as in #\(.
+    // Mostly only quotes, or nothing, need resolving, by prefix parity; otherwise the block is
+    // stepped through one special byte at a time.
+    auto resolve(const scan::StructuralMasks& masks) -> Layout {
+        uint64_t quiet = 0;    // in a string, or escaped
+        uint64_t comment = 0;  // counts as whitespace
+        std::size_t pos = 0;
+        if (m_escape_next) {
+            m_escape_next = false;
+            quiet |= 1;
+            pos = 1;
+        }
+
+        if (!m_in_comment && (masks.semicolon | masks.backslash) == 0) {
+            uint64_t in_string = prefix_xor(masks.quote & bits_from(pos)) ^
+                                 (m_in_string ? ~uint64_t{0} : 0);
+            quiet |= (in_string | masks.quote) & bits_from(pos);
+            m_in_string = (in_string >> 63U) != 0;
+        } else {
+            while (pos < scan::structural_block_size) {
+                uint64_t ahead = bits_from(pos);
+                if (m_in_comment) {
+                    uint64_t line_break = masks.line_break & ahead;
+                    auto end = line_break != 0
+                                   ? static_cast<std::size_t>(std::countr_zero(line_break))
+                                   : scan::structural_block_size;
+                    comment |= bits_between(pos, end);
+                    m_in_comment = line_break == 0;
+                    pos = end;
+                } else if (m_in_string) {
+                    uint64_t special = (masks.quote | masks.backslash) & ahead;
+                    auto at = special != 0 ? static_cast<std::size_t>(std::countr_zero(special))
+                                           : scan::structural_block_size;
+                    bool escape = special != 0 && ((masks.backslash >> at) & 1) != 0;
+                    auto end = at + (escape ? 2 : 1);
+                    quiet |= bits_between(pos, end);
+                    m_in_string = escape || special == 0;
+                    m_escape_next = escape && end > scan::structural_block_size;
+                    pos = end;
+                } else {
+                    uint64_t special = (masks.quote | masks.backslash | masks.semicolon) & ahead;
+                    if (special == 0) break;
+                    auto at = static_cast<std::size_t>(std::countr_zero(special));
+                    uint64_t bit = uint64_t{1} << at;
+                    if ((masks.backslash & bit) != 0) {
+                        quiet |= bits_between(at + 1, at + 2);
+                        m_escape_next = at + 1 == scan::structural_block_size;
+                        pos = at + 2;
+                    } else if ((masks.quote & bit) != 0) {
+                        quiet |= bit;
+                        m_in_string = true;
+                        pos = at + 1;
+                    } else {
+                        m_in_comment = true;
+                        pos = at;
+                    }
+                }
+            }
+        }
+
+        return Layout{.open = masks.open & ~quiet & ~comment,
+                      .close = masks.close & ~quiet & ~comment,
+                      .space = (masks.whitespace & ~quiet) | comment};
+    }
+
+   public:
+    // Scan the block at base, the offset of its first byte, passing emit the offset and length of
+    // each form that ends in it
+    template <typename Emit>
+    void scan_block(const char* block, std::size_t base, Emit& emit) {
+        auto [open, close, space] = resolve(scan::classify_block(block));
+        auto form = [&](std::size_t end) {
+            emit(m_form_start, base + end - m_form_start);
+            m_form_open = false;
+        };
+
+        std::size_t pos = 0;
+        while (pos < scan::structural_block_size) {
+            uint64_t ahead = bits_from(pos);
+            if (m_depth > 0) {
+                // the list stays open past the block unless it has enough closes in it
+                if (m_depth > static_cast<std::size_t>(std::popcount(close & ahead))) {
+                    m_depth += std::popcount(open & ahead);
+                    m_depth -= std::popcount(close & ahead);
+                    return;
+                }
+                uint64_t parens = (open | close) & ahead;
+                while (parens != 0 && m_depth > 0) {
+                    auto at = static_cast<std::size_t>(std::countr_zero(parens));
+                    m_depth = ((open >> at) & 1) != 0 ? m_depth + 1 : m_depth - 1;
+                    parens &= parens - 1;
+                    pos = at + 1;
+                }
+                if (m_depth > 0) return;
+                form(pos);
+            } else if (m_form_open) {
+                // an atom, or the prefix of a list such as #( or #u8(
+                uint64_t delimiters = (space | open | close) & ahead;
+                if (delimiters == 0) return;
+                auto at = static_cast<std::size_t>(std::countr_zero(delimiters));
+                if (((open >> at) & 1) != 0) {
+                    m_depth = 1;
+                    pos = at + 1;
+                } else {
+                    form(at);
+                    pos = at;
+                }
+            } else {
+                uint64_t datum = ~space & ahead;
+                if (datum == 0) return;
+                auto at = static_cast<std::size_t>(std::countr_zero(datum));
+                m_form_open = true;
+                m_form_start = base + at;
+                pos = at + 1;
+                if (((open >> at) & 1) != 0) m_depth = 1;
+                // an unmatched ) stands alone, for the reader to report
+                if (((close >> at) & 1) != 0) form(pos);
+            }
+        }
+    }
+
+    // At the end of the source, size bytes long: a form still open runs to the end
+    template <typename Emit>
+    void finish(std::size_t size, Emit& emit) {
+        if (m_form_open) emit(m_form_start, size - m_form_start);
+        m_form_open = false;
+    }
+};
+
+}  // namespace detail
+
+// FormIndex
+// The top-level forms of a source, as the slices of it they span, found by a structural pass that
+// does not lex: the source is classified 64 bytes at a time with vector compares, and forms are
+// delimited by paren depth, outside strings, ; comments and #\ characters. The slices form a
+// random access range, each of which lexes on its own with lexer::lex, so a caller can lex and
+// read only the forms it needs, or go straight to the nth. Token offsets are then relative to the
+// form; offset(n) is where it starts in the source.
+// A top-level atom is a form of its own, prefixes such as #, ' and #u8 go with the list they open,
+// and an unmatched ) is a form of one byte. A form left open runs to the end of the source.
+// Block comments #| |# and datum comments #; are not recognised. The source is not owned.
+class FormIndex {
+   private:
+    std::string_view m_source{};
+    std::vector<std::string_view> m_forms{};
+
+   public:
+    FormIndex() = default;
+    explicit FormIndex(std::string_view source) : m_source{source} {
+        detail::FormScanner scanner{};
+        auto emit = [this](std::size_t offset, std::size_t length) {
+            m_forms.push_back(m_source.substr(offset, length));
+        };
+
+        constexpr auto block_size = scan::structural_block_size;
+        std::size_t base = 0;
+        for (; source.size() - base >= block_size; base += block_size) {
+            scanner.scan_block(source.data() + base, base, emit);
+        }
+        // the last block padded with whitespace, which ends any atom at the end of the source
+        if (base < source.size()) {
+            std::array<char, block_size> tail{};
+            tail.fill(' ');
+            std::ranges::copy(source.substr(base), tail.begin());
+            scanner.scan_block(tail.data(), base, emit);
+        }
+        scanner.finish(source.size(), emit);
+    }
+
+    [[nodiscard]] auto size() const -> std::size_t { return m_forms.size(); }
+    [[nodiscard]] auto empty() const -> bool { return m_forms.empty(); }
+
+    // The text of the nth form
+    [[nodiscard]] auto operator[](std::size_t n) const -> std::string_view { return m_forms[n]; }
+
+    // Where the nth form starts in the source, to add to the offsets of its tokens
+    [[nodiscard]] auto offset(std::size_t n) const -> uint32_t {
+        return static_cast<uint32_t>(m_forms[n].data() - m_source.data());
+    }
+
+    [[nodiscard]] auto begin() const { return m_forms.begin(); }
+    [[nodiscard]] auto end() const { return m_forms.end(); }
+
+    [[nodiscard]] auto source() const -> std::string_view { return m_source; }
+};
+
+}  // namespace lexer
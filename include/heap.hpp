@@ -0,0 +1,397 @@
+// heap.hpp
+// generational copying garbage collector for the values of the VM
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <ranges>
+#include <span>
+#include <utility>
+#include <vector>
+
+#include "bytecode.hpp"
+#include "value.hpp"
+
+namespace gc {
+
+using vm::Box;
+using vm::Closure;
+using vm::Pair;
+using vm::Value;
+
+enum class Kind : uint8_t { pair, box, closure, forwarded };
+
+// Every object follows a header giving its kind and size, so the collector can copy it without
+// knowing its type. A copied object's kind becomes forwarded and its first word the copy's address.
+struct alignas(8) Header {
+    uint32_t size;  // of the object, not counting the header
+    Kind kind;
+    bool remembered;  // in the remembered set
+    uint8_t epoch;    // of the last major collection before the object was allocated or copied
+};
+
+static_assert(sizeof(Header) == 8 && alignof(Value) <= alignof(Header) &&
+              sizeof(Pair) >= sizeof(void*));
+
+struct Stats {
+    uint64_t allocations{0};
+    uint64_t bytes_allocated{0};
+    uint64_t minor_collections{0};
+    uint64_t major_collections{0};
+    uint64_t bytes_promoted{0};  // copied from the nursery to the old generation
+    uint64_t old_bytes{0};       // in the old generation, including promoted garbage
+    std::chrono::nanoseconds minor_pause_total{0};
+    std::chrono::nanoseconds minor_pause_max{0};
+    std::chrono::nanoseconds major_pause_total{0};
+    std::chrono::nanoseconds major_pause_max{0};
+};
+
+// Heap
+// Precise, moving, generational heap of pairs, boxes and closures. Objects are allocated by
+// bumping a pointer through the nursery. When it fills, a minor collection copies the objects
+// reachable from the roots or from remembered old objects into the old generation and empties the
+// nursery, so a minor collection costs only what survives it. The old generation is a list of
+// blocks, and once it has grown to twice its size after the last major collection, a major
+// collection copies everything reachable into fresh blocks and frees the rest.
+//
+// Collection moves objects, so pointers into the heap are only valid until the next allocation,
+// except those in registered roots, which the collector updates. Storing a value into an object
+// that may be old must go through store(), which remembers old objects pointing to young ones.
+class Heap {
+   private:
+    static constexpr std::size_t block_size = std::size_t{1} << 20U;
+    static constexpr std::size_t min_major_threshold = std::size_t{4} << 20U;
+
+    struct Block {
+        std::unique_ptr<std::byte[]> data;  // NOLINT
+        std::size_t size;
+        std::size_t used;
+    };
+
+    // Values from base up to wherever top points when a collection starts
+    struct Stack {
+        Value* base;
+        Value* const* top;
+    };
+
+    std::unique_ptr<std::byte[]> m_nursery;  // NOLINT
+    std::byte* m_nursery_end;
+    std::byte* m_next;
+    std::vector<Block> m_old{};
+    std::vector<Block> m_spare{};  // emptied blocks, to allocate from again
+    std::size_t m_major_threshold{min_major_threshold};
+    uint8_t m_epoch{0};
+    std::vector<Header*> m_remembered{};
+    std::vector<Value*> m_roots{};
+    std::vector<std::span<Value>> m_root_spans{};
+    std::vector<Stack> m_stacks{};
+    Stats m_stats{};
+
+    static auto header_of(const void* object) -> Header* {
+        return reinterpret_cast<Header*>(const_cast<std::byte*>(  // NOLINT
+                   static_cast<const std::byte*>(object))) -
+               1;
+    }
+
+    static auto padded(std::size_t size) -> std::size_t {
+        return (size + alignof(Header) - 1) & ~(alignof(Header) - 1);
+    }
+
+    [[nodiscard]] auto is_young(const void* object) const -> bool {
+        const auto* p = static_cast<const std::byte*>(object);
+        return p >= m_nursery.get() && p < m_nursery_end;
+    }
+
+    auto add_block(std::size_t min_size) -> Block& {
+        if (min_size <= block_size && !m_spare.empty()) {
+            m_old.push_back(std::move(m_spare.back()));
+            m_spare.pop_back();
+        } else {
+            auto size = std::max(block_size, min_size);
+            m_old.push_back(
+                Block{std::make_unique_for_overwrite<std::byte[]>(size), size, 0});  // NOLINT
+        }
+        return m_old.back();
+    }
+
+    // Room for an object of size bytes and its header at the end of the old generation
+    auto allocate_old(std::size_t size) -> Header* {
+        auto total = sizeof(Header) + size;
+        auto* block = m_old.empty() ? nullptr : &m_old.back();
+        if (block == nullptr || block->size - block->used < total) block = &add_block(total);
+        auto* header = reinterpret_cast<Header*>(block->data.get() + block->used);  // NOLINT
+        block->used += total;
+        m_stats.old_bytes += total;
+        return header;
+    }
+
+    // The copy of object, copying it first unless it was already; objects that stay put are
+    // their own copy
+    template <bool major>
+    auto forward(const void* object) -> void* {
+        auto* header = header_of(object);
+        if constexpr (major) {
+            if (header->epoch == m_epoch) return const_cast<void*>(object);  // NOLINT
+        } else {
+            if (!is_young(object)) return const_cast<void*>(object);  // NOLINT
+        }
+        void* copy{};
+        if (header->kind == Kind::forwarded) {
+            std::memcpy(static_cast<void*>(&copy), object, sizeof(copy));
+            return copy;
+        }
+
+        auto* copied = allocate_old(header->size);
+        std::memcpy(copied, header, sizeof(Header) + header->size);
+        copied->remembered = false;
+        copied->epoch = m_epoch;
+        copy = copied + 1;
+        if (header->kind == Kind::closure) {
+            auto* closure = static_cast<Closure*>(copy);
+            closure->captures = reinterpret_cast<Value*>(closure + 1);  // NOLINT
+        }
+        if constexpr (!major) m_stats.bytes_promoted += sizeof(Header) + header->size;
+        header->kind = Kind::forwarded;
+        std::memcpy(const_cast<void*>(object), static_cast<const void*>(&copy),  // NOLINT
+                    sizeof(copy));
+        return copy;
+    }
+
+    template <bool major>
+    void forward(Value& value) {
+        if (value.is_object()) value = value.moved_to(forward<major>(value.as_object()));
+    }
+
+    template <bool major>
+    void forward_fields(Header* header) {
+        auto* object = header + 1;
+        switch (header->kind) {
+            case Kind::pair: {
+                auto* pair = reinterpret_cast<Pair*>(object);  // NOLINT
+                forward<major>(pair->car);
+                forward<major>(pair->cdr);
+                break;
+            }
+            case Kind::box:
+                forward<major>(reinterpret_cast<Box*>(object)->value);  // NOLINT
+                break;
+            case Kind::closure: {
+                auto* closure = reinterpret_cast<Closure*>(object);  // NOLINT
+                auto count = (header->size - sizeof(Closure)) / sizeof(Value);
+                for (auto& capture : std::span{closure->captures, count}) forward<major>(capture);
+                break;
+            }
+            case Kind::forwarded:
+                break;
+        }
+    }
+
+    // Copy what the roots reach, then the objects copied objects reach, scanning the old
+    // generation from the first copy (block, offset) to its end as copying extends it
+    template <bool major>
+    void copy_reachable(std::size_t block, std::size_t offset) {
+        for (auto* root : m_roots) forward<major>(*root);
+        for (auto roots : m_root_spans) {
+            for (auto& root : roots) forward<major>(root);
+        }
+        for (auto stack : m_stacks) {
+            for (auto* it = stack.base; it != *stack.top; it++) forward<major>(*it);
+        }
+        while (block < m_old.size()) {
+            if (offset == m_old[block].used) {
+                if (block + 1 == m_old.size()) break;
+                block++;
+                offset = 0;
+                continue;
+            }
+            auto* header = reinterpret_cast<Header*>(m_old[block].data.get() + offset);  // NOLINT
+            forward_fields<major>(header);
+            offset += sizeof(Header) + header->size;
+        }
+    }
+
+    static void record_pause(std::chrono::steady_clock::time_point start,
+                             std::chrono::nanoseconds& total, std::chrono::nanoseconds& max) {
+        auto pause = std::chrono::steady_clock::now() - start;
+        total += pause;
+        max = std::max(max, std::chrono::duration_cast<std::chrono::nanoseconds>(pause));
+    }
+
+    // Collect to make room for an allocation, keeping the values in live, which the caller is
+    // about to store in the new object, up to date
+    void collect_for(std::span<Value> live) {
+        for (auto& value : live) m_roots.push_back(&value);
+        collect_minor();
+        if (m_stats.old_bytes > m_major_threshold) collect_major();
+        m_roots.resize(m_roots.size() - live.size());
+    }
+
+    // Header and storage for an object of size bytes, in the nursery unless it is too big to
+    // fit there, in which case it is allocated old and remembered in case it points to young ones
+    auto allocate(Kind kind, std::size_t size, std::span<Value> live) -> void* {
+        size = padded(size);
+        auto total = sizeof(Header) + size;
+        m_stats.allocations++;
+        m_stats.bytes_allocated += total;
+        Header* header{};
+        if (total > nursery_size() / 4) {
+            if (m_stats.old_bytes + total > m_major_threshold) collect_for(live);
+            header = allocate_old(size);
+            header->remembered = true;
+            m_remembered.push_back(header);
+        } else {
+            if (static_cast<std::size_t>(m_nursery_end - m_next) < total) collect_for(live);
+            header = reinterpret_cast<Header*>(m_next);  // NOLINT
+            m_next += total;
+            header->remembered = false;
+        }
+        header->size = static_cast<uint32_t>(size);
+        header->kind = kind;
+        header->epoch = m_epoch;
+        return header + 1;
+    }
+
+   public:
+    static constexpr std::size_t default_nursery_size = std::size_t{2} << 20U;
+
+    explicit Heap(std::size_t nursery_size = default_nursery_size)
+        : m_nursery{std::make_unique_for_overwrite<std::byte[]>(padded(nursery_size))},  // NOLINT
+          m_nursery_end{m_nursery.get() + padded(nursery_size)},
+          m_next{m_nursery.get()} {}
+
+    // Roots point into the heap
+    Heap(const Heap&) = delete;
+    auto operator=(const Heap&) -> Heap& = delete;
+    Heap(Heap&&) = delete;
+    auto operator=(Heap&&) -> Heap& = delete;
+    ~Heap() = default;
+
+    auto make_pair(Value car, Value cdr) -> Pair* {
+        std::array<Value, 2> fields{car, cdr};
+        auto* pair = allocate(Kind::pair, sizeof(Pair), fields);
+        return std::construct_at(static_cast<Pair*>(pair), Pair{fields[0], fields[1]});
+    }
+
+    auto make_box(Value value) -> Box* {
+        auto* box = allocate(Kind::box, sizeof(Box), std::span{&value, 1});
+        return std::construct_at(static_cast<Box*>(box), Box{value});
+    }
+
+    // Closure of function with its captures unspecified, for the caller to fill in before the
+    // next allocation
+    auto make_closure(const bytecode::Function& function) -> Closure* {
+        auto count = function.captures.size();
+        auto* object = allocate(Kind::closure, sizeof(Closure) + count * sizeof(Value), {});
+        auto* closure = static_cast<Closure*>(object);
+        auto* captures = reinterpret_cast<Value*>(closure + 1);  // NOLINT
+        std::uninitialized_fill_n(captures, count, Value{});
+        return std::construct_at(closure, Closure{&function, captures});
+    }
+
+    // Store value in field, a field of object, remembering object if it is old and value young
+    template <typename T>
+    void store(T* object, Value& field, const Value& value) {
+        field = value;
+        if (!value.is_object() || !is_young(value.as_object()) || is_young(object)) return;
+        auto* header = header_of(object);
+        if (header->remembered) return;
+        header->remembered = true;
+        m_remembered.push_back(header);
+    }
+
+    // Values the collector keeps alive and updates as it moves what they point to. A value is
+    // registered by address, so it must stay put until it is removed.
+    void add_root(Value& root) { m_roots.push_back(&root); }
+    void remove_root(Value& root) {
+        auto it = std::ranges::find(m_roots | std::views::reverse, &root);
+        if (it != m_roots.rend()) m_roots.erase(std::next(it).base());
+    }
+    void add_roots(std::span<Value> roots) { m_root_spans.push_back(roots); }
+    void remove_roots(std::span<Value> roots) {
+        std::erase_if(m_root_spans, [roots](std::span<Value> span) {
+            return span.data() == roots.data() && span.size() == roots.size();
+        });
+    }
+    // The values from base up to *top, for a stack that grows and shrinks between collections
+    void add_stack(Value* base, Value* const* top) { m_stacks.push_back(Stack{base, top}); }
+    void remove_stack(Value* base) {
+        std::erase_if(m_stacks, [base](const Stack& stack) { return stack.base == base; });
+    }
+
+    // Promote everything the roots reach from the nursery and empty it
+    void collect_minor() {
+        auto start = std::chrono::steady_clock::now();
+        auto block = m_old.empty() ? 0 : m_old.size() - 1;
+        auto offset = m_old.empty() ? 0 : m_old.back().used;
+        for (auto* header : m_remembered) {
+            header->remembered = false;
+            forward_fields<false>(header);
+        }
+        m_remembered.clear();
+        copy_reachable<false>(block, offset);
+        m_next = m_nursery.get();
+        m_stats.minor_collections++;
+        record_pause(start, m_stats.minor_pause_total, m_stats.minor_pause_max);
+    }
+
+    // Copy everything the roots reach, young or old, into fresh blocks and free the rest
+    void collect_major() {
+        auto start = std::chrono::steady_clock::now();
+        m_epoch++;
+        auto from = std::exchange(m_old, {});
+        m_stats.old_bytes = 0;
+        for (auto* header : m_remembered) header->remembered = false;
+        m_remembered.clear();
+        copy_reachable<true>(0, 0);
+        m_next = m_nursery.get();
+
+        // keep about as many spare blocks as hold the survivors
+        for (auto& block : from) {
+            if (block.size == block_size && m_spare.size() < m_old.size()) {
+                block.used = 0;
+                m_spare.push_back(std::move(block));
+            }
+        }
+        m_major_threshold = std::max(min_major_threshold, 2 * m_stats.old_bytes);
+        m_stats.major_collections++;
+        record_pause(start, m_stats.major_pause_total, m_stats.major_pause_max);
+    }
+
+    [[nodiscard]] auto stats() const -> const Stats& { return m_stats; }
+    [[nodiscard]] auto nursery_size() const -> std::size_t {
+        return static_cast<std::size_t>(m_nursery_end - m_nursery.get());
+    }
+    [[nodiscard]] auto nursery_used() const -> std::size_t {
+        return static_cast<std::size_t>(m_next - m_nursery.get());
+    }
+};
+
+// Root
+// A value registered as a root for as long as the Root lives, for C++ code holding a value across
+// allocations
+class Root {
+   private:
+    Heap& m_heap;
+    Value m_value;
+
+   public:
+    Root(Heap& heap, Value value) : m_heap{heap}, m_value{value} { m_heap.add_root(m_value); }
+    Root(const Root&) = delete;
+    auto operator=(const Root&) -> Root& = delete;
+    Root(Root&&) = delete;
+    auto operator=(Root&&) -> Root& = delete;
+    ~Root() { m_heap.remove_root(m_value); }
+
+    auto operator*() -> Value& { return m_value; }
+    auto operator*() const -> const Value& { return m_value; }
+    auto operator->() -> Value* { return &m_value; }
+};
+
+}  // namespace gc
@@ -3,172 +3,410 @@
 
 #pragma once
 
+#include <algorithm>
 #include <concepts>
+#include <cstddef>
 #include <cstdint>
 #include <expected>
 #include <iterator>
-#include <optional>
+#include <memory>
 #include <ranges>
 #include <string>
 #include <string_view>
+#include <type_traits>
 #include <utility>
 #include <variant>
 
+#include "lexer_automaton.hpp"
+#include "lexer_stats.hpp"
 #include "lexer_types.hpp"
-#include "match_char.hpp"
+#include "number.hpp"
+#include "simd_scan.hpp"
+#include "source_map.hpp"
+#include "symbol_table.hpp"
 #include "token.hpp"
-#include "util.hpp"
+#include "utf8.hpp"
 
 namespace lexer {
 
+// An input iterator over a buffer filled a block at a time, like io::buffered_source's, that shows
+// the rest of its block and can step past part of it at once
+template <typename I>
+concept BlockIterator = std::input_iterator<I> && requires(I it, std::size_t n) {
+    { std::as_const(it).block() } -> std::same_as<std::string_view>;
+    it.skip(n);
+};
+
 // Lexer
-template <std::ranges::input_range R>
+// Over a contiguous source the lexer runs in span mode: identifier lexemes are string_views into
+// the source rather than owned strings, so the tokens borrow from it. They stay valid for as long
+// as the source does, which for an owning view (e.g. an rvalue std::string) means the Lexer itself.
+// Any other input range is lexed in owning mode, yielding token::Token. Over a BlockIterator the
+// lexer still consumes runs of whitespace and identifier chars a block at a time.
+// Tokens carry byte offsets only; source_map() resolves them to lines and columns on demand.
+// Given a symbol table, identifiers are interned as they are lexed and carry their symbol id; the
+// table must outlive the lexer.
+// Instrument is an instrumentation policy: with CollectStats, stats() counts what lexing has done
+// so far; the default NoStats adds nothing.
+template <std::ranges::input_range R, symbol::Interner Symbols = symbol::NoInterning,
+          StatsPolicy Instrument = NoStats>
     requires std::same_as<std::iter_value_t<std::ranges::iterator_t<R>>, char>
-class Lexer : public std::ranges::view_interface<Lexer<R>> {
+class Lexer : public std::ranges::view_interface<Lexer<R, Symbols, Instrument>> {
    private:
     R m_src;
+    Symbols* m_symbols{nullptr};
+    SourceMap m_source_map{};
+    [[no_unique_address]] Instrument m_instrument{};
 
    public:
+    static constexpr bool span_mode = std::ranges::contiguous_range<R>;
+
+    using lexeme_type = std::conditional_t<span_mode, std::string_view, std::string>;
+    using token_type = token::BasicToken<lexeme_type>;
+    using identifier_type = token::BasicIdentifier<lexeme_type>;
+    using number_type = token::BasicNumber<lexeme_type>;
+
     class Iterator {
        private:
         using r_iter_type = std::ranges::iterator_t<R>;
         using r_end_type = std::ranges::sentinel_t<R>;
+        using result_type = std::expected<token_type, LexError>;
+
+        // lexeme under construction, accumulated char by char
+        struct OwnedLexeme {
+            std::string text{};
+
+            void start(const r_iter_type& /*it*/, char event) { text = event; }
+            void extend(char event) { text += event; }
+            void extend_by(std::string_view chars) { text += chars; }
+            [[nodiscard]] auto length() const -> std::size_t { return text.length(); }
+            [[nodiscard]] auto view() const -> std::string_view { return text; }
+            // drop the lexeme but keep its storage for the next one
+            void clear() { text.clear(); }
+            auto take() -> std::string { return std::exchange(text, {}); }
+            auto take_string() -> std::string { return take(); }
+        };
+
+        // lexeme under construction, a span of the source that is never copied
+        struct SpanLexeme {
+            r_iter_type first{};
+            std::size_t count{0};
+
+            void start(const r_iter_type& it, char /*event*/) {
+                first = it;
+                count = 1;
+            }
+            void extend(char /*event*/) { count++; }
+            void extend_by(std::size_t n) { count += n; }
+            // pick up a lexeme of n chars ending at it
+            void resume(const r_iter_type& it, std::size_t n) {
+                first = it - static_cast<std::iter_difference_t<r_iter_type>>(n);
+                count = n;
+            }
+            [[nodiscard]] auto length() const -> std::size_t { return count; }
+            [[nodiscard]] auto view() const -> std::string_view {
+                return std::string_view{std::to_address(first), count};
+            }
+            void clear() { count = 0; }
+            auto take() -> std::string_view {
+                return std::string_view{std::to_address(first), std::exchange(count, 0)};
+            }
+            auto take_string() -> std::string { return std::string{take()}; }
+        };
 
         r_iter_type m_it{};
         r_end_type m_end{};
+        Symbols* m_symbols{nullptr};
         bool m_at_end{false};
-
-        State m_state{};
-        std::string m_current_lexeme{};
-        uint_fast32_t m_line_number{1};
-        uint_fast32_t m_col_number{0};
+        bool m_yielded_eof{false};
+
+        lexer_automaton::StateId m_state{lexer_automaton::init};
+        std::conditional_t<span_mode, SpanLexeme, OwnedLexeme> m_current_lexeme{};
+        SourceMap* m_source_map{nullptr};
+        // the lexer's policy, held by value when it has no state
+        using policy_type = std::conditional_t<Instrument::enabled, Instrument*, Instrument>;
+        [[no_unique_address]] policy_type m_instrument{};
+        uint_fast32_t m_offset{0};
+        uint_fast32_t m_lexeme_offset{0};
         bool m_had_error{false};
+        bool m_non_ascii{false};  // the lexeme has bytes above 0x7F, to validate as UTF-8
+
+        result_type m_tok{};
+
+        auto instrument() -> Instrument& {
+            if constexpr (Instrument::enabled) {
+                return *m_instrument;
+            } else {
+                return m_instrument;
+            }
+        }
+
+        // Step past n chars of the source
+        void consume(std::size_t n = 1) {
+            if constexpr (std::random_access_iterator<r_iter_type>) {
+                m_it += static_cast<std::iter_difference_t<r_iter_type>>(n);
+            } else {
+                auto started = Instrument::now();
+                if constexpr (BlockIterator<r_iter_type>) {
+                    m_it.skip(n);
+                } else {
+                    for (std::size_t i = 0; i < n; i++) m_it++;  // NOLINT
+                }
+                instrument().add_input_time(started);
+            }
+            m_offset += static_cast<uint_fast32_t>(n);
+            instrument().count_bytes(n);
+        }
+
+        auto intern(std::string_view name) -> symbol::Id {
+            if constexpr (std::same_as<Symbols, symbol::NoInterning>) {
+                return symbol::no_symbol;
+            } else {
+                return m_symbols->intern(name);
+            }
+        }
+
+        // contiguous sources with a sized end can consume whole runs of characters at once
+        static constexpr bool bulk_scan =
+            span_mode && std::sized_sentinel_for<r_end_type, r_iter_type>;
+        // and input-only sources read in blocks, up to the end of the block
+        static constexpr bool block_scan = !span_mode && BlockIterator<r_iter_type>;
+
+        // Consume the whitespace at m_it, the whole run of it if possible
+        void skip_whitespace() {
+            if constexpr (bulk_scan) {
+                const char* first = std::to_address(m_it);
+                consume(static_cast<std::size_t>(
+                    scan::skip_whitespace(first, first + (m_end - m_it)) - first));
+            } else if constexpr (block_scan) {
+                // stop at a line break, which skip_line_break records
+                auto block = m_it.block();
+                const char* first = block.data();
+                const char* run_end = scan::skip_whitespace(first, first + block.size());
+                consume(static_cast<std::size_t>(scan::find_line_break(first, run_end) - first));
+            } else {
+                consume();
+            }
+        }
+
+        void skip_line_break(char event) {
+            if constexpr (span_mode) {
+                // the source map indexes contiguous sources itself
+                skip_whitespace();
+            } else {
+                consume();
+                if (event == '\r' && m_it != m_end && *m_it == '\n') {
+                    consume();  // \r\n is a single line break
+                }
+                // input-only sources cannot be indexed later, so record where the line starts
+                m_source_map->add_line_start(m_offset);
+            }
+        }
+
+        // contiguous sources are decoded by the source map itself
+        void record_continuation_byte(char event) {
+            if constexpr (!span_mode) {
+                if (utf8::is_continuation(event)) {
+                    m_source_map->add_continuation_byte(static_cast<uint32_t>(m_offset));
+                }
+            }
+        }
+
+        void start_lexeme(char event) {
+            m_lexeme_offset = m_offset;
+            m_non_ascii = false;
+            m_current_lexeme.start(m_it, event);
+            consume();
+        }
+
+        // Extend the lexeme under construction by the char at m_it and, where the source allows,
+        // by the whole run after it of chars that can continue an identifier. The char itself
+        // need not be one of those: a number goes on past a #, as in #e#x10.
+        void extend_lexeme(char event) {
+            m_current_lexeme.extend(event);
+            consume();
+            if (m_state != lexer_automaton::identifier && m_state != lexer_automaton::number) {
+                return;
+            }
+            if constexpr (bulk_scan) {
+                const char* first = std::to_address(m_it);
+                auto count = static_cast<std::size_t>(
+                    scan::skip_subsequent(first, first + (m_end - m_it)) - first);
+                consume(count);
+                m_current_lexeme.extend_by(count);
+            } else if constexpr (block_scan) {
+                // up to the end of the block, which is empty at the end of the input
+                auto block = m_it.block();
+                auto count = static_cast<std::size_t>(
+                    scan::skip_subsequent(block.data(), block.data() + block.size()) -
+                    block.data());
+                m_current_lexeme.extend_by(block.substr(0, count));
+                consume(count);
+            }
+        }
+
+        auto take_identifier() -> result_type {
+            auto lexeme = m_current_lexeme.take();
+            auto id = intern(lexeme);
+            return identifier_type{
+                .offset = m_lexeme_offset, .lexeme{std::move(lexeme)}, .symbol_id = id};
+        }
+
+        auto take_error() -> result_type {
+            instrument().count_resynchronisation(m_current_lexeme.length());
+            return std::unexpected(InvalidTokenError{.offset = m_lexeme_offset,
+                                                     .lexeme{m_current_lexeme.take_string()}});
+        }
 
-        std::expected<token::Token, LexError> m_tok{};
-
-        // Advance the state of the Lexer FSM
-        // m_it should be manually incremented when needed
-        // yields Eof when stream has ended
-        auto advance_state() -> LexResult {
-            m_col_number++;
-            
-            if (m_it == m_end) {
-                if (m_tok && std::holds_alternative<token::Eof>(*m_tok)) {
-                    m_at_end = true;
-                    return LexResult{.token{token::Eof{.line_number = m_line_number,
-                                                       .col_number = m_col_number}},
-                                     .state{InitState{}}};
+        // The token of the lexeme the automaton ended in state, of the kind lexeme_kind tells.
+        // Numbers are converted in place; only those too big for machine types copy their text.
+        auto take_lexeme(lexer_automaton::StateId state) -> result_type {
+            auto text = m_current_lexeme.view();
+            switch (lexer_automaton::lexeme_kind(state, text, m_non_ascii)) {
+                case token::Kind::identifier:
+                    return take_identifier();
+                case token::Kind::dot:
+                    m_current_lexeme.clear();
+                    return token::Dot{.offset = m_lexeme_offset};
+                case token::Kind::number: {
+                    auto value = number::parse<lexeme_type>(text);
+                    m_current_lexeme.clear();
+                    return number_type{.offset = m_lexeme_offset,
+                                       .length = static_cast<uint_fast32_t>(text.size()),
+                                       .value{std::move(*value)}};
                 }
-                return LexResult{
-                    .token{token::Eof{.line_number = m_line_number, .col_number = m_col_number}},
-                    .state{InitState{}}};
-            }
-
-            auto event = *m_it;
-
-            auto result = std::visit(
-                util::overloads{
-                    [this, event](const InitState& state) -> LexResult {
-                        if (std::iswspace(event)) {
-                            m_it++;  // NOLINT
-                            return LexResult{.token{std::nullopt}, .state{InitState{}}};
-                        }
-
-                        if (match_char::is_initial(event)) {
-                            m_it++;  // NOLINT
-                            m_current_lexeme = event;
-                            return LexResult{.token{std::nullopt}, .state{IdentifierState{}}};
-                        }
-
-                        switch (event) {
-                            case '(': {
-                                token::LParen tok{.line_number = m_line_number,
-                                                  .col_number = m_col_number};
-                                m_it++;  // NOLINT
-                                return LexResult{.token{tok}, .state{InitState{}}};
-                            }
-
-                            case ')': {
-                                token::RParen tok{.line_number = m_line_number,
-                                                  .col_number = m_col_number};
-                                m_it++;  // NOLINT
-                                return LexResult{.token{tok}, .state{InitState{}}};
-                            }
-
-                            default:
-                                // enter error state and try to resynchronise
-                                m_it++;  // NOLINT
-                                m_current_lexeme = event;
-                                return LexResult{.token{std::nullopt}, .state{ErrorState{}}};
-                        }
-                    },
-
-                    [this, event](const IdentifierState& state) -> LexResult {
-                        if (match_char::is_subsequent(event)) {
-                            m_it++;  // NOLINT
-                            m_current_lexeme += event;
-                            return LexResult{.token{std::nullopt}, .state{IdentifierState{}}};
-                        }
-                        auto result = LexResult{
-                            .token{token::Identifier{.line_number = m_line_number,
-                                                     .col_number = m_col_number - m_current_lexeme.length(),
-                                                     .lexeme{std::move(m_current_lexeme)}}}};
-                        m_current_lexeme = {};
-                        return result;
-                    },
-
-                    [this, event](const ErrorState& state) -> LexResult {
-                        if (match_char::is_delimiter(event)) {
-                            auto result = LexResult{.token{std::unexpected(InvalidTokenError{
-                                                        .line_number = m_line_number,
-                                                        .col_number = m_col_number,
-                                                        .lexeme{std::move(m_current_lexeme)}})},
-                                                    .state{InitState{}}};
-                            m_current_lexeme = {};
-                            return result;
-                        }
-
-                        m_current_lexeme += event;
-                        m_it++;  // NOLINT
-                        return LexResult{.token{std::nullopt}, .state{ErrorState{}}};
-                    },
-
-                },
-                m_state);
-
-            m_state = result.state;
-
-            if (event == '\n') {
-                m_col_number = 1;
-                m_line_number++;
-            }
-
-            return result;
-        }
-
-        // Yield the next token
-        auto parse_token() -> std::expected<token::Token, LexError> {
-            while (true) {
-                auto result = advance_state();
-                if (result.token) {
-                    return *result.token;
+                default:
+                    return take_error();
+            }
+        }
+
+        // Run the automaton up to its next token: one table lookup per char, and a token
+        // only on the transitions that emit one
+        auto parse_token() -> result_type {
+            using lexer_automaton::Action;
+
+            while (m_it != m_end) {
+                auto event = *m_it;
+                instrument().count_step(m_state);
+                auto [next, action] = lexer_automaton::transition(m_state, event);
+                auto state = std::exchange(m_state, next);
+
+                switch (action) {
+                    case Action::skip:
+                        skip_whitespace();
+                        break;
+                    case Action::skip_line_break:
+                        skip_line_break(event);
+                        break;
+                    case Action::start_lexeme:
+                        start_lexeme(event);
+                        break;
+                    case Action::extend_lexeme:
+                        extend_lexeme(event);
+                        break;
+                    case Action::start_non_ascii:
+                        record_continuation_byte(event);
+                        start_lexeme(event);
+                        m_non_ascii = true;
+                        break;
+                    case Action::extend_non_ascii:
+                        record_continuation_byte(event);
+                        m_non_ascii = true;
+                        m_current_lexeme.extend(event);
+                        consume();
+                        break;
+                    case Action::emit_lparen: {
+                        token::LParen tok{.offset = m_offset};
+                        consume();
+                        return tok;
+                    }
+                    case Action::emit_rparen: {
+                        token::RParen tok{.offset = m_offset};
+                        consume();
+                        return tok;
+                    }
+                    case Action::emit_vector_open: {
+                        token::VectorOpen tok{.offset = m_lexeme_offset};
+                        m_current_lexeme.clear();
+                        consume();
+                        return tok;
+                    }
+                    case Action::emit_identifier:
+                    case Action::emit_number:
+                    case Action::emit_error:
+                        return take_lexeme(state);
                 }
             }
+
+            // the end of the source delimits the lexeme under construction too
+            auto state = std::exchange(m_state, lexer_automaton::init);
+            if (state != lexer_automaton::init) return take_lexeme(state);
+
+            // yield Eof once, then compare equal to the end
+            m_at_end = m_yielded_eof;
+            m_yielded_eof = true;
+            return token::Eof{.offset = m_offset};
+        }
+
+        // The next token, counted and timed by the instrumentation
+        auto next_token() -> result_type {
+            auto started = Instrument::now();
+            auto tok = parse_token();
+            // the end is not a token
+            if (!m_at_end) {
+                instrument().count_token(tok ? token::kind_of(*tok) : token::Kind::error);
+            }
+            instrument().add_lexing_time(started);
+            return tok;
+        }
+
+        // the pointer to the lexer's policy, if the iterator holds one
+        static auto policy(Instrument* instrument) -> policy_type {
+            if constexpr (Instrument::enabled) {
+                return instrument;
+            } else {
+                return {};
+            }
         }
 
        public:
-        Iterator(r_iter_type begin, r_end_type end)
-            : m_it{std::move(begin)}, m_end{std::move(end)}, m_tok{parse_token()} {}
+        Iterator(r_iter_type begin, r_end_type end, Symbols* symbols, SourceMap* source_map,
+                 Instrument* instrument)
+            : m_it{std::move(begin)},
+              m_end{std::move(end)},
+              m_symbols{symbols},
+              m_source_map{source_map},
+              m_instrument{policy(instrument)},
+              m_tok{next_token()} {}
+
+        // Resume lexing at a checkpoint, with begin at the checkpoint's offset
+        Iterator(r_iter_type begin, r_end_type end, Symbols* symbols, SourceMap* source_map,
+                 Instrument* instrument, const Checkpoint& from)
+            requires span_mode
+            : m_it{std::move(begin)},
+              m_end{std::move(end)},
+              m_symbols{symbols},
+              m_state{static_cast<lexer_automaton::StateId>(from.state.index())},
+              m_source_map{source_map},
+              m_instrument{policy(instrument)},
+              m_offset{from.offset},
+              m_lexeme_offset{from.lexeme_offset} {
+            if (m_state != lexer_automaton::init) {
+                m_current_lexeme.resume(m_it, from.offset - from.lexeme_offset);
+                m_non_ascii = true;  // not known, so validate the lexeme in any case
+            }
+            m_tok = next_token();
+        }
 
         // Iterator boilerplate
         using difference_type = std::ptrdiff_t;
-        using value_type = std::expected<token::Token, LexError>;
+        using value_type = result_type;
         using iterator_concept = std::input_iterator_tag;
 
-        auto operator*() const -> const std::expected<token::Token, LexError>& { return m_tok; }
+        auto operator*() const -> const result_type& { return m_tok; }
 
         auto operator++() -> Iterator& {
-            m_tok = parse_token();
+            m_tok = next_token();
             return *this;
         }
 
@@ -181,16 +419,69 @@ class Lexer : public std::ranges::view_interface<Lexer<R>> {
 
     Lexer() = default;
     explicit Lexer(R src) : m_src{std::move(src)} {}
+    Lexer(R src, Symbols& symbols) : m_src{std::move(src)}, m_symbols{&symbols} {}
+
+    auto begin() {
+        if constexpr (span_mode) {
+            m_source_map = SourceMap{std::string_view{std::ranges::data(m_src),
+                                                      std::ranges::size(m_src)}};
+        } else {
+            m_source_map = SourceMap{};
+        }
+        return Iterator{std::ranges::begin(m_src), std::ranges::end(m_src), m_symbols,
+                        &m_source_map, &m_instrument};
+    }
+    // Start lexing at a checkpoint taken over the same source instead of its beginning.
+    // Every token start is a checkpoint in InitState.
+    auto begin_at(const Checkpoint& from)
+        requires span_mode
+    {
+        m_source_map = SourceMap{std::string_view{std::ranges::data(m_src),
+                                                  std::ranges::size(m_src)}};
+        auto first = std::ranges::begin(m_src) +
+                     static_cast<std::ranges::range_difference_t<R>>(from.offset);
+        return Iterator{first, std::ranges::end(m_src), m_symbols, &m_source_map, &m_instrument,
+                        from};
+    }
 
-    auto begin() { return Iterator{std::ranges::begin(m_src), std::ranges::end(m_src)}; }
     auto end() { return std::default_sentinel; }
+
+    // Resolves the offsets of the tokens lexed so far to lines and columns
+    [[nodiscard]] auto source_map() const -> const SourceMap& { return m_source_map; }
+
+    // What lexing has done so far
+    [[nodiscard]] auto stats() const -> const Stats&
+        requires Instrument::enabled
+    {
+        return m_instrument.stats();
+    }
+};
+
+// src | lex(symbols): lex and intern identifiers into symbols
+template <symbol::Interner Symbols>
+struct InterningLexAdaptorClosure {
+    Symbols* symbols;
+
+    template <std::ranges::viewable_range R>
+    auto operator()(R&& r) const {
+        return Lexer<std::views::all_t<R>, Symbols>{std::views::all(std::forward<R>(r)), *symbols};
+    }
+
+    template <std::ranges::viewable_range R>
+    friend auto operator|(R&& r, InterningLexAdaptorClosure closure) {
+        return closure(std::forward<R>(r));
+    }
 };
 
 struct LexAdaptorClosure {
     template <std::ranges::viewable_range R>
     auto operator()(R&& r) const {
-        auto normalised_view = util::newline_normaliser_adapter(std::forward<R>(r));
-        return Lexer<decltype(normalised_view)>{std::move(normalised_view)};
+        return Lexer<std::views::all_t<R>>{std::views::all(std::forward<R>(r))};
+    }
+
+    template <symbol::Interner Symbols>
+    auto operator()(Symbols& symbols) const {
+        return InterningLexAdaptorClosure<Symbols>{&symbols};
     }
 
     template <std::ranges::viewable_range R>
@@ -202,5 +493,6 @@ struct LexAdaptorClosure {
 constexpr LexAdaptorClosure lex;
 
 static_assert(std::ranges::range<lexer::Lexer<std::string_view>>);
+static_assert(lexer::Lexer<std::string_view>::span_mode);
 
 }  // namespace lexer
@@ -1,101 +1,212 @@
+// lexer_automaton.hpp
+// the lexer's finite automaton as constexpr transition tables
+
 #pragma once
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
-#include <cwctype>
-#include <expected>
-#include <optional>
+#include <string_view>
+#include <type_traits>
 #include <variant>
 
+#include "lexer_types.hpp"
+#include "match_char.hpp"
+#include "number.hpp"
 #include "token.hpp"
+#include "utf8.hpp"
 
 namespace lexer_automaton {
 
-// FSA infastructure
-
-struct InvalidTokenError {
-    uint_fast32_t line_number{};
-    uint_fast32_t col_number{};
-    std::string lexeme{};
+// States, numbered as the alternatives of lexer::State
+enum StateId : uint8_t { init, identifier, number, hash_prefix, error, state_count };
+
+static_assert(std::is_same_v<std::variant_alternative_t<init, lexer::State>, lexer::InitState>);
+static_assert(
+    std::is_same_v<std::variant_alternative_t<identifier, lexer::State>, lexer::IdentifierState>);
+static_assert(std::is_same_v<std::variant_alternative_t<number, lexer::State>, lexer::NumberState>);
+static_assert(
+    std::is_same_v<std::variant_alternative_t<hash_prefix, lexer::State>, lexer::HashState>);
+static_assert(std::is_same_v<std::variant_alternative_t<error, lexer::State>, lexer::ErrorState>);
+static_assert(std::variant_size_v<lexer::State> == state_count);
+
+// What the automaton distinguishes about a char
+enum Input : uint8_t {
+    space,       // whitespace other than line breaks
+    line_break,  // \n or \r
+    lparen,
+    rparen,
+    initial,     // starts and continues identifiers
+    numeric,     // digits, signs and '.': start numbers and continue identifiers
+    hash,        // '#': starts numeric prefixes
+    delimiter,   // " and ;
+    non_ascii,   // bytes of multibyte UTF-8 sequences: continue identifiers once validated
+    other,
+    input_count
 };
 
-using LexError = std::variant<InvalidTokenError>;
-
-struct BaseState {};
-
-struct InitState : BaseState {};
-// struct ErrorState : BaseState {};
-// struct IdentifierState : BaseState {};
-
-using State = std::variant<InitState>;
-
-struct LexResultData {
-    std::optional<token::Token> token;
-    State state;
+// What a transition does besides changing state. Only the emit actions yield a token;
+// emit_identifier, emit_number and emit_error leave the char for the next transition, all others
+// consume it. emit_vector_open ends the lexeme "#" with the '(' it consumes. start_non_ascii and
+// extend_non_ascii are start_lexeme and extend_lexeme for a byte above 0x7F, after which the
+// lexeme must be validated as UTF-8 before it can be an identifier; ASCII lexemes never are. They
+// are also where lexers without the whole source record continuation bytes for the source map.
+enum class Action : uint8_t {
+    skip,
+    skip_line_break,
+    start_lexeme,
+    extend_lexeme,
+    start_non_ascii,
+    extend_non_ascii,
+    emit_lparen,
+    emit_rparen,
+    emit_vector_open,
+    emit_identifier,
+    emit_number,
+    emit_error,
 };
 
-using LexResult = std::expected<LexResultData, LexError>;
-
-// matching characters
-
-
-
-// FSA
-
-struct TransitionTable {
-    std::string_view current_lexeme_prefix;
-    char event;
-    uint_fast32_t line_number;
-    uint_fast32_t col_number;
+struct Transition {
+    StateId next;
+    Action action;
+};
 
-    auto operator()(const InitState& state) -> LexResult {
-        if (std::iswspace(event))
-            return LexResultData{.token{std::nullopt}, .state{InitState{}}};
-                    
-        switch (event) {
-            case '(': {
-                token::LParen tok{.line_number = line_number, .col_number = col_number};
-                return LexResultData{.token{tok}, .state{InitState{}}};
+constexpr auto input_of(const char c) -> Input {
+    if (match_char::is_non_ascii(c)) return non_ascii;
+    auto classes = match_char::classify(c);
+    if (classes & match_char::line_break) return line_break;
+    if (classes & match_char::whitespace) return space;
+    if (c == '(') return lparen;
+    if (c == ')') return rparen;
+    if (classes & match_char::initial) return initial;
+    if (classes & match_char::subsequent) return numeric;
+    if (c == '#') return hash;
+    if (classes & match_char::delimiter) return delimiter;
+    return other;
+}
+
+constexpr auto transition_of(StateId state, Input input) -> Transition {
+    switch (state) {
+        case init:
+            switch (input) {
+                case space:
+                    return {init, Action::skip};
+                case line_break:
+                    return {init, Action::skip_line_break};
+                case lparen:
+                    return {init, Action::emit_lparen};
+                case rparen:
+                    return {init, Action::emit_rparen};
+                case initial:
+                    return {identifier, Action::start_lexeme};
+                case numeric:
+                    return {number, Action::start_lexeme};
+                case hash:
+                    return {hash_prefix, Action::start_lexeme};
+                case non_ascii:
+                    return {identifier, Action::start_non_ascii};
+                default:
+                    // enter error state and try to resynchronise
+                    return {error, Action::start_lexeme};
             }
-
-            case ')': {
-                token::RParen tok{.line_number = line_number, .col_number = col_number};
-                return LexResultData{.token{tok}, .state{InitState{}}};
+        case identifier:
+            if (input == initial || input == numeric) return {identifier, Action::extend_lexeme};
+            if (input == non_ascii) return {identifier, Action::extend_non_ascii};
+            return {init, Action::emit_identifier};
+        case number:
+            // take in every char a literal may have and tell numbers from identifiers and
+            // errors once the lexeme is whole
+            if (input == initial || input == numeric || input == hash) {
+                return {number, Action::extend_lexeme};
             }
-
-            default:
-                return std::unexpected(
-                    InvalidTokenError{.line_number = line_number,
-                                      .col_number = col_number,
-                                      .lexeme{std::string{current_lexeme_prefix}}});
+            // only a peculiar identifier, e.g. "-λ", may go on like this
+            if (input == non_ascii) return {number, Action::extend_non_ascii};
+            if (input == other) return {error, Action::extend_lexeme};
+            return {init, Action::emit_number};
+        case hash_prefix:
+            if (input == lparen) return {init, Action::emit_vector_open};
+            if (input == initial || input == numeric || input == hash) {
+                return {number, Action::extend_lexeme};
+            }
+            if (input == non_ascii) return {number, Action::extend_non_ascii};
+            if (input == other) return {error, Action::extend_lexeme};
+            // a lone '#', which lexeme_kind rejects
+            return {init, Action::emit_number};
+        default:
+            // resynchronise on a delimiter
+            if (input == non_ascii) return {error, Action::extend_non_ascii};
+            if (input == initial || input == numeric || input == hash || input == other) {
+                return {error, Action::extend_lexeme};
+            }
+            return {init, Action::emit_error};
+    }
+}
+
+namespace detail {
+
+// state x byte, composing the char classes with the state x class transitions so that a step
+// is a single lookup
+constexpr auto make_transition_table() -> std::array<std::array<Transition, 256>, state_count> {
+    std::array<std::array<Transition, 256>, state_count> table{};
+    for (std::size_t state = 0; state < state_count; state++) {
+        for (std::size_t byte = 0; byte < 256; byte++) {
+            table[state][byte] = transition_of(static_cast<StateId>(state),
+                                               input_of(static_cast<char>(byte)));
         }
     }
+    return table;
+}
+
+}  // namespace detail
+
+inline constexpr std::array<std::array<Transition, 256>, state_count> transition_table =
+    detail::make_transition_table();
+
+constexpr auto transition(StateId state, const char c) -> Transition {
+    return transition_table[state][static_cast<unsigned char>(c)];
+}
+
+static_assert(transition(init, 'a').next == identifier);
+static_assert(transition(identifier, ')').action == Action::emit_identifier);
+static_assert(transition(init, '1').next == number && transition(number, 'x').next == number);
+static_assert(transition(number, ')').action == Action::emit_number);
+static_assert(transition(init, '#').next == hash_prefix &&
+              transition(hash_prefix, 'x').next == number);
+static_assert(transition(hash_prefix, '(').action == Action::emit_vector_open);
+static_assert(transition(init, '"').next == error && transition(error, '#').next == error);
+static_assert(transition(error, ';').action == Action::emit_error);
+static_assert(transition(init, '\xCE').action == Action::start_non_ascii &&
+              transition(identifier, '\xBB').action == Action::extend_non_ascii &&
+              transition(error, '\xBB').action == Action::extend_non_ascii);
+
+// Kind of the token a lexeme becomes when it ends in state, one of those that build a lexeme,
+// for every lexer to emit by. Lexemes of the number and hash prefix states are the dot, numeric
+// literals and peculiar identifiers; identifiers with a byte above 0x7F, which non_ascii says the
+// lexeme has, must be valid UTF-8. Anything else is an error.
+constexpr auto lexeme_kind(StateId state, std::string_view text, bool non_ascii) -> token::Kind {
+    auto identifier_kind = [&] {
+        return non_ascii && !utf8::is_valid(text) ? token::Kind::error : token::Kind::identifier;
+    };
+    switch (state) {
+        case identifier:
+            return identifier_kind();
+        case number:
+        case hash_prefix:
+            if (text == ".") return token::Kind::dot;
+            if (number::is_literal(text)) return token::Kind::number;
+            if (match_char::is_peculiar_identifier(text)) return identifier_kind();
+            return token::Kind::error;
+        default:
+            return token::Kind::error;
+    }
+}
 
-    // auto operator()(IdentifierState& state, Context& ctx, const char event) -> LexResult {
-    //     if (is_delimiter(event) || event == EOF) {
-    //         ctx.should_increment = false;
-    //         token::Identifier tok{
-    //             .line_number = ctx.line_number, .col_number = ctx.col_number, .lexeme =
-    //             ctx.lexeme};
-    //         return {tok, InitState{}};
-    //     }
-
-    //     ctx.lexeme += event;
-    //     return {std::nullopt, IdentifierState{}};
-    // }
-
-    // auto operator()(ErrorState& state, Context& ctx, const char event) -> LexResult {
-    //     // Sync on delimiter
-    //     if (is_delimiter(event) || event == EOF) {
-    //         std::expected<token::Token, LexError> err =
-    //             std::unexpected(InvalidTokenError{.line_number = ctx.line_number,
-    //                                               .col_number = ctx.col_number,
-    //                                               .lexeme = ctx.lexeme});
-    //         return {std::make_optional(err), InitState{}};
-    //     }
-
-    //     ctx.lexeme += event;
-    //     return {std::nullopt, ErrorState{}};
-    // }
-};
-}  // namespace lexer_automaton
+static_assert(lexeme_kind(identifier, "a", false) == token::Kind::identifier);
+static_assert(lexeme_kind(identifier, "\xCE", true) == token::Kind::error);
+static_assert(lexeme_kind(number, ".", false) == token::Kind::dot &&
+              lexeme_kind(number, "-1/2", false) == token::Kind::number &&
+              lexeme_kind(number, "->x", false) == token::Kind::identifier &&
+              lexeme_kind(number, "1x", false) == token::Kind::error);
+static_assert(lexeme_kind(hash_prefix, "#", false) == token::Kind::error);
 
+}  // namespace lexer_automaton
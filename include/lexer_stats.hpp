@@ -0,0 +1,136 @@
+// lexer_stats.hpp
+// instrumentation policies for the lexer, and the counters they collect
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <numeric>
+#include <string>
+#include <string_view>
+
+#include "lexer_automaton.hpp"
+#include "token.hpp"
+
+namespace lexer {
+
+// What an instrumented lexer counts. Steps are lookups in the automaton's transition table, by
+// the state they leave; a run the lexer consumes in bulk, like whitespace or the rest of an
+// identifier, takes one step. Every error token is a resynchronisation, which skips the bytes of
+// its lexeme. Lexing time includes advancing the input; that is also timed on its own for sources
+// that are not random access, such as a stream or the newline normaliser, where it is real work.
+struct Stats {
+    uint64_t bytes{0};
+    std::array<uint64_t, token::kind_count> tokens{};
+    std::array<uint64_t, lexer_automaton::state_count> steps{};
+    uint64_t resynchronised_bytes{0};
+    std::chrono::nanoseconds lexing{};
+    std::chrono::nanoseconds input{};
+
+    [[nodiscard]] auto token_count() const -> uint64_t {
+        return std::accumulate(tokens.begin(), tokens.end(), uint64_t{0});
+    }
+    [[nodiscard]] auto resynchronisations() const -> uint64_t {
+        return tokens[static_cast<std::size_t>(token::Kind::error)];
+    }
+
+    // the counts of two lexers, as one
+    auto operator+=(const Stats& other) -> Stats& {
+        bytes += other.bytes;
+        for (std::size_t i = 0; i < tokens.size(); i++) tokens[i] += other.tokens[i];
+        for (std::size_t i = 0; i < steps.size(); i++) steps[i] += other.steps[i];
+        resynchronised_bytes += other.resynchronised_bytes;
+        lexing += other.lexing;
+        input += other.input;
+        return *this;
+    }
+};
+
+// An instrumentation policy for Lexer: hooks it calls as it lexes, and a clock for timing.
+// Policies that are not enabled must do nothing, so that the lexer can leave out their state.
+template <typename T>
+concept StatsPolicy = requires(T& policy, typename T::TimePoint since) {
+    { T::enabled } -> std::convertible_to<bool>;
+    { T::now() } -> std::same_as<typename T::TimePoint>;
+    policy.count_bytes(std::size_t{});
+    policy.count_step(lexer_automaton::init);
+    policy.count_token(token::Kind::eof);
+    policy.count_resynchronisation(std::size_t{});
+    policy.add_lexing_time(since);
+    policy.add_input_time(since);
+};
+
+// NoStats
+// The default policy. Its hooks are empty and its clock reads nothing, so they inline away and a
+// Lexer compiles to the same code as it would without them.
+struct NoStats {
+    static constexpr bool enabled = false;
+
+    struct TimePoint {};
+    static auto now() -> TimePoint { return {}; }
+
+    void count_bytes(std::size_t /*n*/) {}
+    void count_step(lexer_automaton::StateId /*from*/) {}
+    void count_token(token::Kind /*kind*/) {}
+    void count_resynchronisation(std::size_t /*bytes*/) {}
+    void add_lexing_time(TimePoint /*since*/) {}
+    void add_input_time(TimePoint /*since*/) {}
+};
+
+// CollectStats
+// Counts into Stats. Timing reads the steady clock twice per token, and for sources that are not
+// random access twice per step of the input as well, which inflates what it measures.
+class CollectStats {
+   private:
+    Stats m_stats{};
+
+   public:
+    static constexpr bool enabled = true;
+
+    using TimePoint = std::chrono::steady_clock::time_point;
+    static auto now() -> TimePoint { return std::chrono::steady_clock::now(); }
+
+    void count_bytes(std::size_t n) { m_stats.bytes += n; }
+    void count_step(lexer_automaton::StateId from) { m_stats.steps[from]++; }
+    void count_token(token::Kind kind) { m_stats.tokens[static_cast<std::size_t>(kind)]++; }
+    void count_resynchronisation(std::size_t bytes) { m_stats.resynchronised_bytes += bytes; }
+    void add_lexing_time(TimePoint since) { m_stats.lexing += now() - since; }
+    void add_input_time(TimePoint since) { m_stats.input += now() - since; }
+
+    [[nodiscard]] auto stats() const -> const Stats& { return m_stats; }
+};
+
+static_assert(StatsPolicy<NoStats> && StatsPolicy<CollectStats>);
+
+// The stats as a table, one counter per line
+inline auto format_stats(const Stats& stats) -> std::string {
+    constexpr std::array<std::string_view, token::kind_count> kind_names{
+        "eof", "lparen", "rparen", "vector_open", "dot", "identifier", "number", "error"};
+    constexpr std::array<std::string_view, lexer_automaton::state_count> state_names{
+        "init", "identifier", "number", "hash_prefix", "error"};
+    auto microseconds = [](std::chrono::nanoseconds time) {
+        return static_cast<double>(time.count()) / 1000.0;
+    };
+
+    std::string out = std::format("bytes                {}\n", stats.bytes);
+    out += std::format("tokens               {}\n", stats.token_count());
+    for (std::size_t kind = 0; kind < kind_names.size(); kind++) {
+        out += std::format("  {:<18} {}\n", kind_names[kind], stats.tokens[kind]);
+    }
+    out += "steps from\n";
+    for (std::size_t state = 0; state < state_names.size(); state++) {
+        out += std::format("  {:<18} {}\n", state_names[state], stats.steps[state]);
+    }
+    out += std::format("resynchronisations   {} ({} bytes)\n", stats.resynchronisations(),
+                       stats.resynchronised_bytes);
+    out += std::format("lexing               {:.1f} us\n", microseconds(stats.lexing));
+    out += std::format("  input              {:.1f} us\n", microseconds(stats.input));
+    out += std::format("  automaton          {:.1f} us", microseconds(stats.lexing - stats.input));
+    return out;
+}
+
+}  // namespace lexer
@@ -5,7 +5,7 @@
 
 #include <cstdint>
 #include <expected>
-#include <optional>
+#include <format>
 #include <string>
 #include <variant>
 
@@ -14,8 +14,7 @@
 namespace lexer {
 
 struct InvalidTokenError {
-    uint_fast32_t line_number{};
-    uint_fast32_t col_number{};
+    uint_fast32_t offset{};
     std::string lexeme{};
 };
 
@@ -23,13 +22,20 @@ using LexError = std::variant<InvalidTokenError>;
 
 struct InitState {};
 struct IdentifierState {};
+// a number, or an identifier starting like one (see match_char::is_peculiar_identifier)
+struct NumberState {};
+// a '#' that opens a vector if '(' follows, and starts a numeric prefix otherwise
+struct HashState {};
 struct ErrorState {};
 
-using State = std::variant<InitState, IdentifierState, ErrorState>;
+using State = std::variant<InitState, IdentifierState, NumberState, HashState, ErrorState>;
 
-struct LexResult {
-    std::optional<std::expected<token::Token, LexError>> token;
-    State state;
+// Point a span mode lexer can resume from: the state it was in before the char at offset, and
+// where the lexeme under construction in that state started
+struct Checkpoint {
+    uint_fast32_t offset{};
+    uint_fast32_t lexeme_offset{};
+    State state{};
 };
 
 }  // namespace lexer
@@ -38,8 +44,16 @@ template <>
 struct std::formatter<lexer::InvalidTokenError> : std::formatter<std::string> {
     auto format(const lexer::InvalidTokenError& err, format_context& ctx) const {
         return formatter<string>::format(
-            std::format("Error [line: {}, column: {}]: Unknown token '{}'.", err.line_number,
-                        err.col_number, err.lexeme),
+            std::format("Error [offset: {}]: Unknown token '{}'.", err.offset, err.lexeme), ctx);
+    }
+};
+
+template <>
+struct std::formatter<token::Located<lexer::InvalidTokenError>> : std::formatter<std::string> {
+    auto format(const token::Located<lexer::InvalidTokenError>& err, format_context& ctx) const {
+        return formatter<string>::format(
+            std::format("Error [line: {}, column: {}]: Unknown token '{}'.",
+                        err.location.line_number, err.location.col_number, err.value.lexeme),
             ctx);
     }
 };
@@ -56,3 +70,18 @@ struct std::formatter<lexer::LexError> : std::formatter<std::string> {
         return std::visit(Visitor{ctx}, err);
     }
 };
+
+template <>
+struct std::formatter<token::Located<lexer::LexError>> : std::formatter<std::string> {
+    auto format(const token::Located<lexer::LexError>& err, format_context& ctx) const {
+        struct Visitor {
+            format_context& ctx;        // NOLINT
+            token::Location location;  // NOLINT
+            auto operator()(const lexer::InvalidTokenError& err) {
+                return std::formatter<token::Located<lexer::InvalidTokenError>>{}.format(
+                    token::Located<lexer::InvalidTokenError>{err, location}, ctx);
+            }
+        };
+        return std::visit(Visitor{ctx, err.location}, err.value);
+    }
+};
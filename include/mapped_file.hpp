@@ -0,0 +1,153 @@
+// mapped_file.hpp
+// contiguous, read-only range over a whole file, memory-mapped when the file allows it
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <filesystem>
+#include <ranges>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace io {
+
+inline constexpr int standard_input = STDIN_FILENO;
+
+// Regular files are mmapped with MADV_SEQUENTIAL, anything that cannot be mapped (pipes, ttys,
+// stdin) is read into an owned buffer instead. Either way it is a contiguous range of const char
+// that stays valid, at the same address, until the mapped_file is destroyed. Like a container it
+// is not itself a view: piping an lvalue borrows it, piping an rvalue moves it into the adaptor.
+class mapped_file {
+   private:
+    const char* m_data{nullptr};
+    std::size_t m_size{0};
+    // the whole mapping, which starts on a page boundary at or before m_data
+    void* m_mapping{nullptr};
+    std::size_t m_mapping_size{0};
+    std::vector<char> m_buffer{};
+
+    [[noreturn]] static void fail(const char* what) {
+        throw std::system_error{errno, std::generic_category(), what};
+    }
+
+    void map_or_read(int fd) {
+        struct stat info{};
+        if (fstat(fd, &info) == -1) fail("fstat");
+
+        if (S_ISREG(info.st_mode)) {
+            off_t position = lseek(fd, 0, SEEK_CUR);
+            if (position == -1) fail("lseek");
+            if (position < info.st_size) {
+                // map from the page the current offset is in, then step over what came before it
+                off_t start = position - position % sysconf(_SC_PAGESIZE);
+                auto length = static_cast<std::size_t>(info.st_size - start);
+                void* addr = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, start);
+                if (addr != MAP_FAILED) {
+                    madvise(addr, length, MADV_SEQUENTIAL);
+                    m_mapping = addr;
+                    m_mapping_size = length;
+                    m_data = static_cast<const char*>(addr) + (position - start);
+                    m_size = static_cast<std::size_t>(info.st_size - position);
+                    // leave fd at the end, as reading it would
+                    lseek(fd, 0, SEEK_END);
+                    return;
+                }
+            }
+        }
+
+        read_all(fd);
+    }
+
+    void read_all(int fd) {
+        constexpr std::size_t block_size = std::size_t{1} << 16U;
+        std::size_t size{0};
+        while (true) {
+            m_buffer.resize(size + block_size);
+            auto count = read(fd, m_buffer.data() + size, block_size);
+            if (count == -1) {
+                if (errno == EINTR) continue;
+                fail("read");
+            }
+            if (count == 0) break;
+            size += static_cast<std::size_t>(count);
+        }
+        m_buffer.resize(size);
+        m_data = m_buffer.data();
+        m_size = size;
+    }
+
+    void release() {
+        if (m_mapping != nullptr) munmap(m_mapping, m_mapping_size);
+        m_data = nullptr;
+        m_size = 0;
+        m_mapping = nullptr;
+        m_mapping_size = 0;
+        m_buffer.clear();
+    }
+
+   public:
+    mapped_file() = default;
+
+    explicit mapped_file(const std::filesystem::path& path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);  // NOLINT
+        if (fd == -1) fail("open");
+        try {
+            map_or_read(fd);
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        // the mapping outlives the descriptor
+        close(fd);
+    }
+
+    // Maps or reads everything in fd from its current offset on, and leaves it at the end of the
+    // file; fd stays owned by the caller
+    explicit mapped_file(int fd) { map_or_read(fd); }
+
+    mapped_file(const mapped_file&) = delete;
+    auto operator=(const mapped_file&) -> mapped_file& = delete;
+
+    mapped_file(mapped_file&& other) noexcept
+        : m_data{std::exchange(other.m_data, nullptr)},
+          m_size{std::exchange(other.m_size, 0)},
+          m_mapping{std::exchange(other.m_mapping, nullptr)},
+          m_mapping_size{std::exchange(other.m_mapping_size, 0)},
+          m_buffer{std::move(other.m_buffer)} {}
+
+    auto operator=(mapped_file&& other) noexcept -> mapped_file& {
+        if (this != &other) {
+            release();
+            m_data = std::exchange(other.m_data, nullptr);
+            m_size = std::exchange(other.m_size, 0);
+            m_mapping = std::exchange(other.m_mapping, nullptr);
+            m_mapping_size = std::exchange(other.m_mapping_size, 0);
+            m_buffer = std::move(other.m_buffer);
+        }
+        return *this;
+    }
+
+    ~mapped_file() { release(); }
+
+    [[nodiscard]] auto begin() const -> const char* { return m_data; }
+    [[nodiscard]] auto end() const -> const char* { return m_data + m_size; }
+    [[nodiscard]] auto data() const -> const char* { return m_data; }
+    [[nodiscard]] auto size() const -> std::size_t { return m_size; }
+    [[nodiscard]] auto empty() const -> bool { return m_size == 0; }
+
+    // whether the contents are backed by a mapping rather than a buffer
+    [[nodiscard]] auto is_mapped() const -> bool { return m_mapping != nullptr; }
+};
+
+static_assert(std::ranges::contiguous_range<mapped_file>);
+static_assert(std::ranges::viewable_range<mapped_file&>);
+static_assert(std::ranges::viewable_range<mapped_file>);
+
+}  // namespace io
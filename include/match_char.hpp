@@ -3,31 +3,132 @@
 
 #pragma once
 
-#include <cctype>
-#include <cwctype>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
 namespace match_char {
 
+// Character classes, a byte may belong to several of them
+enum CharClass : uint16_t {
+    whitespace = 1U << 0U,
+    delimiter = 1U << 1U,
+    initial = 1U << 2U,
+    subsequent = 1U << 3U,
+    digit = 1U << 4U,
+    explicit_sign = 1U << 5U,
+    special_initial = 1U << 6U,
+    special_subsequent = 1U << 7U,
+    line_break = 1U << 8U,
+};
+
 template <const char... match>
-auto match_char(const char c) -> bool {
+constexpr auto match_char(const char c) -> bool {
     return ((c == match) || ...);
 }
 
-auto is_delimiter(const char c) -> bool {
-    return std::iswspace(c) || match_char<'(', ')', '"', ';'>(c);
+namespace detail {
+
+// Classification of the C locale, so the table does not depend on the global locale
+constexpr auto classes_of(const char c) -> uint16_t {
+    uint16_t classes{0};
+
+    bool is_alpha = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    bool is_digit = c >= '0' && c <= '9';
+
+    if (match_char<' ', '\t', '\n', '\v', '\f', '\r'>(c)) classes |= whitespace | delimiter;
+    if (match_char<'\n', '\r'>(c)) classes |= line_break;
+    if (match_char<'(', ')', '"', ';'>(c)) classes |= delimiter;
+    if (match_char<'!', '$', '%', '&', '*', '/', ':', '<', '=', '>', '?', '@', '^', '_', '~'>(c)) {
+        classes |= special_initial;
+    }
+    if (match_char<'+', '-'>(c)) classes |= explicit_sign;
+    if (match_char<'+', '-', '.', '@'>(c)) classes |= special_subsequent;
+    if (is_digit) classes |= digit;
+
+    if (is_alpha || (classes & special_initial)) classes |= initial;
+    if (classes & (initial | digit | special_subsequent)) classes |= subsequent;
+
+    return classes;
 }
 
-auto is_special_initial(const char c) -> bool {
-    return match_char<'!', '$', '%', '&', '*', '/', ':', '<', '=', '>', '?', '@', '^', '_', '~'>(c);
+constexpr auto make_class_table() -> std::array<uint16_t, 256> {
+    std::array<uint16_t, 256> table{};
+    // bytes >= 0x80 are not part of any ASCII class and stay 0
+    for (std::size_t byte = 0; byte < 0x80; byte++) {
+        table[byte] = classes_of(static_cast<char>(byte));
+    }
+    return table;
 }
 
-auto is_initial(const char c) -> bool { return std::isalpha(c) || is_special_initial(c); }
+}  // namespace detail
+
+inline constexpr std::array<uint16_t, 256> class_table = detail::make_class_table();
 
-auto is_explicit_sign(const char c) -> bool { return match_char<'+', '-'>(c); }
+constexpr auto classify(const char c) -> uint16_t {
+    return class_table[static_cast<unsigned char>(c)];
+}
 
-auto is_special_subsequent(const char c) -> bool { return is_explicit_sign(c) || match_char<'.', '@'>(c); }
+constexpr auto is_whitespace(const char c) -> bool { return (classify(c) & whitespace) != 0; }
 
-auto is_subsequent(const char c) -> bool {
-    return is_initial(c) || std::isdigit(c) || is_special_subsequent(c);
+constexpr auto is_delimiter(const char c) -> bool { return (classify(c) & delimiter) != 0; }
+
+constexpr auto is_special_initial(const char c) -> bool {
+    return (classify(c) & special_initial) != 0;
 }
 
+constexpr auto is_initial(const char c) -> bool { return (classify(c) & initial) != 0; }
+
+constexpr auto is_digit(const char c) -> bool { return (classify(c) & digit) != 0; }
+
+constexpr auto is_explicit_sign(const char c) -> bool { return (classify(c) & explicit_sign) != 0; }
+
+constexpr auto is_special_subsequent(const char c) -> bool {
+    return (classify(c) & special_subsequent) != 0;
+}
+
+constexpr auto is_subsequent(const char c) -> bool { return (classify(c) & subsequent) != 0; }
+
+// A byte of a multibyte UTF-8 sequence. The classes are ASCII only; the lexer takes the code
+// points these bytes encode as identifier characters, as R7RS allows, once they are valid UTF-8.
+constexpr auto is_non_ascii(const char c) -> bool { return static_cast<unsigned char>(c) >= 0x80; }
+
+// + and -, and the identifiers that start like a number does: a sign or a dot followed by a char
+// no number can have there (R7RS 7.1.1 <peculiar identifier>)
+constexpr auto is_peculiar_identifier(std::string_view text) -> bool {
+    auto is_sign_subsequent = [](char c) {
+        return is_initial(c) || is_non_ascii(c) || is_explicit_sign(c) || c == '@';
+    };
+    auto all_subsequent = [](std::string_view rest) {
+        for (char c : rest) {
+            if (!is_subsequent(c) && !is_non_ascii(c)) return false;
+        }
+        return true;
+    };
+
+    if (text.empty()) return false;
+    if (is_explicit_sign(text[0])) {
+        text.remove_prefix(1);
+        if (text.empty()) return true;
+        if (is_sign_subsequent(text[0])) return all_subsequent(text.substr(1));
+        if (text[0] != '.') return false;
+    }
+    if (text[0] != '.') return false;
+    text.remove_prefix(1);
+    return !text.empty() && (is_sign_subsequent(text[0]) || text[0] == '.') &&
+           all_subsequent(text.substr(1));
+}
+
+static_assert(is_initial('a') && is_initial('Z') && is_initial('~') && !is_initial('1'));
+static_assert(is_subsequent('1') && is_subsequent('@') && is_subsequent('.') && !is_subsequent('('));
+static_assert(is_delimiter('(') && is_delimiter('\r') && !is_delimiter('a'));
+static_assert(is_peculiar_identifier("-") && is_peculiar_identifier("...") &&
+              is_peculiar_identifier("->x") && is_peculiar_identifier("+.a") &&
+              is_peculiar_identifier("-\xCE\xBB"));
+static_assert(!is_peculiar_identifier(".") && !is_peculiar_identifier("-1") &&
+              !is_peculiar_identifier(".5") && !is_peculiar_identifier("a"));
+static_assert(!is_initial(static_cast<char>(0xE9)) && !is_whitespace(static_cast<char>(0xA0)) &&
+              is_non_ascii(static_cast<char>(0xE9)) && !is_non_ascii('~'));
+
 }  // namespace match_char
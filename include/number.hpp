@@ -0,0 +1,402 @@
+// number.hpp
+// R7RS numeric literals, converted straight from their source text to machine numbers
+
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <variant>
+
+#include "util.hpp"
+
+namespace number {
+
+// An exact non-integer in lowest terms, with a denominator above 1
+struct Rational {
+    int64_t numerator;
+    int64_t denominator;
+
+    auto operator==(const Rational&) const -> bool = default;
+};
+
+// An exact number out of the range of int64_t and Rational, kept as the text of its literal
+template <typename Lexeme>
+struct BasicBig {
+    Lexeme text;
+
+    auto operator==(const BasicBig&) const -> bool = default;
+};
+
+// Exact integers and rationals, inexact reals as double
+template <typename Lexeme>
+using BasicValue = std::variant<int64_t, Rational, double, BasicBig<Lexeme>>;
+
+using Value = BasicValue<std::string>;
+using ValueView = BasicValue<std::string_view>;
+
+namespace detail {
+
+// Radix and exactness given by the #x, #b, #o, #d, #e and #i prefixes; exactness is 'e', 'i'
+// or 0 for the default of the literal's syntax
+struct Prefix {
+    unsigned radix{10};
+    char exactness{0};
+};
+
+constexpr auto to_lower(const char c) -> char {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+// Strip at most one radix and one exactness prefix, in either order
+constexpr auto strip_prefix(std::string_view& text) -> std::optional<Prefix> {
+    Prefix prefix{};
+    bool has_radix{false};
+    while (text.size() >= 2 && text[0] == '#') {
+        auto c = to_lower(text[1]);
+        if (c == 'e' || c == 'i') {
+            if (prefix.exactness != 0) return std::nullopt;
+            prefix.exactness = c;
+        } else {
+            if (has_radix) return std::nullopt;
+            has_radix = true;
+            switch (c) {
+                case 'x':
+                    prefix.radix = 16;
+                    break;
+                case 'o':
+                    prefix.radix = 8;
+                    break;
+                case 'b':
+                    prefix.radix = 2;
+                    break;
+                case 'd':
+                    prefix.radix = 10;
+                    break;
+                default:
+                    return std::nullopt;
+            }
+        }
+        text.remove_prefix(2);
+    }
+    return prefix;
+}
+
+constexpr auto digit_value(const char c) -> unsigned {
+    if (c >= '0' && c <= '9') return static_cast<unsigned>(c - '0');
+    auto lower = to_lower(c);
+    if (lower >= 'a' && lower <= 'z') return static_cast<unsigned>(lower - 'a' + 10);
+    return std::numeric_limits<unsigned>::max();
+}
+
+// Length of the run of digits in radix text starts with
+constexpr auto digits_end(std::string_view text, unsigned radix) -> std::size_t {
+    std::size_t end{0};
+    while (end < text.size() && digit_value(text[end]) < radix) end++;
+    return end;
+}
+
+constexpr auto is_digits(std::string_view text, unsigned radix) -> bool {
+    return !text.empty() && digits_end(text, radix) == text.size();
+}
+
+// Digits in radix as an unsigned magnitude, or nullopt on overflow
+inline auto to_magnitude(std::string_view digits, unsigned radix) -> std::optional<uint64_t> {
+    uint64_t value{};
+    auto [ptr, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), value,
+                                     static_cast<int>(radix));
+    if (ec != std::errc{}) return std::nullopt;
+    return value;
+}
+
+// A magnitude with its sign applied, or nullopt if that leaves int64_t
+constexpr auto to_signed(uint64_t magnitude, bool negative) -> std::optional<int64_t> {
+    constexpr auto max = static_cast<uint64_t>(std::numeric_limits<int64_t>::max());
+    if (magnitude <= max) {
+        return negative ? -static_cast<int64_t>(magnitude) : static_cast<int64_t>(magnitude);
+    }
+    if (negative && magnitude == max + 1) return std::numeric_limits<int64_t>::min();
+    return std::nullopt;
+}
+
+// Digits in radix as a double, sign excluded
+inline auto to_double(std::string_view digits, unsigned radix) -> double {
+    double value{};
+    if (radix == 10 || radix == 16) {
+        auto format = radix == 10 ? std::chars_format::general : std::chars_format::hex;
+        auto [ptr, ec] =
+            std::from_chars(digits.data(), digits.data() + digits.size(), value, format);
+        // only overflow is out of range for an integer
+        if (ec == std::errc::result_out_of_range) return std::numeric_limits<double>::infinity();
+        return value;
+    }
+    // from_chars reads no binary or octal floats; accumulation is exact up to 2^53
+    for (char c : digits) value = value * radix + digit_value(c);
+    return value;
+}
+
+template <typename Lexeme>
+auto make_big(std::string_view literal) -> BasicValue<Lexeme> {
+    return BasicBig<Lexeme>{Lexeme{literal}};
+}
+
+// numerator / denominator in lowest terms, as an integer if that is what it reduces to
+template <typename Lexeme>
+auto make_exact_ratio(uint64_t numerator, uint64_t denominator, bool negative,
+                      std::string_view literal) -> BasicValue<Lexeme> {
+    auto divisor = std::gcd(numerator, denominator);
+    numerator /= divisor;
+    denominator /= divisor;
+    auto signed_numerator = to_signed(numerator, negative);
+    if (!signed_numerator) return make_big<Lexeme>(literal);
+    if (denominator == 1) return *signed_numerator;
+    if (denominator > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+        return make_big<Lexeme>(literal);
+    }
+    return Rational{.numerator = *signed_numerator,
+                    .denominator = static_cast<int64_t>(denominator)};
+}
+
+// digits[.digits][e[sign]digits] with at least one mantissa digit, split into its parts
+struct Decimal {
+    std::string_view integral{};
+    std::string_view fraction{};
+    std::string_view exponent{};  // signed
+};
+
+// The decimal of integral digits followed by rest
+constexpr auto split_decimal(std::string_view integral, std::string_view rest)
+    -> std::optional<Decimal> {
+    Decimal decimal{.integral = integral};
+    if (!rest.empty() && rest[0] == '.') {
+        rest.remove_prefix(1);
+        decimal.fraction = rest.substr(0, digits_end(rest, 10));
+        rest.remove_prefix(decimal.fraction.size());
+    }
+    if (decimal.integral.empty() && decimal.fraction.empty()) return std::nullopt;
+    if (!rest.empty() && to_lower(rest[0]) == 'e') {
+        rest.remove_prefix(1);
+        decimal.exponent = rest;
+        if (!rest.empty() && (rest[0] == '+' || rest[0] == '-')) rest.remove_prefix(1);
+        if (!is_digits(rest, 10)) return std::nullopt;
+        rest = {};
+    }
+    if (!rest.empty()) return std::nullopt;
+    return decimal;
+}
+
+// A decimal as an exact number: its digits as an integer scaled by a power of ten
+template <typename Lexeme>
+auto exact_decimal(const Decimal& decimal, bool negative, std::string_view literal)
+    -> BasicValue<Lexeme> {
+    constexpr uint64_t max = std::numeric_limits<uint64_t>::max();
+    uint64_t mantissa{0};
+    for (auto digits : {decimal.integral, decimal.fraction}) {
+        for (char c : digits) {
+            auto digit = static_cast<uint64_t>(c - '0');
+            if (mantissa > (max - digit) / 10) return make_big<Lexeme>(literal);
+            mantissa = mantissa * 10 + digit;
+        }
+    }
+
+    int64_t exponent{0};
+    if (!decimal.exponent.empty()) {
+        auto digits = decimal.exponent;
+        if (digits[0] == '+') digits.remove_prefix(1);
+        auto [ptr, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), exponent);
+        if (ec != std::errc{}) return make_big<Lexeme>(literal);
+        // past the fraction length of any literal, so that the scale below overflows either way
+        // but the subtraction and negation cannot
+        constexpr int64_t exponent_bound = int64_t{1} << 40U;
+        exponent = std::clamp(exponent, -exponent_bound, exponent_bound);
+    }
+    exponent -= static_cast<int64_t>(decimal.fraction.size());
+    if (mantissa == 0) return int64_t{0};
+
+    uint64_t scale{1};
+    for (int64_t i = 0; i < (exponent < 0 ? -exponent : exponent); i++) {
+        if (scale > max / 10) return make_big<Lexeme>(literal);
+        scale *= 10;
+    }
+    if (exponent < 0) return make_exact_ratio<Lexeme>(mantissa, scale, negative, literal);
+    if (mantissa > max / scale) return make_big<Lexeme>(literal);
+    return make_exact_ratio<Lexeme>(mantissa * scale, 1, negative, literal);
+}
+
+// A decimal as a double. from_chars reports overflow and underflow alike as out of range, so
+// tell them apart by the magnitude the exponent gives.
+inline auto inexact_decimal(std::string_view text, const Decimal& decimal, bool negative)
+    -> double {
+    double value{};
+    auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value,
+                                     std::chars_format::general);
+    if (ec != std::errc::result_out_of_range) return negative ? -value : value;
+
+    int64_t exponent{0};
+    auto digits = decimal.exponent;
+    if (!digits.empty() && digits[0] == '+') digits.remove_prefix(1);
+    std::from_chars(digits.data(), digits.data() + digits.size(), exponent);
+    double magnitude = exponent > 0 ? std::numeric_limits<double>::infinity() : 0.0;
+    return negative ? -magnitude : magnitude;
+}
+
+// The parts of a numeric literal that conversion needs, found without converting anything
+struct Syntax {
+    enum class Form : uint8_t { infinity, nan, integer, ratio, decimal };
+
+    Form form;
+    Prefix prefix;
+    bool negative;
+    std::string_view text;           // the literal without its prefixes and sign
+    std::string_view digits{};       // of an integer or the numerator of a ratio
+    std::string_view denominator{};  // of a ratio
+    Decimal decimal{};
+};
+
+constexpr auto is_zero(std::string_view digits) -> bool {
+    for (char c : digits) {
+        if (c != '0') return false;
+    }
+    return true;
+}
+
+// The syntax of literal, or nullopt if it is not a numeric literal
+constexpr auto scan(std::string_view literal) -> std::optional<Syntax> {
+    auto text = literal;
+    auto prefix = strip_prefix(text);
+    if (!prefix || text.empty()) return std::nullopt;
+
+    bool negative = text[0] == '-';
+    bool has_sign = negative || text[0] == '+';
+    if (has_sign) text.remove_prefix(1);
+    Syntax syntax{
+        .form = Syntax::Form::integer, .prefix = *prefix, .negative = negative, .text = text};
+
+    // +inf.0, -inf.0, +nan.0 and -nan.0
+    if (has_sign && prefix->exactness != 'e' && text.size() == 5 &&
+        !is_digits(text.substr(0, 1), 10)) {
+        auto special = [&text](std::string_view name) {
+            for (std::size_t i = 0; i < name.size(); i++) {
+                if (to_lower(text[i]) != name[i]) return false;
+            }
+            return true;
+        };
+        if (special("inf.0")) {
+            syntax.form = Syntax::Form::infinity;
+            return syntax;
+        }
+        if (special("nan.0")) {
+            syntax.form = Syntax::Form::nan;
+            return syntax;
+        }
+    }
+
+    // the leading digits tell integers, rationals and decimals apart in one scan
+    syntax.digits = text.substr(0, digits_end(text, prefix->radix));
+    auto rest = text.substr(syntax.digits.size());
+
+    if (rest.empty()) {
+        if (syntax.digits.empty()) return std::nullopt;
+        return syntax;
+    }
+
+    if (rest[0] == '/') {
+        syntax.form = Syntax::Form::ratio;
+        syntax.denominator = rest.substr(1);
+        if (syntax.digits.empty() || !is_digits(syntax.denominator, prefix->radix)) {
+            return std::nullopt;
+        }
+        // division by zero, which only inexact ratios may do
+        if (prefix->exactness != 'i' && is_zero(syntax.denominator)) return std::nullopt;
+        return syntax;
+    }
+
+    // decimal, which only radix 10 has
+    if (prefix->radix != 10) return std::nullopt;
+    auto decimal = split_decimal(syntax.digits, rest);
+    if (!decimal) return std::nullopt;
+    syntax.form = Syntax::Form::decimal;
+    syntax.decimal = *decimal;
+    return syntax;
+}
+
+}  // namespace detail
+
+// Whether text is a numeric literal, that is whether parse accepts it. Unlike parse it is
+// constexpr, so literals can be checked at compile time.
+constexpr auto is_literal(std::string_view text) -> bool { return detail::scan(text).has_value(); }
+
+static_assert(is_literal("42") && is_literal("-1/2") && is_literal("#x-fF") && is_literal(".5e3") &&
+              is_literal("+inf.0") && is_literal("#i1/0") && is_literal("#e1e400"));
+static_assert(!is_literal("1/0") && !is_literal("#b12") && !is_literal("#x1.5") &&
+              !is_literal("1e") && !is_literal("-") && !is_literal(".") && !is_literal("#"));
+
+// The value of a numeric literal, or nullopt if text is not one. Big values keep literal's text
+// as a Lexeme. Complex numbers are not read.
+template <typename Lexeme = std::string_view>
+auto parse(std::string_view literal) -> std::optional<BasicValue<Lexeme>> {
+    using Form = detail::Syntax::Form;
+
+    auto syntax = detail::scan(literal);
+    if (!syntax) return std::nullopt;
+    auto radix = syntax->prefix.radix;
+    bool negative = syntax->negative;
+    bool exact = syntax->prefix.exactness == 'e';
+    bool inexact = syntax->prefix.exactness == 'i';
+
+    switch (syntax->form) {
+        case Form::infinity:
+            return negative ? -std::numeric_limits<double>::infinity()
+                            : std::numeric_limits<double>::infinity();
+        case Form::nan:
+            return std::numeric_limits<double>::quiet_NaN();
+        case Form::integer: {
+            if (inexact) {
+                auto value = detail::to_double(syntax->digits, radix);
+                return negative ? -value : value;
+            }
+            auto magnitude = detail::to_magnitude(syntax->digits, radix);
+            auto value = magnitude ? detail::to_signed(*magnitude, negative) : std::nullopt;
+            if (!value) return detail::make_big<Lexeme>(literal);
+            return *value;
+        }
+        case Form::ratio: {
+            if (inexact) {
+                auto value = detail::to_double(syntax->digits, radix) /
+                             detail::to_double(syntax->denominator, radix);
+                return negative ? -value : value;
+            }
+            auto n = detail::to_magnitude(syntax->digits, radix);
+            auto d = detail::to_magnitude(syntax->denominator, radix);
+            if (!n || !d) return detail::make_big<Lexeme>(literal);
+            return detail::make_exact_ratio<Lexeme>(*n, *d, negative, literal);
+        }
+        case Form::decimal:
+            if (exact) return detail::exact_decimal<Lexeme>(syntax->decimal, negative, literal);
+            return detail::inexact_decimal(syntax->text, syntax->decimal, negative);
+    }
+    return std::nullopt;
+}
+
+// Text of a value for diagnostics; Big values print as their literal
+template <typename Lexeme>
+auto format_value(const BasicValue<Lexeme>& value) -> std::string {
+    return std::visit(
+        util::overloads{
+            [](int64_t n) { return std::format("{}", n); },
+            [](Rational r) { return std::format("{}/{}", r.numerator, r.denominator); },
+            [](double x) { return std::format("{}", x); },
+            [](const BasicBig<Lexeme>& big) { return std::string{std::string_view{big.text}}; },
+        },
+        value);
+}
+
+}  // namespace number
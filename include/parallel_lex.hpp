@@ -0,0 +1,153 @@
+// parallel_lex.hpp
+// lexing of one large contiguous source in chunks on several threads
+
+#pragma once
+
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <ranges>
+#include <span>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "lexer.hpp"
+#include "match_char.hpp"
+#include "symbol_table.hpp"
+#include "token.hpp"
+#include "token_buffer.hpp"
+
+namespace lexer {
+
+namespace detail {
+
+// Below this many bytes per chunk, spreading over threads costs more than it saves
+inline constexpr std::size_t min_chunk_bytes = std::size_t{1} << 20U;
+
+// Chunk boundaries: the source split evenly into chunk_count parts, each cut moved to just after
+// the next whitespace byte. Whitespace always returns the lexer to its initial state, so lexing
+// a chunk from its start in that state guesses right. Cuts may coincide, leaving empty chunks.
+inline auto chunk_bounds(std::string_view source, std::size_t chunk_count)
+    -> std::vector<std::size_t> {
+    std::vector<std::size_t> bounds{0};
+    for (std::size_t i = 1; i < chunk_count; i++) {
+        auto cut = std::max(source.size() / chunk_count * i, bounds.back());
+        while (cut < source.size() && !match_char::is_whitespace(source[cut])) cut++;
+        bounds.push_back(std::min(cut + 1, source.size()));
+    }
+    bounds.push_back(source.size());
+    return bounds;
+}
+
+// Lex the tokens of source starting in [first, last) into buffer, lexing on past last as
+// needed to finish the final token. Returns the offset of the first token starting at or after
+// last, where the next chunk takes over, or npos if the chunk ends the source and yielded Eof.
+template <symbol::Interner Symbols>
+auto tokenize_chunk(token::TokenBuffer& buffer, std::string_view source, std::size_t first,
+                    std::size_t last, Symbols* symbols) -> std::size_t {
+    auto tail = source.substr(first);
+    auto tokens = [&] {
+        if constexpr (std::same_as<Symbols, symbol::NoInterning>) {
+            return Lexer<std::string_view>{tail};
+        } else {
+            return Lexer<std::string_view, Symbols>{tail, *symbols};
+        }
+    }();
+
+    buffer.reserve((last - first) / token::TokenBuffer::bytes_per_token_estimate + 1);
+    for (const auto& tok : tokens) {
+        auto offset = first + (tok ? token::offset_of(*tok) : token::offset_of(tok.error()));
+        if (offset >= last && last < source.size()) return offset;
+        push_token(buffer, tok, static_cast<uint32_t>(first));
+    }
+    return std::string_view::npos;
+}
+
+// Lex the chunks between bounds concurrently, then stitch them into buffer in order.
+// Every chunk is lexed as if the lexer were in its initial state at the chunk start. The lexer
+// only starts a token from that state, so once a chunk yields a token at the offset where the
+// previous chunk handed over, both agree from there on: the chunk's tokens before that offset
+// are dropped, and a chunk with no token there is lexed again from the hand-over offset.
+template <symbol::Interner Symbols>
+void tokenize_chunks(token::TokenBuffer& buffer, std::span<const std::size_t> bounds,
+                     Symbols* symbols) {
+    auto source = buffer.source();
+    auto chunk_count = bounds.size() - 1;
+    std::vector<token::TokenBuffer> chunks(chunk_count, token::TokenBuffer{source,
+                                                                           buffer.interned()});
+    std::vector<std::size_t> hand_over(chunk_count);
+    std::vector<std::exception_ptr> errors(chunk_count);
+
+    auto lex_chunk = [&](std::size_t i) {
+        try {
+            hand_over[i] = tokenize_chunk(chunks[i], source, bounds[i], bounds[i + 1], symbols);
+        } catch (...) {
+            errors[i] = std::current_exception();
+        }
+    };
+    {
+        std::vector<std::jthread> threads{};
+        for (std::size_t i = 1; i < chunk_count; i++) threads.emplace_back(lex_chunk, i);
+        lex_chunk(0);
+    }
+    for (const auto& error : errors) {
+        if (error) std::rethrow_exception(error);
+    }
+
+    std::size_t total{0};
+    for (const auto& chunk : chunks) total += chunk.size();
+    buffer.reserve(total);
+
+    std::size_t next{0};  // offset of the next true token
+    for (std::size_t i = 0; i < chunk_count && next != std::string_view::npos; i++) {
+        auto& chunk = chunks[i];
+        auto offsets = chunk.offsets();
+        auto synced = std::ranges::lower_bound(offsets, next);
+        if (synced == offsets.end() || *synced != next) {
+            chunk = token::TokenBuffer{source, buffer.interned()};
+            hand_over[i] = tokenize_chunk(chunk, source, next, std::max(next, bounds[i + 1]),
+                                          symbols);
+            synced = chunk.offsets().begin();
+        }
+        buffer.append(chunk, static_cast<std::size_t>(synced - chunk.offsets().begin()));
+        next = hand_over[i];
+    }
+    buffer.shrink_to_fit();  // tokens dropped at the hand-overs were reserved for
+}
+
+template <symbol::Interner Symbols>
+auto parallel_tokenize(std::string_view source, unsigned threads, Symbols* symbols)
+    -> token::TokenBuffer {
+    auto chunk_count =
+        std::clamp<std::size_t>(source.size() / min_chunk_bytes, 1, std::max(threads, 1U));
+    token::TokenBuffer buffer{checked_source(source),
+                              !std::same_as<Symbols, symbol::NoInterning>};
+    tokenize_chunks(buffer, chunk_bounds(source, chunk_count), symbols);
+    return buffer;
+}
+
+}  // namespace detail
+
+// Lex all of src like tokenize_all, splitting it into chunks lexed on up to threads threads.
+// Small sources are lexed on the calling thread. src must outlive the buffer.
+template <std::ranges::contiguous_range R>
+    requires std::same_as<std::ranges::range_value_t<R>, char>
+auto parallel_lex(const R& src, unsigned threads = std::thread::hardware_concurrency())
+    -> token::TokenBuffer {
+    std::string_view source{std::ranges::data(src), std::ranges::size(src)};
+    return detail::parallel_tokenize<symbol::NoInterning>(source, threads, nullptr);
+}
+
+// Lex all of src on up to threads threads, interning identifiers into the shared table
+template <std::ranges::contiguous_range R>
+    requires std::same_as<std::ranges::range_value_t<R>, char>
+auto parallel_lex(const R& src, symbol::SharedSymbolTable& symbols,
+                  unsigned threads = std::thread::hardware_concurrency()) -> token::TokenBuffer {
+    std::string_view source{std::ranges::data(src), std::ranges::size(src)};
+    return detail::parallel_tokenize(source, threads, &symbols);
+}
+
+}  // namespace lexer
@@ -0,0 +1,475 @@
+// reader.hpp
+// range adaptor reading datums from a token stream into an arena
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <format>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "arena.hpp"
+#include "lexer_types.hpp"
+#include "number.hpp"
+#include "token.hpp"
+#include "util.hpp"
+
+namespace reader {
+
+enum class Tag : uint8_t { nil, pair, vector, symbol, integer, rational, real, big };
+
+struct Pair;
+
+// A datum in 16 bytes: a tag, a length for vectors, symbols and big numbers, and an 8-byte
+// payload holding fixnums and reals themselves and pointing into the arena for everything else.
+// Datums are trivially copyable; the ones they point to live as long as the arena's contents.
+class Datum {
+   private:
+    union Payload {
+        int64_t integer;
+        double real;
+        const Pair* pair;
+        const Datum* items;
+        const char* chars;
+        const number::Rational* rational;
+    };
+
+    Tag m_tag{Tag::nil};
+    uint32_t m_size{0};
+    Payload m_payload{.integer = 0};
+
+    constexpr Datum(Tag tag, uint32_t size, Payload payload)
+        : m_tag{tag}, m_size{size}, m_payload{payload} {}
+
+   public:
+    // the empty list
+    constexpr Datum() = default;
+
+    static constexpr auto nil() -> Datum { return Datum{}; }
+    static constexpr auto integer(int64_t n) -> Datum {
+        return Datum{Tag::integer, 0, Payload{.integer = n}};
+    }
+    static constexpr auto real(double x) -> Datum {
+        return Datum{Tag::real, 0, Payload{.real = x}};
+    }
+    static constexpr auto rational(const number::Rational* q) -> Datum {
+        return Datum{Tag::rational, 0, Payload{.rational = q}};
+    }
+    static constexpr auto pair(const Pair* p) -> Datum {
+        return Datum{Tag::pair, 0, Payload{.pair = p}};
+    }
+    static constexpr auto vector(std::span<const Datum> items) -> Datum {
+        return Datum{Tag::vector, static_cast<uint32_t>(items.size()),
+                     Payload{.items = items.data()}};
+    }
+    static constexpr auto symbol(std::string_view name) -> Datum {
+        return Datum{Tag::symbol, static_cast<uint32_t>(name.size()),
+                     Payload{.chars = name.data()}};
+    }
+    // a number too big for the machine types, as its literal
+    static constexpr auto big(std::string_view text) -> Datum {
+        return Datum{Tag::big, static_cast<uint32_t>(text.size()), Payload{.chars = text.data()}};
+    }
+
+    [[nodiscard]] constexpr auto tag() const -> Tag { return m_tag; }
+    [[nodiscard]] constexpr auto is_nil() const -> bool { return m_tag == Tag::nil; }
+    [[nodiscard]] constexpr auto is_pair() const -> bool { return m_tag == Tag::pair; }
+
+    // Accessors of each tag, only to be called on datums with that tag
+    [[nodiscard]] constexpr auto as_integer() const -> int64_t { return m_payload.integer; }
+    [[nodiscard]] constexpr auto as_real() const -> double { return m_payload.real; }
+    [[nodiscard]] constexpr auto as_rational() const -> const number::Rational& {
+        return *m_payload.rational;
+    }
+    [[nodiscard]] constexpr auto as_pair() const -> const Pair& { return *m_payload.pair; }
+    [[nodiscard]] constexpr auto as_vector() const -> std::span<const Datum> {
+        return {m_payload.items, m_size};
+    }
+    [[nodiscard]] constexpr auto as_symbol() const -> std::string_view {
+        return {m_payload.chars, m_size};
+    }
+    [[nodiscard]] constexpr auto as_big() const -> std::string_view {
+        return {m_payload.chars, m_size};
+    }
+};
+
+// The reader allocates the pairs of a list as one contiguous run, each cdr pointing to the pair
+// after it, so walking a list reads memory front to back, two pairs per cache line.
+struct Pair {
+    Datum car;
+    Datum cdr;
+};
+
+static_assert(sizeof(Datum) == 16 && std::is_trivially_copyable_v<Datum>);
+static_assert(sizeof(Pair) == 32 && std::is_trivially_destructible_v<Pair>);
+
+// ')' that closes nothing
+struct UnexpectedParen {
+    uint_fast32_t offset{};
+};
+
+// '.' that is not followed by the single last datum of a list with at least one before it
+struct UnexpectedDot {
+    uint_fast32_t offset{};
+};
+
+// "(" or "#(" the source ended inside of
+struct UnclosedList {
+    uint_fast32_t offset{};
+};
+
+using ReadError =
+    std::variant<lexer::InvalidTokenError, UnexpectedParen, UnexpectedDot, UnclosedList>;
+
+// Reader
+// Yields each datum at the top level of a token stream. Datums are built into the arena, which
+// must outlive them; symbol names and big numbers are copied there, so they do not borrow from
+// the source. Nested lists are read without recursion, the elements of every open list kept on
+// one stack that is reused from datum to datum, so after the first few datums reading allocates
+// from the arena alone. An error ends the top-level datum it occurs in: it is yielded instead,
+// and reading resumes after the datum.
+template <std::ranges::view Tokens>
+class Reader : public std::ranges::view_interface<Reader<Tokens>> {
+   private:
+    Tokens m_tokens;
+    arena::Arena* m_arena{nullptr};
+
+   public:
+    using result_type = std::expected<Datum, ReadError>;
+
+    class Iterator {
+       private:
+        using tokens_iter_type = std::ranges::iterator_t<Tokens>;
+        using tokens_end_type = std::ranges::sentinel_t<Tokens>;
+        using token_type = std::remove_cvref_t<decltype(**std::declval<tokens_iter_type&>())>;
+
+        enum class Dot : uint8_t { none, before_tail, after_tail };
+
+        // a list or vector being read, whose elements start at m_items[first]
+        struct Frame {
+            std::size_t first;
+            uint_fast32_t offset;
+            bool vector;
+            Dot dot{Dot::none};
+        };
+
+        tokens_iter_type m_it;
+        tokens_end_type m_end;
+        arena::Arena* m_arena{nullptr};
+        std::vector<Datum> m_items{};
+        std::vector<Frame> m_frames{};
+        std::size_t m_skip_depth{0};  // of lists left to skip after an error inside a datum
+        bool m_read_eof{false};
+        bool m_at_end{false};
+
+        result_type m_datum{};
+
+        // Give up on the top-level datum being read, if any, skipping the rest of it
+        auto fail(ReadError error) -> std::optional<result_type> {
+            m_skip_depth = m_frames.size();
+            m_frames.clear();
+            m_items.clear();
+            return std::unexpected(std::move(error));
+        }
+
+        auto close(const Frame& frame) -> Datum {
+            std::span<const Datum> items = std::span{m_items}.subspan(frame.first);
+            Datum tail = Datum::nil();
+            if (frame.dot == Dot::after_tail) {
+                tail = items.back();
+                items = items.first(items.size() - 1);
+            }
+
+            Datum datum = tail;
+            if (frame.vector) {
+                auto* stored = m_arena->allocate<Datum>(items.size());
+                std::ranges::uninitialized_copy(items, std::span{stored, items.size()});
+                datum = Datum::vector({stored, items.size()});
+            } else if (!items.empty()) {
+                auto* pairs = m_arena->allocate<Pair>(items.size());
+                for (std::size_t i = 0; i + 1 < items.size(); i++) {
+                    std::construct_at(pairs + i, items[i], Datum::pair(pairs + i + 1));
+                }
+                std::construct_at(pairs + items.size() - 1, items.back(), tail);
+                datum = Datum::pair(pairs);
+            }
+            m_items.resize(frame.first);
+            return datum;
+        }
+
+        // A datum starting at offset is complete: yield it at the top level, otherwise make it
+        // an element of the innermost open list
+        auto complete(Datum datum, uint_fast32_t offset) -> std::optional<result_type> {
+            if (m_frames.empty()) return datum;
+            auto& frame = m_frames.back();
+            if (frame.dot == Dot::after_tail) return fail(UnexpectedDot{offset});
+            if (frame.dot == Dot::before_tail) frame.dot = Dot::after_tail;
+            m_items.push_back(datum);
+            return std::nullopt;
+        }
+
+        auto read(const token::Eof& /*tok*/) -> std::optional<result_type> {
+            m_read_eof = true;
+            if (m_frames.empty()) return std::nullopt;
+            auto offset = m_frames.back().offset;
+            m_frames.clear();
+            m_items.clear();
+            return std::unexpected(UnclosedList{offset});
+        }
+
+        auto read(const token::LParen& tok) -> std::optional<result_type> {
+            m_frames.push_back(
+                Frame{.first = m_items.size(), .offset = tok.offset, .vector = false});
+            return std::nullopt;
+        }
+
+        auto read(const token::VectorOpen& tok) -> std::optional<result_type> {
+            m_frames.push_back(
+                Frame{.first = m_items.size(), .offset = tok.offset, .vector = true});
+            return std::nullopt;
+        }
+
+        auto read(const token::RParen& tok) -> std::optional<result_type> {
+            if (m_frames.empty()) return fail(UnexpectedParen{tok.offset});
+            auto frame = m_frames.back();
+            m_frames.pop_back();
+            if (frame.dot == Dot::before_tail) return fail(UnexpectedDot{tok.offset});
+            return complete(close(frame), frame.offset);
+        }
+
+        auto read(const token::Dot& tok) -> std::optional<result_type> {
+            if (m_frames.empty()) return fail(UnexpectedDot{tok.offset});
+            auto& frame = m_frames.back();
+            if (frame.vector || frame.dot != Dot::none || m_items.size() == frame.first) {
+                return fail(UnexpectedDot{tok.offset});
+            }
+            frame.dot = Dot::before_tail;
+            return std::nullopt;
+        }
+
+        template <typename Lexeme>
+        auto read(const token::BasicIdentifier<Lexeme>& tok) -> std::optional<result_type> {
+            return complete(Datum::symbol(m_arena->store(tok.lexeme)), tok.offset);
+        }
+
+        template <typename Lexeme>
+        auto read(const token::BasicNumber<Lexeme>& tok) -> std::optional<result_type> {
+            auto datum = std::visit(
+                util::overloads{
+                    [](int64_t n) { return Datum::integer(n); },
+                    [](double x) { return Datum::real(x); },
+                    [this](const number::Rational& q) {
+                        return Datum::rational(m_arena->make<number::Rational>(q));
+                    },
+                    [this](const number::BasicBig<Lexeme>& big) {
+                        return Datum::big(m_arena->store(big.text));
+                    },
+                },
+                tok.value);
+            return complete(datum, tok.offset);
+        }
+
+        // Skip a token of a datum an error ended
+        void skip(const token_type& tok) {
+            if (std::holds_alternative<token::LParen>(tok) ||
+                std::holds_alternative<token::VectorOpen>(tok)) {
+                m_skip_depth++;
+            } else if (std::holds_alternative<token::RParen>(tok)) {
+                m_skip_depth--;
+            } else if (std::holds_alternative<token::Eof>(tok)) {
+                m_read_eof = true;
+            }
+        }
+
+        // Read tokens up to the end of the next top-level datum or error
+        auto read_datum() -> std::optional<result_type> {
+            while (!m_read_eof && m_it != m_end) {
+                const auto& tok = *m_it;
+                std::optional<result_type> result{};
+                if (m_skip_depth > 0) {
+                    if (tok) skip(*tok);
+                } else if (tok) {
+                    result = std::visit([this](const auto& t) { return this->read(t); }, *tok);
+                } else {
+                    result = fail(std::visit([](const auto& err) -> ReadError { return err; },
+                                             tok.error()));
+                }
+                ++m_it;
+                if (result) return result;
+            }
+            return std::nullopt;
+        }
+
+        void advance() {
+            if (auto datum = read_datum()) {
+                m_datum = std::move(*datum);
+            } else {
+                m_at_end = true;
+            }
+        }
+
+       public:
+        Iterator(tokens_iter_type begin, tokens_end_type end, arena::Arena* arena)
+            : m_it{std::move(begin)}, m_end{std::move(end)}, m_arena{arena} {
+            advance();
+        }
+
+        // Iterator boilerplate
+        using difference_type = std::ptrdiff_t;
+        using value_type = result_type;
+        using iterator_concept = std::input_iterator_tag;
+
+        auto operator*() const -> const result_type& { return m_datum; }
+
+        auto operator++() -> Iterator& {
+            advance();
+            return *this;
+        }
+
+        void operator++(int) { ++(*this); }
+
+        auto operator==(std::default_sentinel_t /*other*/) const -> bool { return m_at_end; }
+    };
+
+    Reader() = default;
+    Reader(Tokens tokens, arena::Arena& arena) : m_tokens{std::move(tokens)}, m_arena{&arena} {}
+
+    auto begin() {
+        return Iterator{std::ranges::begin(m_tokens), std::ranges::end(m_tokens), m_arena};
+    }
+    auto end() { return std::default_sentinel; }
+
+    // The token stream, e.g. for its source_map() to locate datums and errors
+    auto base() -> Tokens& { return m_tokens; }
+};
+
+// tokens | read(arena)
+struct ReadAdaptorClosure {
+    arena::Arena* arena;
+
+    template <std::ranges::viewable_range R>
+    auto operator()(R&& r) const {
+        return Reader<std::views::all_t<R>>{std::views::all(std::forward<R>(r)), *arena};
+    }
+
+    template <std::ranges::viewable_range R>
+    friend auto operator|(R&& r, ReadAdaptorClosure closure) {
+        return closure(std::forward<R>(r));
+    }
+};
+
+inline auto read(arena::Arena& arena) -> ReadAdaptorClosure { return ReadAdaptorClosure{&arena}; }
+
+namespace detail {
+
+inline void write(std::string& out, const Datum& datum);
+
+inline void write_number(std::string& out, const number::ValueView& value) {
+    out += number::format_value(value);
+}
+
+// Lists print their elements along the cdrs, iteratively, and recurse into the cars only
+inline void write(std::string& out, const Datum& datum) {
+    switch (datum.tag()) {
+        case Tag::nil:
+            out += "()";
+            return;
+        case Tag::integer:
+            return write_number(out, datum.as_integer());
+        case Tag::real:
+            return write_number(out, datum.as_real());
+        case Tag::rational:
+            return write_number(out, datum.as_rational());
+        case Tag::big:
+            return write_number(out, number::BasicBig<std::string_view>{datum.as_big()});
+        case Tag::symbol:
+            out += datum.as_symbol();
+            return;
+        case Tag::vector: {
+            out += "#(";
+            const char* separator = "";
+            for (const auto& item : datum.as_vector()) {
+                out += std::exchange(separator, " ");
+                write(out, item);
+            }
+            out += ')';
+            return;
+        }
+        case Tag::pair: {
+            out += '(';
+            const Datum* it = &datum;
+            write(out, it->as_pair().car);
+            for (it = &it->as_pair().cdr; it->is_pair(); it = &it->as_pair().cdr) {
+                out += ' ';
+                write(out, it->as_pair().car);
+            }
+            if (!it->is_nil()) {
+                out += " . ";
+                write(out, *it);
+            }
+            out += ')';
+            return;
+        }
+    }
+}
+
+inline auto describe(const ReadError& err) -> std::string {
+    return std::visit(
+        util::overloads{
+            [](const lexer::InvalidTokenError& e) {
+                return std::format("Unknown token '{}'.", e.lexeme);
+            },
+            [](const UnexpectedParen& /*e*/) { return std::string{"Unexpected ')'."}; },
+            [](const UnexpectedDot& /*e*/) { return std::string{"Unexpected '.'."}; },
+            [](const UnclosedList& /*e*/) { return std::string{"List is never closed."}; },
+        },
+        err);
+}
+
+}  // namespace detail
+
+// External representation of a datum, as it could be read back
+inline auto write(const Datum& datum) -> std::string {
+    std::string out;
+    detail::write(out, datum);
+    return out;
+}
+
+}  // namespace reader
+
+template <>
+struct std::formatter<reader::Datum> : std::formatter<std::string> {
+    auto format(const reader::Datum& datum, format_context& ctx) const {
+        return formatter<string>::format(reader::write(datum), ctx);
+    }
+};
+
+template <>
+struct std::formatter<reader::ReadError> : std::formatter<std::string> {
+    auto format(const reader::ReadError& err, format_context& ctx) const {
+        return formatter<string>::format(std::format("Error [offset: {}]: {}",
+                                                     token::offset_of(err),
+                                                     reader::detail::describe(err)),
+                                         ctx);
+    }
+};
+
+template <>
+struct std::formatter<token::Located<reader::ReadError>> : std::formatter<std::string> {
+    auto format(const token::Located<reader::ReadError>& err, format_context& ctx) const {
+        return formatter<string>::format(
+            std::format("Error [line: {}, column: {}]: {}", err.location.line_number,
+                        err.location.col_number, reader::detail::describe(err.value)),
+            ctx);
+    }
+};
@@ -0,0 +1,91 @@
+// relex.hpp
+// incremental re-lexing of a token buffer after an edit of its source
+
+#pragma once
+
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "lexer.hpp"
+#include "symbol_table.hpp"
+#include "token.hpp"
+#include "token_buffer.hpp"
+
+namespace lexer {
+
+// removed bytes at offset of the old source replaced by inserted bytes
+struct Edit {
+    uint32_t offset{};
+    uint32_t removed{};
+    uint32_t inserted{};
+};
+
+// Tokens [first, first + old_count) of the old buffer were replaced by new_count tokens
+struct Relexed {
+    std::size_t first{};
+    std::size_t old_count{};
+    std::size_t new_count{};
+};
+
+namespace detail {
+
+template <symbol::Interner Symbols>
+auto relex_into(token::TokenBuffer& tokens, Edit edit, std::string_view new_source,
+                Lexer<std::string_view, Symbols> lexer) -> Relexed {
+    auto old_offsets = tokens.offsets();
+    auto shift = static_cast<int64_t>(edit.inserted) - static_cast<int64_t>(edit.removed);
+
+    // Resume at the last token starting before the edit: the char ending the token before it
+    // is not edited either, so every earlier token stays as it is
+    auto first = static_cast<std::size_t>(std::ranges::lower_bound(old_offsets, edit.offset) -
+                                          old_offsets.begin());
+    if (first > 0) first--;
+
+    // Old tokens from the first one starting past the edit on are the candidates to
+    // resynchronise with. The lexer starts every token in its initial state, so once it starts
+    // a token where one of them now is, the rest of the old tokens are still right.
+    auto last = static_cast<std::size_t>(
+        std::ranges::lower_bound(old_offsets, edit.offset + edit.removed) - old_offsets.begin());
+
+    token::TokenBuffer fresh{new_source, tokens.interned()};
+    auto from = first < tokens.size() ? tokens.checkpoint(first) : Checkpoint{};
+    for (auto it = lexer.begin_at(from); it != lexer.end(); ++it) {
+        const auto& tok = *it;
+        auto offset = static_cast<int64_t>(tok ? token::offset_of(*tok)
+                                                : token::offset_of(tok.error()));
+        while (last < tokens.size() && old_offsets[last] + shift < offset) last++;
+        if (last < tokens.size() && old_offsets[last] + shift == offset) break;
+        push_token(fresh, tok);
+    }
+    // without a resynchronisation the lexer ran to Eof and replaced everything after first
+    last = std::min(last, tokens.size());
+
+    tokens.splice(first, last, fresh, shift);
+    tokens.set_source(new_source);
+    return Relexed{.first = first, .old_count = last - first, .new_count = fresh.size()};
+}
+
+}  // namespace detail
+
+// Update tokens, lexed from a source, to new_source, which is that source with edit applied.
+// Lexing resumes shortly before the edit and stops as soon as it meets the old tokens again, so
+// a small edit re-lexes a few tokens whatever the size of the source. new_source must outlive
+// the buffer.
+inline auto relex(token::TokenBuffer& tokens, Edit edit, std::string_view new_source)
+    -> Relexed {
+    return detail::relex_into(tokens, edit, detail::checked_source(new_source),
+                              Lexer<std::string_view>{new_source});
+}
+
+// Update an interned buffer, interning new identifiers into the table it was lexed with
+template <symbol::Interner Symbols>
+auto relex(token::TokenBuffer& tokens, Edit edit, std::string_view new_source, Symbols& symbols)
+    -> Relexed {
+    return detail::relex_into(tokens, edit, detail::checked_source(new_source),
+                              Lexer<std::string_view, Symbols>{new_source, symbols});
+}
+
+}  // namespace lexer
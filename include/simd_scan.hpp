@@ -0,0 +1,347 @@
+// simd_scan.hpp
+// vectorised scanning of character runs over contiguous memory
+
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+#include "match_char.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ALENVERS_SIMD_X86 1
+#endif
+
+namespace scan {
+
+// inclusive byte range [lo, hi]
+struct ByteRange {
+    unsigned char lo;
+    unsigned char hi;
+};
+
+// The character classes expressed as byte ranges, which is what the vector kernels test against
+inline constexpr std::array<ByteRange, 2> whitespace_ranges{{{'\t', '\r'}, {' ', ' '}}};
+
+inline constexpr std::array<ByteRange, 2> line_break_ranges{{{'\n', '\n'}, {'\r', '\r'}}};
+
+inline constexpr std::array<ByteRange, 8> subsequent_ranges{{
+    {'!', '!'},
+    {'$', '&'},
+    {'*', '+'},
+    {'-', ':'},  // - . / 0-9 :
+    {'<', 'Z'},  // < = > ? @ A-Z
+    {'^', '_'},
+    {'a', 'z'},
+    {'~', '~'},
+}};
+
+namespace detail {
+
+template <std::size_t N>
+constexpr auto ranges_match_class(const std::array<ByteRange, N>& ranges, uint16_t char_class)
+    -> bool {
+    for (unsigned byte = 0; byte < 256; byte++) {
+        bool in_ranges = false;
+        for (auto range : ranges) in_ranges |= byte >= range.lo && byte <= range.hi;
+        bool in_class = (match_char::class_table[byte] & char_class) != 0;
+        if (in_ranges != in_class) return false;
+    }
+    return true;
+}
+
+static_assert(ranges_match_class(whitespace_ranges, match_char::whitespace));
+static_assert(ranges_match_class(subsequent_ranges, match_char::subsequent));
+static_assert(ranges_match_class(line_break_ranges, match_char::line_break));
+
+}  // namespace detail
+
+// The bytes of a 64-byte block that give a source its structure, as bitmasks: bit i is byte i
+struct StructuralMasks {
+    uint64_t open;        // (
+    uint64_t close;       // )
+    uint64_t quote;       // "
+    uint64_t backslash;
+    uint64_t semicolon;
+    uint64_t line_break;  // \r or \n
+    uint64_t whitespace;
+
+    auto operator==(const StructuralMasks&) const -> bool = default;
+};
+
+inline constexpr std::size_t structural_block_size = 64;
+
+// Reference implementations, also used for the tails shorter than a vector
+namespace scalar {
+
+inline auto skip_class(const char* first, const char* last, uint16_t char_class) -> const char* {
+    while (first != last && (match_char::classify(*first) & char_class) != 0) first++;
+    return first;
+}
+
+inline auto find_class(const char* first, const char* last, uint16_t char_class) -> const char* {
+    while (first != last && (match_char::classify(*first) & char_class) == 0) first++;
+    return first;
+}
+
+// Skip the chars in char_class, or with Until the ones that are not
+template <bool Until>
+inline auto scan_class(const char* first, const char* last, uint16_t char_class) -> const char* {
+    return Until ? find_class(first, last, char_class) : skip_class(first, last, char_class);
+}
+
+inline auto skip_whitespace(const char* first, const char* last) -> const char* {
+    return skip_class(first, last, match_char::whitespace);
+}
+
+inline auto skip_subsequent(const char* first, const char* last) -> const char* {
+    return skip_class(first, last, match_char::subsequent);
+}
+
+inline auto find_line_break(const char* first, const char* last) -> const char* {
+    return find_class(first, last, match_char::line_break);
+}
+
+inline auto skip_ascii(const char* first, const char* last) -> const char* {
+    while (first != last && static_cast<unsigned char>(*first) < 0x80) first++;
+    return first;
+}
+
+inline auto classify_block(const char* block) -> StructuralMasks {
+    StructuralMasks masks{};
+    for (std::size_t i = 0; i < structural_block_size; i++) {
+        uint64_t bit = uint64_t{1} << i;
+        auto classes = match_char::classify(block[i]);
+        if (block[i] == '(') masks.open |= bit;
+        if (block[i] == ')') masks.close |= bit;
+        if (block[i] == '"') masks.quote |= bit;
+        if (block[i] == '\\') masks.backslash |= bit;
+        if (block[i] == ';') masks.semicolon |= bit;
+        if ((classes & match_char::line_break) != 0) masks.line_break |= bit;
+        if ((classes & match_char::whitespace) != 0) masks.whitespace |= bit;
+    }
+    return masks;
+}
+
+}  // namespace scalar
+
+#ifdef ALENVERS_SIMD_X86
+
+namespace sse2 {
+
+template <const auto& Ranges>
+inline auto match_mask(__m128i chunk) -> unsigned {
+    __m128i matched = _mm_setzero_si128();
+    for (auto range : Ranges) {
+        // unsigned (chunk - lo) <= (hi - lo)
+        __m128i offset = _mm_sub_epi8(chunk, _mm_set1_epi8(static_cast<char>(range.lo)));
+        __m128i clamped =
+            _mm_min_epu8(offset, _mm_set1_epi8(static_cast<char>(range.hi - range.lo)));
+        matched = _mm_or_si128(matched, _mm_cmpeq_epi8(offset, clamped));
+    }
+    return static_cast<unsigned>(_mm_movemask_epi8(matched));
+}
+
+template <const auto& Ranges, bool Until = false>
+inline auto skip_ranges(const char* first, const char* last, uint16_t char_class)
+    -> const char* {
+    constexpr std::ptrdiff_t width = 16;
+    while (last - first >= width) {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));  // NOLINT
+        unsigned matched = match_mask<Ranges>(chunk);
+        unsigned stop = Until ? matched : ~matched & 0xFFFFU;
+        if (stop != 0) return first + std::countr_zero(stop);
+        first += width;
+    }
+    return scalar::scan_class<Until>(first, last, char_class);
+}
+
+inline auto skip_whitespace(const char* first, const char* last) -> const char* {
+    return skip_ranges<whitespace_ranges>(first, last, match_char::whitespace);
+}
+
+inline auto skip_subsequent(const char* first, const char* last) -> const char* {
+    return skip_ranges<subsequent_ranges>(first, last, match_char::subsequent);
+}
+
+inline auto find_line_break(const char* first, const char* last) -> const char* {
+    return skip_ranges<line_break_ranges, true>(first, last, match_char::line_break);
+}
+
+// the high bits of a chunk are its movemask, no compare needed
+inline auto skip_ascii(const char* first, const char* last) -> const char* {
+    constexpr std::ptrdiff_t width = 16;
+    while (last - first >= width) {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));  // NOLINT
+        auto high = static_cast<unsigned>(_mm_movemask_epi8(chunk));
+        if (high != 0) return first + std::countr_zero(high);
+        first += width;
+    }
+    return scalar::skip_ascii(first, last);
+}
+
+inline auto byte_mask(__m128i chunk, char c) -> uint64_t {
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(c))));
+}
+
+// four 16-byte chunks, each contributing 16 bits of every mask
+inline auto classify_block(const char* block) -> StructuralMasks {
+    StructuralMasks masks{};
+    for (unsigned i = 0; i < 4; i++) {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i));  // NOLINT
+        unsigned shift = 16 * i;
+        masks.open |= byte_mask(chunk, '(') << shift;
+        masks.close |= byte_mask(chunk, ')') << shift;
+        masks.quote |= byte_mask(chunk, '"') << shift;
+        masks.backslash |= byte_mask(chunk, '\\') << shift;
+        masks.semicolon |= byte_mask(chunk, ';') << shift;
+        masks.line_break |= uint64_t{match_mask<line_break_ranges>(chunk)} << shift;
+        masks.whitespace |= uint64_t{match_mask<whitespace_ranges>(chunk)} << shift;
+    }
+    return masks;
+}
+
+}  // namespace sse2
+
+namespace avx2 {
+
+template <const auto& Ranges>
+[[gnu::target("avx2")]] inline auto match_mask(__m256i chunk) -> uint32_t {
+    __m256i matched = _mm256_setzero_si256();
+    for (auto range : Ranges) {
+        __m256i offset = _mm256_sub_epi8(chunk, _mm256_set1_epi8(static_cast<char>(range.lo)));
+        __m256i clamped =
+            _mm256_min_epu8(offset, _mm256_set1_epi8(static_cast<char>(range.hi - range.lo)));
+        matched = _mm256_or_si256(matched, _mm256_cmpeq_epi8(offset, clamped));
+    }
+    return static_cast<uint32_t>(_mm256_movemask_epi8(matched));
+}
+
+template <const auto& Ranges, bool Until = false>
+[[gnu::target("avx2")]] inline auto skip_ranges(const char* first, const char* last,
+                                                uint16_t char_class) -> const char* {
+    constexpr std::ptrdiff_t width = 32;
+    while (last - first >= width) {
+        auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));  // NOLINT
+        uint32_t matched = match_mask<Ranges>(chunk);
+        uint32_t stop = Until ? matched : ~matched;
+        if (stop != 0) return first + std::countr_zero(stop);
+        first += width;
+    }
+    return sse2::skip_ranges<Ranges, Until>(first, last, char_class);
+}
+
+[[gnu::target("avx2")]] inline auto skip_whitespace(const char* first, const char* last)
+    -> const char* {
+    return skip_ranges<whitespace_ranges>(first, last, match_char::whitespace);
+}
+
+[[gnu::target("avx2")]] inline auto skip_subsequent(const char* first, const char* last)
+    -> const char* {
+    return skip_ranges<subsequent_ranges>(first, last, match_char::subsequent);
+}
+
+[[gnu::target("avx2")]] inline auto find_line_break(const char* first, const char* last)
+    -> const char* {
+    return skip_ranges<line_break_ranges, true>(first, last, match_char::line_break);
+}
+
+[[gnu::target("avx2")]] inline auto skip_ascii(const char* first, const char* last)
+    -> const char* {
+    constexpr std::ptrdiff_t width = 32;
+    while (last - first >= width) {
+        auto chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));  // NOLINT
+        auto high = static_cast<uint32_t>(_mm256_movemask_epi8(chunk));
+        if (high != 0) return first + std::countr_zero(high);
+        first += width;
+    }
+    return sse2::skip_ascii(first, last);
+}
+
+[[gnu::target("avx2")]] inline auto byte_mask(__m256i chunk, char c) -> uint64_t {
+    return static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(c))));
+}
+
+[[gnu::target("avx2")]] inline auto classify_block(const char* block) -> StructuralMasks {
+    StructuralMasks masks{};
+    for (unsigned i = 0; i < 2; i++) {
+        auto chunk =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32 * i));  // NOLINT
+        unsigned shift = 32 * i;
+        masks.open |= byte_mask(chunk, '(') << shift;
+        masks.close |= byte_mask(chunk, ')') << shift;
+        masks.quote |= byte_mask(chunk, '"') << shift;
+        masks.backslash |= byte_mask(chunk, '\\') << shift;
+        masks.semicolon |= byte_mask(chunk, ';') << shift;
+        masks.line_break |= uint64_t{match_mask<line_break_ranges>(chunk)} << shift;
+        masks.whitespace |= uint64_t{match_mask<whitespace_ranges>(chunk)} << shift;
+    }
+    return masks;
+}
+
+}  // namespace avx2
+
+#endif
+
+namespace detail {
+
+using skip_fn = auto (*)(const char*, const char*) -> const char*;
+using classify_fn = auto (*)(const char*) -> StructuralMasks;
+
+// Pick the widest kernel the running CPU supports, once per kernel
+template <typename Fn>
+inline auto select([[maybe_unused]] Fn scalar_fn, [[maybe_unused]] Fn sse2_fn,
+                   [[maybe_unused]] Fn avx2_fn) -> Fn {
+#ifdef ALENVERS_SIMD_X86
+    if (__builtin_cpu_supports("avx2")) return avx2_fn;
+    return sse2_fn;
+#else
+    return scalar_fn;
+#endif
+}
+
+}  // namespace detail
+
+#ifdef ALENVERS_SIMD_X86
+#define ALENVERS_SIMD_SELECT(name) detail::select(scalar::name, sse2::name, avx2::name)
+#else
+#define ALENVERS_SIMD_SELECT(name) detail::select(scalar::name, scalar::name, scalar::name)
+#endif
+
+// First character in [first, last) that is not whitespace, or last
+inline auto skip_whitespace(const char* first, const char* last) -> const char* {
+    static const detail::skip_fn impl = ALENVERS_SIMD_SELECT(skip_whitespace);
+    return impl(first, last);
+}
+
+// First character in [first, last) that cannot continue an identifier, or last
+inline auto skip_subsequent(const char* first, const char* last) -> const char* {
+    static const detail::skip_fn impl = ALENVERS_SIMD_SELECT(skip_subsequent);
+    return impl(first, last);
+}
+
+// First \r or \n in [first, last), or last
+inline auto find_line_break(const char* first, const char* last) -> const char* {
+    static const detail::skip_fn impl = ALENVERS_SIMD_SELECT(find_line_break);
+    return impl(first, last);
+}
+
+// First byte of [first, last) with the high bit set, or last
+inline auto skip_ascii(const char* first, const char* last) -> const char* {
+    static const detail::skip_fn impl = ALENVERS_SIMD_SELECT(skip_ascii);
+    return impl(first, last);
+}
+
+// The structural bytes of the structural_block_size bytes at block
+inline auto classify_block(const char* block) -> StructuralMasks {
+    static const detail::classify_fn impl = ALENVERS_SIMD_SELECT(classify_block);
+    return impl(block);
+}
+
+#undef ALENVERS_SIMD_SELECT
+
+}  // namespace scan
@@ -0,0 +1,86 @@
+// source_map.hpp
+// resolution of byte offsets to line and column numbers
+
+#pragma once
+
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+#include <vector>
+
+#include "simd_scan.hpp"
+#include "token.hpp"
+#include "utf8.hpp"
+
+namespace lexer {
+
+// Line start offsets of a source, from which token offsets are resolved to 1-based line and column
+// numbers. \r, \n and \r\n each end one line.
+// Over a whole source the index is built on the first lookup with a vectorised line break scan.
+// Without one (input-only sources) the lexer records line starts as it consumes line breaks, and
+// only offsets it has already lexed past can be resolved.
+// Columns count code points: over a whole source by decoding the line up to the offset, and
+// without one by the UTF-8 continuation bytes the lexer records, which only non-ASCII text has.
+// Lookups are const but the lazy build is not synchronised: resolve from one thread at a time.
+class SourceMap {
+   private:
+    std::string_view m_source{};
+    mutable std::vector<uint32_t> m_line_starts{0};
+    mutable bool m_indexed{true};
+    std::vector<uint32_t> m_continuation_bytes{};
+
+    void index() const {
+        const char* first = m_source.data();
+        const char* last = first + m_source.size();
+        for (const char* it = scan::find_line_break(first, last); it != last;
+             it = scan::find_line_break(it, last)) {
+            it += (*it == '\r' && it + 1 != last && it[1] == '\n') ? 2 : 1;
+            m_line_starts.push_back(static_cast<uint32_t>(it - first));
+        }
+        m_indexed = true;
+    }
+
+   public:
+    SourceMap() = default;
+    explicit SourceMap(std::string_view source) : m_source{source}, m_indexed{false} {}
+
+    // Record that a line starts at offset, which must be past every line start recorded so far
+    void add_line_start(uint32_t offset) { m_line_starts.push_back(offset); }
+
+    // Record a UTF-8 continuation byte at offset, past every one recorded so far, so that columns
+    // count code points without the source
+    void add_continuation_byte(uint32_t offset) { m_continuation_bytes.push_back(offset); }
+
+    [[nodiscard]] auto locate(uint_fast32_t offset) const -> token::Location {
+        if (!m_indexed) index();
+        auto next_line = std::ranges::upper_bound(m_line_starts, offset);
+        auto line = static_cast<uint_fast32_t>(next_line - m_line_starts.begin());
+        auto line_start = *std::prev(next_line);
+        auto column = offset - line_start;
+        if (!m_source.empty()) {
+            column = utf8::count_code_points(m_source.substr(line_start, column));
+        } else if (!m_continuation_bytes.empty()) {
+            column -= static_cast<uint_fast32_t>(
+                std::ranges::lower_bound(m_continuation_bytes, offset) -
+                std::ranges::lower_bound(m_continuation_bytes, line_start));
+        }
+        return token::Location{.line_number = line, .col_number = column + 1};
+    }
+
+    // A token, error or variant of either paired with where it starts, for formatting
+    template <typename T>
+        requires(!std::integral<T>)
+    [[nodiscard]] auto locate(const T& value) const -> token::Located<T> {
+        return token::Located<T>{value, locate(token::offset_of(value))};
+    }
+
+    [[nodiscard]] auto line_count() const -> std::size_t {
+        if (!m_indexed) index();
+        return m_line_starts.size();
+    }
+};
+
+}  // namespace lexer
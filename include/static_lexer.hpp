@@ -0,0 +1,224 @@
+// static_lexer.hpp
+// Scheme source embedded in C++, lexed at compile time
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <iterator>
+#include <ranges>
+#include <span>
+#include <string_view>
+#include <utility>
+
+#include "lexer_automaton.hpp"
+#include "lexer_types.hpp"
+#include "number.hpp"
+#include "source_map.hpp"
+#include "token.hpp"
+#include "token_buffer.hpp"
+
+namespace lexer {
+
+// A string literal as a structural type, so that it can be a template argument
+template <std::size_t Size>
+struct FixedString {
+    std::array<char, Size> chars{};
+
+    // NOLINTNEXTLINE(google-explicit-constructor): made from the literal of a literal operator
+    consteval FixedString(const char (&literal)[Size]) {
+        std::ranges::copy(literal, chars.begin());
+    }
+
+    // without the terminating NUL
+    [[nodiscard]] constexpr auto view() const -> std::string_view {
+        return {chars.data(), Size - 1};
+    }
+};
+
+namespace detail {
+
+// Not constexpr, so that reaching it in constant evaluation makes the program ill-formed: the
+// compiler reports the call, naming the problem, with the expansion leading to it
+inline void invalid_token_in_scheme_literal() {}
+
+// Run the automaton over source as Lexer does, passing each token to emit, the Eof included. The
+// payload is the lexeme length, as in a TokenBuffer that does not intern.
+template <typename Emit>
+constexpr void lex_each(std::string_view source, Emit emit) {
+    using lexer_automaton::Action;
+
+    auto state = lexer_automaton::init;
+    std::size_t start{0};
+    bool non_ascii{false};
+    auto emit_lexeme = [&source, &start, &non_ascii, &emit](lexer_automaton::StateId from,
+                                                            std::size_t end) {
+        auto text = source.substr(start, end - start);
+        emit(token::TokenRef{.kind = lexer_automaton::lexeme_kind(from, text, non_ascii),
+                             .offset = static_cast<uint32_t>(start),
+                             .payload = static_cast<uint32_t>(text.size())});
+    };
+    auto emit_char = [&emit](token::Kind kind, std::size_t offset, uint32_t length) {
+        emit(token::TokenRef{
+            .kind = kind, .offset = static_cast<uint32_t>(offset), .payload = length});
+    };
+
+    for (std::size_t i = 0; i < source.size();) {
+        auto [next, action] = lexer_automaton::transition(state, source[i]);
+        auto from = std::exchange(state, next);
+        switch (action) {
+            case Action::skip:
+            case Action::skip_line_break:
+            case Action::extend_lexeme:
+                i++;
+                break;
+            case Action::start_lexeme:
+            case Action::start_non_ascii:
+                non_ascii = action == Action::start_non_ascii;
+                start = i++;
+                break;
+            case Action::extend_non_ascii:
+                non_ascii = true;
+                i++;
+                break;
+            case Action::emit_lparen:
+                emit_char(token::Kind::lparen, i++, 1);
+                break;
+            case Action::emit_rparen:
+                emit_char(token::Kind::rparen, i++, 1);
+                break;
+            case Action::emit_vector_open:
+                emit_char(token::Kind::vector_open, start, 2);
+                i++;
+                break;
+            case Action::emit_identifier:
+            case Action::emit_number:
+            case Action::emit_error:
+                emit_lexeme(from, i);
+                break;
+        }
+    }
+
+    // the end of the source delimits the lexeme under construction too
+    if (state != lexer_automaton::init) emit_lexeme(state, source.size());
+    emit_char(token::Kind::eof, source.size(), 0);
+}
+
+constexpr auto count_tokens(std::string_view source) -> std::size_t {
+    std::size_t count{0};
+    lex_each(source, [&count](token::TokenRef /*tok*/) { count++; });
+    return count;
+}
+
+template <std::size_t Count>
+consteval auto lex_static(std::string_view source) -> std::array<token::TokenRef, Count> {
+    std::array<token::TokenRef, Count> tokens{};
+    std::size_t i{0};
+    lex_each(source, [&tokens, &i](token::TokenRef tok) {
+        if (tok.kind == token::Kind::error) invalid_token_in_scheme_literal();
+        tokens[i++] = tok;
+    });
+    return tokens;
+}
+
+}  // namespace detail
+
+// StaticTokens
+// The tokens of Source, lexed while compiling: they are a constant array in the binary, and an
+// invalid token in Source is a compile error. As a view it yields the tokens Lexer does for the
+// same source in span mode, so it composes with reader::read; only numbers are converted on the
+// way, as in TokenBuffer. Identifiers are not interned.
+template <FixedString Source>
+class StaticTokens : public std::ranges::view_interface<StaticTokens<Source>> {
+   private:
+    static constexpr std::string_view m_source = Source.view();
+    static constexpr std::array m_tokens =
+        detail::lex_static<detail::count_tokens(m_source)>(m_source);
+    // lex with the class rather than on first use, so that errors show wherever Source is
+    static_assert(m_tokens.back().kind == token::Kind::eof);
+
+   public:
+    using token_type = token::BasicToken<std::string_view>;
+    using result_type = std::expected<token_type, LexError>;
+
+    class Iterator {
+       private:
+        const token::TokenRef* m_tok{nullptr};
+
+       public:
+        // Iterator boilerplate
+        using difference_type = std::ptrdiff_t;
+        using value_type = result_type;
+        using iterator_concept = std::forward_iterator_tag;
+
+        Iterator() = default;
+        explicit Iterator(const token::TokenRef* tok) : m_tok{tok} {}
+
+        auto operator*() const -> result_type {
+            auto lexeme = m_source.substr(m_tok->offset, m_tok->payload);
+            switch (m_tok->kind) {
+                case token::Kind::lparen:
+                    return token::LParen{.offset = m_tok->offset};
+                case token::Kind::rparen:
+                    return token::RParen{.offset = m_tok->offset};
+                case token::Kind::vector_open:
+                    return token::VectorOpen{.offset = m_tok->offset};
+                case token::Kind::dot:
+                    return token::Dot{.offset = m_tok->offset};
+                case token::Kind::identifier:
+                    return token::IdentifierView{.offset = m_tok->offset, .lexeme = lexeme};
+                case token::Kind::number:
+                    return token::NumberView{.offset = m_tok->offset,
+                                             .length = m_tok->payload,
+                                             .value = *number::parse(lexeme)};
+                case token::Kind::eof:
+                case token::Kind::error:
+                    break;
+            }
+            return token::Eof{.offset = m_tok->offset};
+        }
+
+        auto operator++() -> Iterator& {
+            ++m_tok;
+            return *this;
+        }
+
+        auto operator++(int) -> Iterator {
+            auto it = *this;
+            ++m_tok;
+            return it;
+        }
+
+        auto operator==(const Iterator&) const -> bool = default;
+    };
+
+    [[nodiscard]] auto begin() const -> Iterator { return Iterator{m_tokens.data()}; }
+    [[nodiscard]] auto end() const -> Iterator {
+        return Iterator{m_tokens.data() + m_tokens.size()};
+    }
+
+    [[nodiscard]] static constexpr auto source() -> std::string_view { return m_source; }
+
+    // The tokens as stored, in the compact form of TokenBuffer
+    [[nodiscard]] static constexpr auto refs() -> std::span<const token::TokenRef> {
+        return m_tokens;
+    }
+
+    // A source map is cheap to make and indexes the source only when asked for a location
+    [[nodiscard]] static auto source_map() -> SourceMap { return SourceMap{m_source}; }
+};
+
+namespace literals {
+
+// "(+ 1 2)"_scm: the tokens of the literal, lexed at compile time
+template <FixedString Source>
+consteval auto operator""_scm() -> StaticTokens<Source> {
+    return {};
+}
+
+}  // namespace literals
+
+}  // namespace lexer
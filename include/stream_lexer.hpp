@@ -0,0 +1,200 @@
+// stream_lexer.hpp
+// push mode lexing of input that arrives in chunks
+
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include "lexer_automaton.hpp"
+#include "lexer_types.hpp"
+#include "number.hpp"
+#include "simd_scan.hpp"
+#include "source_map.hpp"
+#include "symbol_table.hpp"
+#include "token.hpp"
+#include "utf8.hpp"
+
+namespace lexer {
+
+using StreamResult = std::expected<token::TokenView, LexError>;
+
+// Lexer for input pushed to it in chunks of any size, e.g. as it is read from a non-blocking
+// file descriptor. feed() lexes a chunk and passes every token it completes to the sink;
+// finish() ends the input, completing the last token and yielding Eof.
+// Between chunks only the automaton state and the unfinished lexeme are kept, so memory is
+// bounded by the longest lexeme. Lexemes of the tokens passed to the sink borrow from the chunk,
+// or from that carried lexeme, and are only valid during the call; offsets count from the start
+// of the whole input. Tokens are the same as a Lexer over all of the input would yield.
+template <std::invocable<const StreamResult&> Sink, symbol::Interner Symbols = symbol::NoInterning>
+class StreamLexer {
+   private:
+    Sink m_sink;
+    Symbols* m_symbols{nullptr};
+    SourceMap m_source_map{};
+
+    lexer_automaton::StateId m_state{lexer_automaton::init};
+    std::string m_partial{};  // start of the lexeme under construction, from earlier chunks
+    uint_fast32_t m_offset{0};  // of the start of the next chunk
+    uint_fast32_t m_lexeme_offset{0};
+    bool m_after_cr{false};  // the last chunk ended in \r, which may be half of a \r\n
+    bool m_non_ascii{false};  // the lexeme has bytes above 0x7F, to validate as UTF-8
+
+    auto intern(std::string_view name) -> symbol::Id {
+        if constexpr (std::same_as<Symbols, symbol::NoInterning>) {
+            return symbol::no_symbol;
+        } else {
+            return m_symbols->intern(name);
+        }
+    }
+
+    // Lexeme ending at last in the current chunk, whose part in the chunk starts at first
+    auto lexeme(const char* first, const char* last) -> std::string_view {
+        if (m_partial.empty()) return std::string_view{first, last};
+        m_partial.append(first, last);
+        return m_partial;
+    }
+
+    void emit(const StreamResult& tok) {
+        m_sink(tok);
+        m_partial.clear();
+    }
+
+    // Emit the lexeme state was building, as the token lexeme_kind tells
+    void emit_lexeme(lexer_automaton::StateId state, std::string_view text) {
+        switch (lexer_automaton::lexeme_kind(state, text, m_non_ascii)) {
+            case token::Kind::identifier:
+                emit(token::IdentifierView{
+                    .offset = m_lexeme_offset, .lexeme = text, .symbol_id = intern(text)});
+                break;
+            case token::Kind::dot:
+                emit(token::Dot{.offset = m_lexeme_offset});
+                break;
+            case token::Kind::number:
+                emit(token::NumberView{.offset = m_lexeme_offset,
+                                       .length = static_cast<uint_fast32_t>(text.size()),
+                                       .value = *number::parse(text)});
+                break;
+            default:
+                emit(std::unexpected(
+                    InvalidTokenError{.offset = m_lexeme_offset, .lexeme{std::string{text}}}));
+                break;
+        }
+    }
+
+    // Record the line starts of a chunk starting at m_offset. Line breaks never occur inside a
+    // lexeme, so this is a scan of its own rather than part of the automaton.
+    void index_lines(const char* first, const char* last) {
+        const char* it = first;
+        if (m_after_cr && it != last) {
+            if (*it == '\n') it++;
+            m_source_map.add_line_start(m_offset + static_cast<uint_fast32_t>(it - first));
+            m_after_cr = false;
+        }
+        for (it = scan::find_line_break(it, last); it != last;
+             it = scan::find_line_break(it, last)) {
+            if (*it == '\r' && it + 1 == last) {
+                m_after_cr = true;
+                return;
+            }
+            it += (*it == '\r' && it[1] == '\n') ? 2 : 1;
+            m_source_map.add_line_start(m_offset + static_cast<uint_fast32_t>(it - first));
+        }
+    }
+
+    void record_continuation_byte(char c, uint_fast32_t offset) {
+        if (utf8::is_continuation(c)) m_source_map.add_continuation_byte(offset);
+    }
+
+   public:
+    explicit StreamLexer(Sink sink) : m_sink{std::move(sink)} {}
+    StreamLexer(Sink sink, Symbols& symbols) : m_sink{std::move(sink)}, m_symbols{&symbols} {}
+
+    void feed(std::span<const char> chunk) {
+        using lexer_automaton::Action;
+
+        const char* first = chunk.data();
+        const char* last = first + chunk.size();
+        auto offset_of = [this, first](const char* it) {
+            return m_offset + static_cast<uint_fast32_t>(it - first);
+        };
+
+        // index first, so that the sink can locate the tokens of this chunk
+        index_lines(first, last);
+
+        // a lexeme carried over from the last chunk continues at the start of this one
+        const char* lexeme_first = first;
+        const char* it = first;
+        while (it != last) {
+            auto [next, action] = lexer_automaton::transition(m_state, *it);
+            auto state = std::exchange(m_state, next);
+
+            switch (action) {
+                case Action::skip:
+                case Action::skip_line_break:
+                    it = scan::skip_whitespace(it, last);
+                    break;
+                case Action::start_lexeme:
+                case Action::start_non_ascii:
+                    m_lexeme_offset = offset_of(it);
+                    m_non_ascii = action == Action::start_non_ascii;
+                    if (m_non_ascii) record_continuation_byte(*it, offset_of(it));
+                    lexeme_first = it++;
+                    break;
+                case Action::extend_non_ascii:
+                    m_non_ascii = true;
+                    record_continuation_byte(*it, offset_of(it));
+                    [[fallthrough]];
+                case Action::extend_lexeme:
+                    it++;
+                    if (next == lexer_automaton::identifier || next == lexer_automaton::number) {
+                        it = scan::skip_subsequent(it, last);
+                    }
+                    break;
+                case Action::emit_lparen:
+                    emit(token::LParen{.offset = offset_of(it++)});
+                    break;
+                case Action::emit_rparen:
+                    emit(token::RParen{.offset = offset_of(it++)});
+                    break;
+                case Action::emit_vector_open:
+                    emit(token::VectorOpen{.offset = m_lexeme_offset});
+                    it++;
+                    break;
+                case Action::emit_identifier:
+                case Action::emit_number:
+                case Action::emit_error:
+                    emit_lexeme(state, lexeme(lexeme_first, it));
+                    break;
+            }
+        }
+
+        if (m_state != lexer_automaton::init) m_partial.append(lexeme_first, last);
+        m_offset += static_cast<uint_fast32_t>(chunk.size());
+    }
+
+    // End the input: the end delimits the lexeme under construction, then Eof follows
+    void finish() {
+        auto state = std::exchange(m_state, lexer_automaton::init);
+        if (state != lexer_automaton::init) emit_lexeme(state, m_partial);
+        if (m_after_cr) {
+            m_source_map.add_line_start(m_offset);
+            m_after_cr = false;
+        }
+        emit(token::Eof{.offset = m_offset});
+    }
+
+    // Resolves the offsets of the tokens lexed so far to lines and columns, including from the
+    // sink
+    [[nodiscard]] auto source_map() const -> const SourceMap& { return m_source_map; }
+
+    [[nodiscard]] auto sink() -> Sink& { return m_sink; }
+};
+
+}  // namespace lexer
@@ -0,0 +1,188 @@
+// symbol_table.hpp
+// interning of identifier names into stable 32-bit symbol ids
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <vector>
+
+namespace symbol {
+
+using Id = uint32_t;
+
+// id of identifiers that were not interned
+inline constexpr Id no_symbol = ~Id{0};
+
+// FNV-1a, good enough for short identifiers and cheap to compute
+constexpr auto hash(std::string_view name) -> uint32_t {
+    uint32_t h = 2166136261U;
+    for (char c : name) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 16777619U;
+    }
+    return h;
+}
+
+// Bump allocator for the interned names. Chunks are never moved or freed before the arena is,
+// so the returned views stay valid for its whole lifetime.
+class StringArena {
+   private:
+    static constexpr std::size_t chunk_size = std::size_t{1} << 16U;
+
+    std::vector<std::unique_ptr<char[]>> m_chunks{};  // NOLINT
+    char* m_next{nullptr};
+    std::size_t m_left{0};
+
+   public:
+    auto store(std::string_view str) -> std::string_view {
+        if (str.size() > m_left) {
+            auto size = std::max(chunk_size, str.size());
+            m_chunks.push_back(std::make_unique_for_overwrite<char[]>(size));  // NOLINT
+            m_next = m_chunks.back().get();
+            m_left = size;
+        }
+        if (!str.empty()) std::memcpy(m_next, str.data(), str.size());
+        std::string_view stored{m_next, str.size()};
+        m_next += str.size();
+        m_left -= str.size();
+        return stored;
+    }
+};
+
+// Single threaded interning table: open addressing with linear probing over (hash, id) slots,
+// names stored contiguously in an arena. Ids are dense and handed out in interning order.
+class SymbolTable {
+   private:
+    struct Slot {
+        uint32_t hash{};
+        Id id{no_symbol};
+    };
+
+    std::vector<Slot> m_slots = std::vector<Slot>(64);
+    std::vector<std::string_view> m_names{};
+    StringArena m_arena{};
+
+    void grow() {
+        std::vector<Slot> slots(m_slots.size() * 2);
+        auto mask = slots.size() - 1;
+        for (auto slot : m_slots) {
+            if (slot.id == no_symbol) continue;
+            auto i = slot.hash & mask;
+            while (slots[i].id != no_symbol) i = (i + 1) & mask;
+            slots[i] = slot;
+        }
+        m_slots = std::move(slots);
+    }
+
+   public:
+    // Id of name, interning it if it has not been seen yet
+    auto intern(std::string_view name) -> Id { return intern(name, hash(name)); }
+
+    auto intern(std::string_view name, uint32_t name_hash) -> Id {
+        auto mask = m_slots.size() - 1;
+        for (auto i = name_hash & mask;; i = (i + 1) & mask) {
+            auto& slot = m_slots[i];
+            if (slot.id == no_symbol) {
+                auto id = static_cast<Id>(m_names.size());
+                m_names.push_back(m_arena.store(name));
+                slot = Slot{.hash = name_hash, .id = id};
+                // keep the load factor at or below 1/2
+                if (m_names.size() * 2 > m_slots.size()) grow();
+                return id;
+            }
+            if (slot.hash == name_hash && m_names[slot.id] == name) return slot.id;
+        }
+    }
+
+    // Id of name if it has been interned, no_symbol otherwise
+    [[nodiscard]] auto find(std::string_view name) const -> Id { return find(name, hash(name)); }
+
+    [[nodiscard]] auto find(std::string_view name, uint32_t name_hash) const -> Id {
+        auto mask = m_slots.size() - 1;
+        for (auto i = name_hash & mask;; i = (i + 1) & mask) {
+            const auto& slot = m_slots[i];
+            if (slot.id == no_symbol) return no_symbol;
+            if (slot.hash == name_hash && m_names[slot.id] == name) return slot.id;
+        }
+    }
+
+    // The interned name, valid for as long as the table lives
+    [[nodiscard]] auto name(Id id) const -> std::string_view { return m_names[id]; }
+
+    [[nodiscard]] auto size() const -> std::size_t { return m_names.size(); }
+};
+
+// Interning table that several threads, e.g. lexers working on different files, can share.
+// Names are spread over independently locked shards by hash; ids stay stable and unique across
+// shards by encoding the shard in their low bits.
+class SharedSymbolTable {
+   private:
+    static constexpr std::size_t shard_bits = 4;
+    static constexpr std::size_t shard_count = std::size_t{1} << shard_bits;
+
+    struct Shard {
+        mutable std::shared_mutex mutex{};
+        SymbolTable table{};
+    };
+
+    std::array<Shard, shard_count> m_shards{};
+
+    static auto shard_of(uint32_t name_hash) -> std::size_t {
+        // the table indexes slots with the low bits, shard with the high ones
+        return name_hash >> (32U - shard_bits);
+    }
+
+   public:
+    auto intern(std::string_view name) -> Id {
+        auto name_hash = hash(name);
+        auto shard = shard_of(name_hash);
+        auto& [mutex, table] = m_shards[shard];
+
+        Id local{no_symbol};
+        {
+            std::shared_lock lock{mutex};
+            local = table.find(name, name_hash);
+        }
+        if (local == no_symbol) {
+            std::unique_lock lock{mutex};
+            local = table.intern(name, name_hash);
+        }
+        return static_cast<Id>((local << shard_bits) | shard);
+    }
+
+    [[nodiscard]] auto name(Id id) const -> std::string_view {
+        const auto& [mutex, table] = m_shards[id & (shard_count - 1)];
+        std::shared_lock lock{mutex};
+        return table.name(id >> shard_bits);
+    }
+
+    [[nodiscard]] auto size() const -> std::size_t {
+        std::size_t size{0};
+        for (const auto& [mutex, table] : m_shards) {
+            std::shared_lock lock{mutex};
+            size += table.size();
+        }
+        return size;
+    }
+};
+
+// Interner the lexer uses when it is given no table: identifiers keep no_symbol
+struct NoInterning {
+    static constexpr auto intern(std::string_view /*name*/) -> Id { return no_symbol; }
+};
+
+template <typename T>
+concept Interner = requires(T& table, std::string_view name) {
+    { table.intern(name) } -> std::same_as<Id>;
+};
+
+}  // namespace symbol
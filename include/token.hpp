@@ -1,6 +1,7 @@
 #pragma once
 
 #include <concepts>
+#include <cstddef>
 #include <cstdint>
 #include <format>
 #include <string>
@@ -8,42 +9,102 @@
 #include <type_traits>
 #include <variant>
 
+#include "number.hpp"
+#include "symbol_table.hpp"
+#include "util.hpp"
+
 namespace token {
 
+// Tokens only record where they start, in bytes from the start of the source. Line and column
+// are resolved from that offset by a lexer::SourceMap when a diagnostic needs them.
 template <typename T>
 concept BaseToken = requires(T tok) {
-    requires(std::same_as<std::remove_cvref_t<decltype(tok.line_number)>, uint_fast32_t>);
-    requires(std::same_as<std::remove_cvref_t<decltype(tok.col_number)>, uint_fast32_t>);
+    requires(std::same_as<std::remove_cvref_t<decltype(tok.offset)>, uint_fast32_t>);
 };
 
 template <typename T>
 concept HasLexeme = requires(T tok) {
-    requires(std::same_as<std::remove_cvref_t<decltype(tok.lexeme)>, std::string>);
+    requires(std::convertible_to<decltype(tok.lexeme), std::string_view>);
+};
+
+struct Location {
+    uint_fast32_t line_number;
+    uint_fast32_t col_number;
+
+    auto operator==(const Location&) const -> bool = default;
+};
+
+// A token, or lex error, together with its resolved location
+template <typename T>
+struct Located {
+    const T& value;
+    Location location;
 };
 
 template <typename T>
     requires BaseToken<T> && HasLexeme<T>
 auto format_tok(const T& tok) -> std::string {
-    return std::format("['{}', line: {}, column: {}]", tok.lexeme, tok.line_number, tok.col_number);
+    return std::format("['{}', offset: {}]", tok.lexeme, tok.offset);
 }
 
 template <typename T>
     requires BaseToken<T>
 auto format_tok(const T& tok, std::string_view lexeme) -> std::string {
-    return std::format("['{}', line: {}, column: {}]", lexeme, tok.line_number, tok.col_number);
+    return std::format("['{}', offset: {}]", lexeme, tok.offset);
+}
+
+inline auto format_tok(Location location, std::string_view lexeme) -> std::string {
+    return std::format("['{}', line: {}, column: {}]", lexeme, location.line_number,
+                       location.col_number);
+}
+
+// Offset of a token or error, or of whichever alternative a variant of them holds
+template <typename T>
+constexpr auto offset_of(const T& value) -> uint_fast32_t {
+    if constexpr (requires { value.offset; }) {
+        return value.offset;
+    } else {
+        return std::visit([](const auto& alternative) { return offset_of(alternative); }, value);
+    }
 }
 
 struct Eof {
-    uint_fast32_t line_number;
-    uint_fast32_t col_number;
+    uint_fast32_t offset;
 };
 
-struct Identifier {
-    uint_fast32_t line_number;
-    uint_fast32_t col_number;
-    std::string lexeme;
+// Lexeme is either an owned std::string or a std::string_view borrowed from the source.
+// symbol_id is set when the lexer interns identifiers into a symbol table.
+template <typename Lexeme>
+struct BasicIdentifier {
+    uint_fast32_t offset;
+    Lexeme lexeme;
+    symbol::Id symbol_id{symbol::no_symbol};
+};
+
+// Whether two identifiers name the same symbol, by id if both were interned in the same table
+template <typename L, typename M>
+constexpr auto same_symbol(const BasicIdentifier<L>& a, const BasicIdentifier<M>& b) -> bool {
+    if (a.symbol_id != symbol::no_symbol && b.symbol_id != symbol::no_symbol) {
+        return a.symbol_id == b.symbol_id;
+    }
+    return std::string_view{a.lexeme} == std::string_view{b.lexeme};
+}
+
+using Identifier = BasicIdentifier<std::string>;
+using IdentifierView = BasicIdentifier<std::string_view>;
+
+// A numeric literal of length bytes, converted to its value as it is lexed. Lexeme is only used
+// for the text of numbers too big for the machine types.
+template <typename Lexeme>
+struct BasicNumber {
+    uint_fast32_t offset;
+    uint_fast32_t length;
+    number::BasicValue<Lexeme> value;
 };
 
+using Number = BasicNumber<std::string>;
+using NumberView = BasicNumber<std::string_view>;
+
 // struct Plus {
 //     uint_fast32_t line_number;
 //     uint_fast32_t col_number;
@@ -54,10 +115,10 @@ struct Identifier {
 //     uint_fast32_t col_number;
 // };
 
-// struct Dot {
-//     uint_fast32_t line_number;
-//     uint_fast32_t col_number;
-// };
+// '.' on its own, separating the tail of a dotted list
+struct Dot {
+    uint_fast32_t offset;
+};
 
 // struct Quote {
 //     uint_fast32_t line_number;
@@ -88,19 +149,70 @@ struct Identifier {
 // };
 
 struct LParen {
-    uint_fast32_t line_number;
-    uint_fast32_t col_number;
+    uint_fast32_t offset;
 };
 
 struct RParen {
-    uint_fast32_t line_number;
-    uint_fast32_t col_number;
+    uint_fast32_t offset;
+};
+
+// "#(", opening a vector
+struct VectorOpen {
+    uint_fast32_t offset;
 };
 
 // using Token = std::variant<Eof, Identifier, Plus, Minus, Dot, Quote, Quasiquote, String, True,
 //                           False, LParen, RParen>;
 
-using Token = std::variant<Eof, LParen, RParen, Identifier>;
+template <typename Lexeme>
+using BasicToken = std::variant<Eof, LParen, RParen, VectorOpen, Dot, BasicIdentifier<Lexeme>,
+                                BasicNumber<Lexeme>>;
+
+// Token owns its lexemes, TokenView borrows them from the lexed source
+using Token = BasicToken<std::string>;
+using TokenView = BasicToken<std::string_view>;
+
+// What a token is, without its data, in the order of the alternatives of BasicToken; error
+// stands for a lex error in place of a token
+enum class Kind : uint8_t { eof, lparen, rparen, vector_open, dot, identifier, number, error };
+
+inline constexpr std::size_t kind_count = static_cast<std::size_t>(Kind::error) + 1;
+
+template <typename Lexeme>
+constexpr auto kind_of(const BasicToken<Lexeme>& tok) -> Kind {
+    return static_cast<Kind>(tok.index());
+}
+
+static_assert(std::is_same_v<std::variant_alternative_t<static_cast<std::size_t>(Kind::identifier),
+                                                        TokenView>,
+                             IdentifierView>);
+static_assert(std::is_same_v<std::variant_alternative_t<static_cast<std::size_t>(Kind::number),
+                                                        TokenView>,
+                             NumberView> &&
+              std::variant_size_v<TokenView> == static_cast<std::size_t>(Kind::error));
+
+// Text a token is printed as
+constexpr auto lexeme_of(const Eof& /*tok*/) -> std::string_view { return "EOF"; }
+constexpr auto lexeme_of(const LParen& /*tok*/) -> std::string_view { return "("; }
+constexpr auto lexeme_of(const RParen& /*tok*/) -> std::string_view { return ")"; }
+constexpr auto lexeme_of(const VectorOpen& /*tok*/) -> std::string_view { return "#("; }
+constexpr auto lexeme_of(const Dot& /*tok*/) -> std::string_view { return "."; }
+
+template <typename Lexeme>
+constexpr auto lexeme_of(const BasicIdentifier<Lexeme>& tok) -> std::string_view {
+    return tok.lexeme;
+}
+
+// Text of any token, which for numbers is their value
+template <typename Lexeme>
+auto text_of(const BasicToken<Lexeme>& tok) -> std::string {
+    return std::visit(
+        util::overloads{
+            [](const BasicNumber<Lexeme>& num) { return number::format_value(num.value); },
+            [](const auto& alternative) { return std::string{lexeme_of(alternative)}; },
+        },
+        tok);
+}
 
 }  // namespace token
 
@@ -111,13 +223,21 @@ struct std::formatter<token::Eof> : std::formatter<std::string> {
     }
 };
 
-template <>
-struct std::formatter<token::Identifier> : std::formatter<std::string> {
-    auto format(const token::Identifier& tok, format_context& ctx) const {
+template <typename Lexeme>
+struct std::formatter<token::BasicIdentifier<Lexeme>> : std::formatter<std::string> {
+    auto format(const token::BasicIdentifier<Lexeme>& tok, format_context& ctx) const {
         return formatter<string>::format(token::format_tok(tok), ctx);
     }
 };
 
+template <typename Lexeme>
+struct std::formatter<token::BasicNumber<Lexeme>> : std::formatter<std::string> {
+    auto format(const token::BasicNumber<Lexeme>& tok, format_context& ctx) const {
+        return formatter<string>::format(
+            token::format_tok(tok, number::format_value(tok.value)), ctx);
+    }
+};
+
 // template <>
 // struct std::formatter<token::Plus> : std::formatter<std::string> {
 //     auto format(const token::Plus& tok, format_context& ctx) const {
@@ -131,12 +251,13 @@ struct std::formatter<token::Identifier> : std::formatter<std::string> {
 //         return formatter<string>::format(std::format("['-', line {}]", tok.line_number), ctx);
 //     }
 // };
-// template <>
-// struct std::formatter<token::Dot> : std::formatter<std::string> {
-//     auto format(const token::Dot& tok, format_context& ctx) const {
-//         return formatter<string>::format(std::format("['.', line {}]", tok.line_number), ctx);
-//     }
-// };
+
+template <>
+struct std::formatter<token::Dot> : std::formatter<std::string> {
+    auto format(const token::Dot& tok, format_context& ctx) const {
+        return formatter<string>::format(token::format_tok(tok, "."), ctx);
+    }
+};
 
 // template <>
 // struct std::formatter<token::Quote> : std::formatter<std::string> {
@@ -179,8 +300,15 @@ struct std::formatter<token::RParen> : std::formatter<std::string> {
 };
 
 template <>
-struct std::formatter<token::Token> : std::formatter<std::string> {
-    auto format(const token::Token& tok, format_context& ctx) const {
+struct std::formatter<token::VectorOpen> : std::formatter<std::string> {
+    auto format(const token::VectorOpen& tok, format_context& ctx) const {
+        return formatter<string>::format(token::format_tok(tok, "#("), ctx);
+    }
+};
+
+template <typename Lexeme>
+struct std::formatter<token::BasicToken<Lexeme>> : std::formatter<std::string> {
+    auto format(const token::BasicToken<Lexeme>& tok, format_context& ctx) const {
         struct Visitor {
             format_context& ctx;  // NOLINT
             auto operator()(const token::Eof tok) {
@@ -192,11 +320,29 @@ struct std::formatter<token::Token> : std::formatter<std::string> {
             auto operator()(const token::RParen& tok) {
                 return std::formatter<token::RParen>{}.format(tok, ctx);
             }
-            auto operator()(const token::Identifier& tok) {
-                return std::formatter<token::Identifier>{}.format(tok, ctx);
+            auto operator()(const token::VectorOpen& tok) {
+                return std::formatter<token::VectorOpen>{}.format(tok, ctx);
+            }
+            auto operator()(const token::Dot& tok) {
+                return std::formatter<token::Dot>{}.format(tok, ctx);
+            }
+            auto operator()(const token::BasicIdentifier<Lexeme>& tok) {
+                return std::formatter<token::BasicIdentifier<Lexeme>>{}.format(tok, ctx);
+            }
+            auto operator()(const token::BasicNumber<Lexeme>& tok) {
+                return std::formatter<token::BasicNumber<Lexeme>>{}.format(tok, ctx);
             }
         };
 
         return std::visit(Visitor{ctx}, tok);
     }
 };
+
+template <typename Lexeme>
+struct std::formatter<token::Located<token::BasicToken<Lexeme>>> : std::formatter<std::string> {
+    auto format(const token::Located<token::BasicToken<Lexeme>>& tok,
+                format_context& ctx) const {
+        return formatter<string>::format(
+            token::format_tok(tok.location, token::text_of(tok.value)), ctx);
+    }
+};
@@ -0,0 +1,259 @@
+// token_buffer.hpp
+// structure-of-arrays storage for every token of a source, and the batch lexer filling it
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <limits>
+#include <ranges>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "lexer.hpp"
+#include "number.hpp"
+#include "symbol_table.hpp"
+#include "token.hpp"
+#include "util.hpp"
+
+namespace token {
+
+// A single token of a TokenBuffer, with the payload as described there
+struct TokenRef {
+    Kind kind;
+    uint32_t offset;
+    uint32_t payload;
+};
+
+// Tokens of one contiguous source as parallel arrays: kind, byte offset and a 32-bit payload,
+// which is the lexeme length for identifiers, numbers and errors, or the symbol id for
+// identifiers of an interned buffer (their text is then in the symbol table). Nine bytes per token
+// instead of a whole std::expected<token::Token, LexError>, and passes that only look at kinds
+// stay in cache. Number values do not fit the payload; number_value() converts them again from
+// the source. The buffer refers to the source without owning it.
+class TokenBuffer {
+   private:
+    std::string_view m_source{};
+    bool m_interned{false};
+
+    std::vector<Kind> m_kinds{};
+    std::vector<uint32_t> m_offsets{};
+    std::vector<uint32_t> m_payloads{};
+
+   public:
+    // Dense code averages about 2.6 source bytes per token and indented code 4 to 9. Reserving for
+    // 2 avoids regrowing on anything but paren soup; tokenize_all gives back the slack once done.
+    static constexpr std::size_t bytes_per_token_estimate = 2;
+
+    TokenBuffer() = default;
+    explicit TokenBuffer(std::string_view source, bool interned = false)
+        : m_source{source}, m_interned{interned} {}
+
+    void reserve(std::size_t tokens) {
+        m_kinds.reserve(tokens);
+        m_offsets.reserve(tokens);
+        m_payloads.reserve(tokens);
+    }
+
+    // Release the capacity reserved past the tokens held
+    void shrink_to_fit() {
+        m_kinds.shrink_to_fit();
+        m_offsets.shrink_to_fit();
+        m_payloads.shrink_to_fit();
+    }
+
+    void push_back(Kind kind, uint32_t offset, uint32_t payload = 0) {
+        m_kinds.push_back(kind);
+        m_offsets.push_back(offset);
+        m_payloads.push_back(payload);
+    }
+
+    // Append the tokens of other from index first on
+    void append(const TokenBuffer& other, std::size_t first = 0) {
+        auto from = static_cast<std::ptrdiff_t>(first);
+        m_kinds.insert(m_kinds.end(), other.m_kinds.begin() + from, other.m_kinds.end());
+        m_offsets.insert(m_offsets.end(), other.m_offsets.begin() + from, other.m_offsets.end());
+        m_payloads.insert(m_payloads.end(), other.m_payloads.begin() + from,
+                          other.m_payloads.end());
+    }
+
+    // Replace tokens [first, last) by all of tokens, then move the offsets of the tokens after
+    // them by shift bytes
+    void splice(std::size_t first, std::size_t last, const TokenBuffer& tokens, int64_t shift) {
+        // overwrite in place and only move the tail when the token count changes
+        auto replace = [first, last](auto& into, const auto& from) {
+            auto common = std::min(last - first, from.size());
+            auto at = into.begin() + static_cast<std::ptrdiff_t>(first + common);
+            std::copy_n(from.begin(), common, into.begin() + static_cast<std::ptrdiff_t>(first));
+            if (from.size() > common) {
+                into.insert(at, from.begin() + static_cast<std::ptrdiff_t>(common), from.end());
+            } else {
+                into.erase(at, into.begin() + static_cast<std::ptrdiff_t>(last));
+            }
+        };
+        replace(m_kinds, tokens.m_kinds);
+        replace(m_offsets, tokens.m_offsets);
+        replace(m_payloads, tokens.m_payloads);
+        if (shift == 0) return;
+        for (auto i = first + tokens.size(); i < m_offsets.size(); i++) {
+            m_offsets[i] += static_cast<uint32_t>(shift);  // wraps around for negative shifts
+        }
+    }
+
+    // Point the buffer at a new version of its source, as after an edit
+    void set_source(std::string_view source) { m_source = source; }
+
+    [[nodiscard]] auto size() const -> std::size_t { return m_kinds.size(); }
+    [[nodiscard]] auto empty() const -> bool { return m_kinds.empty(); }
+    [[nodiscard]] auto source() const -> std::string_view { return m_source; }
+    [[nodiscard]] auto interned() const -> bool { return m_interned; }
+
+    [[nodiscard]] auto kinds() const -> std::span<const Kind> { return m_kinds; }
+    [[nodiscard]] auto offsets() const -> std::span<const uint32_t> { return m_offsets; }
+    [[nodiscard]] auto payloads() const -> std::span<const uint32_t> { return m_payloads; }
+
+    [[nodiscard]] auto operator[](std::size_t i) const -> TokenRef {
+        return TokenRef{.kind = m_kinds[i], .offset = m_offsets[i], .payload = m_payloads[i]};
+    }
+
+    [[nodiscard]] auto kind(std::size_t i) const -> Kind { return m_kinds[i]; }
+    [[nodiscard]] auto offset(std::size_t i) const -> uint32_t { return m_offsets[i]; }
+
+    // Every token starts in the lexer's initial state, so each one is a point to resume lexing at
+    [[nodiscard]] auto checkpoint(std::size_t i) const -> lexer::Checkpoint {
+        return lexer::Checkpoint{
+            .offset = m_offsets[i], .lexeme_offset = m_offsets[i], .state{lexer::InitState{}}};
+    }
+
+    // Symbol id of an identifier of an interned buffer
+    [[nodiscard]] auto symbol(std::size_t i) const -> symbol::Id {
+        assert(m_interned && m_kinds[i] == Kind::identifier);
+        return m_payloads[i];
+    }
+
+    // Value of number i
+    [[nodiscard]] auto number_value(std::size_t i) const -> number::ValueView {
+        assert(m_kinds[i] == Kind::number);
+        return *number::parse(lexeme(i));
+    }
+
+    // Source text of token i; identifiers of an interned buffer are looked up in the table instead
+    [[nodiscard]] auto lexeme(std::size_t i) const -> std::string_view {
+        switch (m_kinds[i]) {
+            case Kind::eof:
+                return {};
+            case Kind::lparen:
+            case Kind::rparen:
+            case Kind::dot:
+                return m_source.substr(m_offsets[i], 1);
+            case Kind::vector_open:
+                return m_source.substr(m_offsets[i], 2);
+            case Kind::identifier:
+                assert(!m_interned);
+                [[fallthrough]];
+            case Kind::number:
+            case Kind::error:
+                return m_source.substr(m_offsets[i], m_payloads[i]);
+        }
+        return {};
+    }
+
+    // Bytes held by the token arrays, spare capacity included. Buffers from tokenize_all and
+    // parallel_lex have none, so this is the nine bytes of each token.
+    [[nodiscard]] auto memory_usage() const -> std::size_t {
+        return m_kinds.capacity() * sizeof(Kind) +
+               (m_offsets.capacity() + m_payloads.capacity()) * sizeof(uint32_t);
+    }
+};
+
+}  // namespace token
+
+namespace lexer {
+
+namespace detail {
+
+// Append tok to buffer, its offset shifted by base
+template <typename Lexeme>
+void push_token(token::TokenBuffer& buffer,
+                const std::expected<token::BasicToken<Lexeme>, LexError>& tok, uint32_t base = 0) {
+    if (!tok) {
+        const auto& err = std::get<InvalidTokenError>(tok.error());
+        buffer.push_back(token::Kind::error, base + err.offset,
+                         static_cast<uint32_t>(err.lexeme.size()));
+        return;
+    }
+    std::visit(util::overloads{
+                   [&buffer, base](const token::Eof& t) {
+                       buffer.push_back(token::Kind::eof, base + t.offset);
+                   },
+                   [&buffer, base](const token::LParen& t) {
+                       buffer.push_back(token::Kind::lparen, base + t.offset, 1);
+                   },
+                   [&buffer, base](const token::RParen& t) {
+                       buffer.push_back(token::Kind::rparen, base + t.offset, 1);
+                   },
+                   [&buffer, base](const token::VectorOpen& t) {
+                       buffer.push_back(token::Kind::vector_open, base + t.offset, 2);
+                   },
+                   [&buffer, base](const token::Dot& t) {
+                       buffer.push_back(token::Kind::dot, base + t.offset, 1);
+                   },
+                   [&buffer, base](const token::BasicIdentifier<Lexeme>& t) {
+                       auto payload = buffer.interned() ? t.symbol_id
+                                                        : static_cast<uint32_t>(t.lexeme.size());
+                       buffer.push_back(token::Kind::identifier, base + t.offset, payload);
+                   },
+                   [&buffer, base](const token::BasicNumber<Lexeme>& t) {
+                       buffer.push_back(token::Kind::number, base + t.offset,
+                                        static_cast<uint32_t>(t.length));
+                   },
+               },
+               *tok);
+}
+
+template <symbol::Interner Symbols>
+auto tokenize_into(token::TokenBuffer& buffer, Lexer<std::string_view, Symbols> tokens) -> void {
+    buffer.reserve(buffer.source().size() / token::TokenBuffer::bytes_per_token_estimate + 1);
+    for (const auto& tok : tokens) push_token(buffer, tok);
+    buffer.shrink_to_fit();
+}
+
+inline auto checked_source(std::string_view src) -> std::string_view {
+    if (src.size() > std::numeric_limits<uint32_t>::max()) {
+        throw std::length_error{"token buffers address sources of at most 4 GiB"};
+    }
+    return src;
+}
+
+}  // namespace detail
+
+// Lex all of src in one go. src must outlive the buffer.
+template <std::ranges::contiguous_range R>
+    requires std::same_as<std::ranges::range_value_t<R>, char>
+auto tokenize_all(const R& src) -> token::TokenBuffer {
+    auto source = detail::checked_source(std::string_view{std::ranges::data(src),
+                                                          std::ranges::size(src)});
+    token::TokenBuffer buffer{source};
+    detail::tokenize_into(buffer, Lexer<std::string_view>{source});
+    return buffer;
+}
+
+// Lex all of src in one go, interning identifiers into symbols
+template <std::ranges::contiguous_range R, symbol::Interner Symbols>
+    requires std::same_as<std::ranges::range_value_t<R>, char>
+auto tokenize_all(const R& src, Symbols& symbols) -> token::TokenBuffer {
+    auto source = detail::checked_source(std::string_view{std::ranges::data(src),
+                                                          std::ranges::size(src)});
+    token::TokenBuffer buffer{source, true};
+    detail::tokenize_into(buffer, Lexer<std::string_view, Symbols>{source, symbols});
+    return buffer;
+}
+
+}  // namespace lexer
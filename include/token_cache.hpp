@@ -0,0 +1,452 @@
+// token_cache.hpp
+// lexed sources saved to a cache directory, keyed by content hash, and mapped back without lexing
+
+#pragma once
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <expected>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "lexer_types.hpp"
+#include "mapped_file.hpp"
+#include "number.hpp"
+#include "source_map.hpp"
+#include "symbol_table.hpp"
+#include "token.hpp"
+#include "token_buffer.hpp"
+
+namespace token_cache {
+
+// Part of every key: bump it whenever the lexer yields different tokens for some source, so that
+// entries written by an older lexer are not used
+inline constexpr uint32_t lexer_version = 1;
+
+namespace detail {
+
+inline constexpr uint64_t prime_1 = 0x9E3779B185EBCA87ULL;
+inline constexpr uint64_t prime_2 = 0xC2B2AE3D27D4EB4FULL;
+inline constexpr uint64_t prime_3 = 0x165667B19E3779F9ULL;
+inline constexpr uint64_t prime_4 = 0x85EBCA77C2B2AE63ULL;
+inline constexpr uint64_t prime_5 = 0x27D4EB2F165667C5ULL;
+
+inline auto load_u64(const char* p) -> uint64_t {
+    uint64_t word{};
+    std::memcpy(&word, p, sizeof(word));
+    return word;
+}
+
+inline auto round(uint64_t acc, uint64_t input) -> uint64_t {
+    return std::rotl(acc + input * prime_2, 31) * prime_1;
+}
+
+inline auto merge(uint64_t acc, uint64_t lane) -> uint64_t {
+    return (acc ^ round(0, lane)) * prime_1 + prime_4;
+}
+
+}  // namespace detail
+
+// 64-bit hash of bytes, after XXH64: four independent lanes take 32 bytes per round, so it runs
+// at several bytes per cycle. It tells contents apart, and corrupt entries from whole ones; it is
+// no defence against anyone forging a collision.
+inline auto content_hash(std::string_view bytes, uint64_t seed = 0) -> uint64_t {
+    using namespace detail;
+    const char* p = bytes.data();
+    const char* last = p + bytes.size();
+    uint64_t hash{};
+
+    if (bytes.size() >= 32) {
+        std::array<uint64_t, 4> lanes{seed + prime_1 + prime_2, seed + prime_2, seed,
+                                      seed - prime_1};
+        for (; last - p >= 32; p += 32) {
+            for (std::size_t i = 0; i < lanes.size(); i++) {
+                lanes[i] = round(lanes[i], load_u64(p + i * 8));
+            }
+        }
+        hash = std::rotl(lanes[0], 1) + std::rotl(lanes[1], 7) + std::rotl(lanes[2], 12) +
+               std::rotl(lanes[3], 18);
+        for (auto lane : lanes) hash = merge(hash, lane);
+    } else {
+        hash = seed + prime_5;
+    }
+    hash += bytes.size();
+
+    for (; last - p >= 8; p += 8) {
+        hash = std::rotl(hash ^ round(0, load_u64(p)), 27) * prime_1 + prime_4;
+    }
+    for (; p != last; p++) {
+        hash = std::rotl(hash ^ (static_cast<unsigned char>(*p) * prime_5), 11) * prime_1;
+    }
+
+    hash ^= hash >> 33U;
+    hash *= prime_2;
+    hash ^= hash >> 29U;
+    hash *= prime_3;
+    hash ^= hash >> 32U;
+    return hash;
+}
+
+namespace detail {
+
+// An entry is this header, then the offsets and payloads of the tokens, the offsets of the
+// identifier names into the name text (one more than there are names), the token kinds and the
+// name text. Arrays of 32-bit words come first, so every array is aligned in a mapping. Words are
+// in the byte order of the machine that wrote them; the magic number tells another one apart.
+struct Header {
+    uint64_t magic;
+    uint32_t format_version;
+    uint32_t lexer_version;
+    uint64_t source_hash;
+    uint64_t source_size;
+    uint32_t token_count;
+    uint32_t name_count;
+    uint64_t name_bytes;
+    uint64_t body_hash;  // of everything after the header
+};
+
+inline constexpr uint64_t magic = 0x31304B4F544D4353ULL;  // "SCMTOK01" read little-endian
+inline constexpr uint32_t format_version = 1;
+
+static_assert(sizeof(Header) == 56 && alignof(Header) == 8);
+
+// Bytes an entry of header takes after the header, if its counts could be a source's
+inline auto body_size(const Header& header) -> std::optional<std::size_t> {
+    // every token but Eof has at least one byte of source, and every name one token
+    if (header.token_count == 0 || header.token_count - 1 > header.source_size ||
+        header.name_count >= header.token_count || header.name_bytes > header.source_size) {
+        return std::nullopt;
+    }
+    std::size_t tokens = header.token_count;
+    std::size_t names = header.name_count;
+    return tokens * 2 * sizeof(uint32_t) + (names + 1) * sizeof(uint32_t) +
+           tokens * sizeof(token::Kind) + header.name_bytes;
+}
+
+}  // namespace detail
+
+// CachedTokens
+// The tokens of a source as a cache entry holds them, in a mapping of the entry or, when it was
+// just lexed, the bytes written to it. Loading one does not allocate per token: the token arrays
+// and identifier names are read where they lie. As a view it yields the tokens Lexer does for the
+// same source, so it composes with reader::read, except that identifier lexemes are in the entry
+// and only numbers and errors refer to the source, which must outlive the tokens.
+// Identifiers carry ids local to the source, 0 for the first name it uses, 1 for the next; after
+// intern_into they carry the ids of a symbol table.
+class CachedTokens : public std::ranges::view_interface<CachedTokens> {
+   private:
+    std::string_view m_source{};
+    io::mapped_file m_file{};
+    std::vector<char> m_bytes{};
+    bool m_from_cache{false};
+
+    std::span<const uint32_t> m_offsets{};
+    std::span<const uint32_t> m_payloads{};
+    std::span<const uint32_t> m_name_offsets{};
+    std::span<const token::Kind> m_kinds{};
+    std::string_view m_names{};
+    std::vector<symbol::Id> m_symbols{};
+
+    // Point the arrays into the entry at data, checked against its header
+    auto attach(const char* data, std::size_t size, uint64_t source_hash) -> bool {
+        detail::Header header{};
+        if (size < sizeof(header)) return false;
+        std::memcpy(&header, data, sizeof(header));
+        auto body = detail::body_size(header);
+        if (header.magic != detail::magic || header.format_version != detail::format_version ||
+            header.lexer_version != lexer_version || header.source_hash != source_hash ||
+            header.source_size != m_source.size() || !body || size != sizeof(header) + *body) {
+            return false;
+        }
+        std::string_view body_bytes{data + sizeof(header), *body};
+        if (content_hash(body_bytes) != header.body_hash) return false;
+
+        const auto* words = reinterpret_cast<const uint32_t*>(body_bytes.data());  // NOLINT
+        std::size_t tokens = header.token_count;
+        std::size_t names = header.name_count;
+        m_offsets = {words, tokens};
+        m_payloads = {words + tokens, tokens};
+        m_name_offsets = {words + 2 * tokens, names + 1};
+        const auto* kinds =
+            reinterpret_cast<const token::Kind*>(words + 2 * tokens + names + 1);  // NOLINT
+        m_kinds = {kinds, tokens};
+        m_names = {reinterpret_cast<const char*>(kinds + tokens), header.name_bytes};  // NOLINT
+
+        // the body hash is the writer's own, so it shows the entry is whole but not that its
+        // tokens are ones Lexer could yield for the source: check that each can be made
+        if (m_kinds.back() != token::Kind::eof || m_name_offsets.front() != 0 ||
+            m_name_offsets.back() != m_names.size() || !std::ranges::is_sorted(m_name_offsets)) {
+            return false;
+        }
+        for (std::size_t i = 0; i < tokens; i++) {
+            auto tok = (*this)[i];
+            if (static_cast<std::size_t>(tok.kind) >= token::kind_count) return false;
+            if (tok.kind == token::Kind::identifier) {
+                if (tok.payload >= names) return false;
+            } else if (uint64_t{tok.offset} + tok.payload > m_source.size()) {
+                return false;
+            } else if (tok.kind == token::Kind::number &&
+                       !number::is_literal(m_source.substr(tok.offset, tok.payload))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+   public:
+    using token_type = token::BasicToken<std::string_view>;
+    using result_type = std::expected<token_type, lexer::LexError>;
+
+    CachedTokens() = default;
+
+    // Tokens of source from the entry in file, or nothing if it is not a whole entry for source
+    static auto load(std::string_view source, uint64_t source_hash, io::mapped_file file)
+        -> std::optional<CachedTokens> {
+        CachedTokens tokens{};
+        tokens.m_source = source;
+        tokens.m_file = std::move(file);
+        tokens.m_from_cache = true;
+        if (!tokens.attach(tokens.m_file.data(), tokens.m_file.size(), source_hash)) {
+            return std::nullopt;
+        }
+        return tokens;
+    }
+
+    // Tokens of source from the entry serialised in bytes, which must be whole
+    static auto adopt(std::string_view source, uint64_t source_hash, std::vector<char> bytes)
+        -> CachedTokens {
+        CachedTokens tokens{};
+        tokens.m_source = source;
+        tokens.m_bytes = std::move(bytes);
+        [[maybe_unused]] auto whole =
+            tokens.attach(tokens.m_bytes.data(), tokens.m_bytes.size(), source_hash);
+        assert(whole);
+        return tokens;
+    }
+
+    class Iterator {
+       private:
+        const CachedTokens* m_tokens{nullptr};
+        std::size_t m_index{0};
+
+       public:
+        // Iterator boilerplate
+        using difference_type = std::ptrdiff_t;
+        using value_type = result_type;
+        using iterator_concept = std::forward_iterator_tag;
+
+        Iterator() = default;
+        Iterator(const CachedTokens* tokens, std::size_t index)
+            : m_tokens{tokens}, m_index{index} {}
+
+        auto operator*() const -> result_type {
+            auto tok = (*m_tokens)[m_index];
+            auto lexeme = [this, &tok] {
+                return m_tokens->m_source.substr(tok.offset, tok.payload);
+            };
+            switch (tok.kind) {
+                case token::Kind::lparen:
+                    return token::LParen{.offset = tok.offset};
+                case token::Kind::rparen:
+                    return token::RParen{.offset = tok.offset};
+                case token::Kind::vector_open:
+                    return token::VectorOpen{.offset = tok.offset};
+                case token::Kind::dot:
+                    return token::Dot{.offset = tok.offset};
+                case token::Kind::identifier:
+                    return token::IdentifierView{.offset = tok.offset,
+                                                 .lexeme = m_tokens->name(tok.payload),
+                                                 .symbol_id = m_tokens->symbol(tok.payload)};
+                case token::Kind::number:
+                    return token::NumberView{.offset = tok.offset,
+                                             .length = tok.payload,
+                                             .value = *number::parse(lexeme())};
+                case token::Kind::error:
+                    return std::unexpected(lexer::InvalidTokenError{
+                        .offset = tok.offset, .lexeme = std::string{lexeme()}});
+                case token::Kind::eof:
+                    break;
+            }
+            return token::Eof{.offset = tok.offset};
+        }
+
+        auto operator++() -> Iterator& {
+            ++m_index;
+            return *this;
+        }
+
+        auto operator++(int) -> Iterator {
+            auto it = *this;
+            ++m_index;
+            return it;
+        }
+
+        auto operator==(const Iterator& other) const -> bool { return m_index == other.m_index; }
+    };
+
+    [[nodiscard]] auto begin() const -> Iterator { return Iterator{this, 0}; }
+    [[nodiscard]] auto end() const -> Iterator { return Iterator{this, size()}; }
+
+    [[nodiscard]] auto size() const -> std::size_t { return m_kinds.size(); }
+    [[nodiscard]] auto source() const -> std::string_view { return m_source; }
+    // whether the tokens were loaded from the cache rather than lexed
+    [[nodiscard]] auto from_cache() const -> bool { return m_from_cache; }
+
+    [[nodiscard]] auto kinds() const -> std::span<const token::Kind> { return m_kinds; }
+    [[nodiscard]] auto offsets() const -> std::span<const uint32_t> { return m_offsets; }
+    // lexeme lengths, but local name ids for identifiers
+    [[nodiscard]] auto payloads() const -> std::span<const uint32_t> { return m_payloads; }
+
+    [[nodiscard]] auto operator[](std::size_t i) const -> token::TokenRef {
+        return {.kind = m_kinds[i], .offset = m_offsets[i], .payload = m_payloads[i]};
+    }
+
+    // Names of the identifiers of the source, by local id
+    [[nodiscard]] auto name_count() const -> std::size_t { return m_name_offsets.size() - 1; }
+    [[nodiscard]] auto name(uint32_t id) const -> std::string_view {
+        return m_names.substr(m_name_offsets[id], m_name_offsets[id + 1] - m_name_offsets[id]);
+    }
+
+    // Intern the names of the source into symbols, once each rather than once per identifier, so
+    // that identifiers carry their ids in it
+    template <symbol::Interner Symbols>
+    void intern_into(Symbols& symbols) {
+        m_symbols.clear();
+        m_symbols.reserve(name_count());
+        for (uint32_t id = 0; id < name_count(); id++) {
+            m_symbols.push_back(symbols.intern(name(id)));
+        }
+    }
+
+    // Symbol id of the name with local id, if the names were interned
+    [[nodiscard]] auto symbol(uint32_t id) const -> symbol::Id {
+        return m_symbols.empty() ? symbol::no_symbol : m_symbols[id];
+    }
+
+    // A source map is cheap to make and indexes the source only when asked for a location
+    [[nodiscard]] auto source_map() const -> lexer::SourceMap {
+        return lexer::SourceMap{m_source};
+    }
+};
+
+// Lex source into an entry's bytes
+inline auto serialise(std::string_view source, uint64_t source_hash) -> std::vector<char> {
+    symbol::SymbolTable names{};
+    auto tokens = lexer::tokenize_all(source, names);
+
+    detail::Header header{.magic = detail::magic,
+                          .format_version = detail::format_version,
+                          .lexer_version = lexer_version,
+                          .source_hash = source_hash,
+                          .source_size = source.size(),
+                          .token_count = static_cast<uint32_t>(tokens.size()),
+                          .name_count = static_cast<uint32_t>(names.size()),
+                          .name_bytes = 0,
+                          .body_hash = 0};
+    std::vector<uint32_t> name_offsets{0};
+    for (uint32_t id = 0; id < names.size(); id++) {
+        header.name_bytes += names.name(id).size();
+        name_offsets.push_back(static_cast<uint32_t>(header.name_bytes));
+    }
+
+    std::vector<char> bytes(sizeof(header) + *detail::body_size(header));
+    auto* out = bytes.data() + sizeof(header);
+    auto write = [&out](const auto& items) {
+        auto size = std::ranges::size(items) * sizeof(*std::ranges::data(items));
+        std::memcpy(out, std::ranges::data(items), size);
+        out += size;
+    };
+    write(tokens.offsets());
+    write(tokens.payloads());
+    write(name_offsets);
+    write(tokens.kinds());
+    for (uint32_t id = 0; id < names.size(); id++) write(names.name(id));
+
+    header.body_hash =
+        content_hash({bytes.data() + sizeof(header), bytes.size() - sizeof(header)});
+    std::memcpy(bytes.data(), &header, sizeof(header));
+    return bytes;
+}
+
+// TokenCache
+// A directory of entries, one per source content and lexer version. A source whose entry is
+// missing, stale or corrupt is lexed and its entry (re)written; entries are written to a temporary
+// file and renamed into place, so processes sharing the directory never see half an entry. The
+// cache only speeds lexing up: if an entry cannot be written, the tokens are returned regardless.
+class TokenCache {
+   private:
+    std::filesystem::path m_directory;
+
+   public:
+    explicit TokenCache(std::filesystem::path directory) : m_directory{std::move(directory)} {
+        std::filesystem::create_directories(m_directory);
+    }
+
+    [[nodiscard]] auto directory() const -> const std::filesystem::path& { return m_directory; }
+
+    [[nodiscard]] auto entry_path(uint64_t source_hash) const -> std::filesystem::path {
+        return m_directory / std::format("{:016x}-{}.tokens", source_hash, lexer_version);
+    }
+
+    // The tokens of source from its entry, if it has a valid one
+    [[nodiscard]] auto load(std::string_view source) const -> std::optional<CachedTokens> {
+        return load(source, content_hash(source));
+    }
+
+    [[nodiscard]] auto load(std::string_view source, uint64_t source_hash) const
+        -> std::optional<CachedTokens> {
+        std::error_code err{};
+        auto path = entry_path(source_hash);
+        if (!std::filesystem::is_regular_file(path, err)) return std::nullopt;
+        try {
+            return CachedTokens::load(source, source_hash, io::mapped_file{path});
+        } catch (const std::system_error&) {
+            return std::nullopt;
+        }
+    }
+
+    // Lex source and write its entry, replacing any there is
+    auto store(std::string_view source, uint64_t source_hash) const -> CachedTokens {
+        auto bytes = serialise(source, source_hash);
+        auto path = entry_path(source_hash);
+        // unique to the process and thread, as several may write the same entry at once
+        auto temporary = path;
+        temporary += std::format(".{}.{}", getpid(),
+                                 std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        std::ofstream out{temporary, std::ios::binary | std::ios::trunc};
+        out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        out.close();
+        std::error_code err{};
+        if (out) std::filesystem::rename(temporary, path, err);
+        if (!out || err) std::filesystem::remove(temporary, err);
+        return CachedTokens::adopt(source, source_hash, std::move(bytes));
+    }
+
+    // The tokens of source, from the cache when it can
+    auto tokens(std::string_view source) const -> CachedTokens {
+        auto source_hash = content_hash(source);
+        if (auto cached = load(source, source_hash)) return std::move(*cached);
+        return store(source, source_hash);
+    }
+};
+
+}  // namespace token_cache
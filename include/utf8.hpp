@@ -0,0 +1,102 @@
+// utf8.hpp
+// validation and code point counting of UTF-8 text
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "simd_scan.hpp"
+
+namespace utf8 {
+
+constexpr auto is_continuation(const char c) -> bool {
+    return (static_cast<unsigned char>(c) & 0xC0U) == 0x80U;
+}
+
+namespace detail {
+
+// The length of the sequence a byte starts, 0 for bytes no sequence starts with, and the range
+// of the byte after it. That range is narrower than the 80..BF of the other continuation bytes
+// for the leads that could otherwise encode an overlong form, a surrogate or a code point past
+// U+10FFFF (Unicode table 3-7).
+struct Lead {
+    std::size_t length;
+    unsigned char lo;
+    unsigned char hi;
+};
+
+constexpr auto lead_of(const char c) -> Lead {
+    auto byte = static_cast<unsigned char>(c);
+    if (byte < 0x80) return {1, 0, 0};
+    if (byte < 0xC2) return {0, 0, 0};
+    if (byte < 0xE0) return {2, 0x80, 0xBF};
+    if (byte == 0xE0) return {3, 0xA0, 0xBF};
+    if (byte == 0xED) return {3, 0x80, 0x9F};
+    if (byte < 0xF0) return {3, 0x80, 0xBF};
+    if (byte == 0xF0) return {4, 0x90, 0xBF};
+    if (byte < 0xF4) return {4, 0x80, 0xBF};
+    if (byte == 0xF4) return {4, 0x80, 0x8F};
+    return {0, 0, 0};
+}
+
+// Length of the well-formed sequence at first, or 0 if there is none
+constexpr auto sequence_length(const char* first, const char* last) -> std::size_t {
+    auto lead = lead_of(*first);
+    if (lead.length == 0 || static_cast<std::size_t>(last - first) < lead.length) return 0;
+    for (std::size_t i = 1; i < lead.length; i++) {
+        auto byte = static_cast<unsigned char>(first[i]);
+        auto lo = i == 1 ? lead.lo : 0x80;
+        auto hi = i == 1 ? lead.hi : 0xBF;
+        if (byte < lo || byte > hi) return 0;
+    }
+    return lead.length;
+}
+
+}  // namespace detail
+
+// First byte of [first, last) that is not part of a well-formed sequence, or last. Runs of ASCII
+// are skipped a vector at a time and only the bytes after a high bit are decoded.
+constexpr auto validate(const char* first, const char* last) -> const char* {
+    while (first != last) {
+        if consteval {
+            if (static_cast<unsigned char>(*first) < 0x80) {
+                first++;
+                continue;
+            }
+        } else {
+            first = scan::skip_ascii(first, last);
+            if (first == last) break;
+        }
+        // a run of multibyte sequences, up to the next ASCII byte
+        while (first != last && static_cast<unsigned char>(*first) >= 0x80) {
+            auto length = detail::sequence_length(first, last);
+            if (length == 0) return first;
+            first += length;
+        }
+    }
+    return last;
+}
+
+constexpr auto is_valid(std::string_view text) -> bool {
+    return validate(text.data(), text.data() + text.size()) == text.data() + text.size();
+}
+
+// Code points in valid text, which is its bytes less the continuation bytes
+inline auto count_code_points(std::string_view text) -> std::size_t {
+    const char* first = text.data();
+    const char* last = first + text.size();
+    const char* ascii_end = scan::skip_ascii(first, last);
+    auto count = static_cast<std::size_t>(ascii_end - first);
+    for (const char* it = ascii_end; it != last; it++) count += is_continuation(*it) ? 0 : 1;
+    return count;
+}
+
+static_assert(is_valid("abc") && is_valid("\xCE\xBB") && is_valid("\xE2\x82\xAC") &&
+              is_valid("\xF0\x9F\x98\x80") && is_valid("\xF4\x8F\xBF\xBF"));
+// a stray continuation, an overlong '/', a surrogate, past U+10FFFF and a truncated sequence
+static_assert(!is_valid("\x80") && !is_valid("\xC0\xAF") && !is_valid("\xED\xA0\x80") &&
+              !is_valid("\xF4\x90\x80\x80") && !is_valid("\xE2\x82"));
+
+}  // namespace utf8
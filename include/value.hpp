@@ -0,0 +1,240 @@
+// value.hpp
+// runtime values of the VM
+
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <format>
+#include <string>
+#include <type_traits>
+
+#include "bytecode.hpp"
+#include "symbol_table.hpp"
+
+namespace vm {
+
+struct Pair;
+struct Closure;
+struct Box;
+
+// Value
+// A value in one 64-bit word. Fixnums have a low bit of 0 and the number in the other 63, so
+// tagged fixnums add, subtract and compare as they are. Heap objects are 8-byte aligned, which
+// leaves their low three bits for a tag; the last tag marks immediates, whose next five bits say
+// which kind and whose high 32 bits hold a character or symbol id:
+//
+//   nnnn...nnnn0  fixnum            pppp...p001  pair
+//   pppp...p011  closure           pppp...p101  box
+//   xxxx...kkkkk111  empty list, #f, #t, unspecified, character, symbol or undefined, by k
+class Value {
+   public:
+    enum class Tag : uint8_t { pair = 1, closure = 3, box = 5, immediate = 7 };
+    enum class Immediate : uint8_t {
+        empty_list,
+        false_,
+        true_,
+        unspecified,
+        character,
+        symbol,
+        undefined
+    };
+
+    static constexpr int64_t min_fixnum = bytecode::min_fixnum;
+    static constexpr int64_t max_fixnum = bytecode::max_fixnum;
+
+   private:
+    static constexpr uint64_t tag_mask = 7;
+    static constexpr uint64_t immediate_mask = 0xFF;
+
+    uint64_t m_bits;
+
+    constexpr explicit Value(uint64_t bits) : m_bits{bits} {}
+
+    static constexpr auto immediate(Immediate kind, uint32_t payload = 0) -> Value {
+        return Value{(uint64_t{payload} << 32U) | (static_cast<uint64_t>(kind) << 3U) |
+                     static_cast<uint64_t>(Tag::immediate)};
+    }
+
+    template <typename T>
+    static auto object(T* object, Tag tag) -> Value {
+        return Value{std::bit_cast<uintptr_t>(object) | static_cast<uint64_t>(tag)};
+    }
+
+    [[nodiscard]] constexpr auto is_immediate(Immediate kind) const -> bool {
+        return (m_bits & immediate_mask) == immediate(kind).m_bits;
+    }
+
+   public:
+    // unspecified
+    constexpr Value() : Value{immediate(Immediate::unspecified)} {}
+
+    static constexpr auto fits_fixnum(int64_t n) -> bool {
+        return n >= min_fixnum && n <= max_fixnum;
+    }
+    // n must fit a fixnum
+    static constexpr auto fixnum(int64_t n) -> Value {
+        return Value{static_cast<uint64_t>(n) << 1U};
+    }
+    static constexpr auto boolean(bool b) -> Value {
+        return immediate(b ? Immediate::true_ : Immediate::false_);
+    }
+    static constexpr auto empty_list() -> Value { return immediate(Immediate::empty_list); }
+    static constexpr auto unspecified() -> Value { return immediate(Immediate::unspecified); }
+    // What a variable holds until its definition has run; no expression evaluates to it
+    static constexpr auto undefined() -> Value { return immediate(Immediate::undefined); }
+    static constexpr auto character(char32_t c) -> Value {
+        return immediate(Immediate::character, static_cast<uint32_t>(c));
+    }
+    static constexpr auto symbol(symbol::Id id) -> Value {
+        return immediate(Immediate::symbol, id);
+    }
+    static auto pair(Pair* pair) -> Value { return object(pair, Tag::pair); }
+    static auto closure(const Closure* closure) -> Value { return object(closure, Tag::closure); }
+    static auto box(Box* box) -> Value { return object(box, Tag::box); }
+
+    // The word itself, and the value a word is, for code working on tagged fixnums directly
+    [[nodiscard]] constexpr auto bits() const -> uint64_t { return m_bits; }
+    static constexpr auto from_bits(uint64_t bits) -> Value { return Value{bits}; }
+
+    [[nodiscard]] constexpr auto tag() const -> Tag { return static_cast<Tag>(m_bits & tag_mask); }
+    [[nodiscard]] constexpr auto is_fixnum() const -> bool { return (m_bits & 1U) == 0; }
+    [[nodiscard]] constexpr auto is_pair() const -> bool { return tag() == Tag::pair; }
+    [[nodiscard]] constexpr auto is_closure() const -> bool { return tag() == Tag::closure; }
+    [[nodiscard]] constexpr auto is_box() const -> bool { return tag() == Tag::box; }
+    // a pointer to a heap object, which is any odd word that is not an immediate
+    [[nodiscard]] constexpr auto is_object() const -> bool {
+        return (m_bits & 1U) != 0 && tag() != Tag::immediate;
+    }
+    [[nodiscard]] constexpr auto is_boolean() const -> bool {
+        return is_immediate(Immediate::false_) || is_immediate(Immediate::true_);
+    }
+    // #f is the only false value
+    [[nodiscard]] constexpr auto is_false() const -> bool {
+        return m_bits == immediate(Immediate::false_).m_bits;
+    }
+    [[nodiscard]] constexpr auto is_empty_list() const -> bool {
+        return m_bits == immediate(Immediate::empty_list).m_bits;
+    }
+    [[nodiscard]] constexpr auto is_unspecified() const -> bool {
+        return m_bits == immediate(Immediate::unspecified).m_bits;
+    }
+    [[nodiscard]] constexpr auto is_undefined() const -> bool {
+        return m_bits == immediate(Immediate::undefined).m_bits;
+    }
+    [[nodiscard]] constexpr auto is_character() const -> bool {
+        return is_immediate(Immediate::character);
+    }
+    [[nodiscard]] constexpr auto is_symbol() const -> bool {
+        return is_immediate(Immediate::symbol);
+    }
+
+    [[nodiscard]] constexpr auto as_fixnum() const -> int64_t {
+        return static_cast<int64_t>(m_bits) >> 1;
+    }
+    [[nodiscard]] constexpr auto as_boolean() const -> bool {
+        return is_immediate(Immediate::true_);
+    }
+    [[nodiscard]] constexpr auto as_character() const -> char32_t {
+        return static_cast<char32_t>(m_bits >> 32U);
+    }
+    [[nodiscard]] constexpr auto as_symbol() const -> symbol::Id {
+        return static_cast<symbol::Id>(m_bits >> 32U);
+    }
+    [[nodiscard]] auto as_pair() const -> Pair* { return static_cast<Pair*>(as_object()); }
+    [[nodiscard]] auto as_closure() const -> const Closure* {
+        return static_cast<const Closure*>(as_object());
+    }
+    [[nodiscard]] auto as_box() const -> Box* { return static_cast<Box*>(as_object()); }
+
+    // The object of a heap value, and the same value for the object moved to object
+    [[nodiscard]] auto as_object() const -> void* {
+        return std::bit_cast<void*>(static_cast<uintptr_t>(m_bits & ~tag_mask));
+    }
+    [[nodiscard]] auto moved_to(const void* object) const -> Value {
+        return Value{std::bit_cast<uintptr_t>(object) | (m_bits & tag_mask)};
+    }
+
+    // eq?: the same object or the same immediate
+    constexpr auto operator==(const Value&) const -> bool = default;
+};
+
+static_assert(sizeof(Value) == 8 && std::is_trivially_copyable_v<Value>);
+static_assert(Value::fixnum(-5).as_fixnum() == -5 && Value::fixnum(Value::max_fixnum).is_fixnum());
+static_assert(Value::fixnum(2).bits() + Value::fixnum(3).bits() == Value::fixnum(5).bits());
+static_assert(Value::boolean(false).is_false() && !Value::fixnum(0).is_false() &&
+              !Value::empty_list().is_false());
+static_assert(Value::symbol(7).is_symbol() && Value::symbol(7).as_symbol() == 7 &&
+              !Value::symbol(7).is_object() && !Value::character(U'x').is_symbol());
+
+struct Pair {
+    Value car;
+    Value cdr;
+};
+
+// a variable closures share, for those defined after closures can see them
+struct Box {
+    Value value;
+};
+
+// A function together with the values it captured, laid out after it in the same allocation
+struct Closure {
+    const bytecode::Function* function;
+    Value* captures;
+};
+
+// the collector copies objects with memcpy
+static_assert(std::is_trivially_copyable_v<Pair> && std::is_trivially_copyable_v<Box> &&
+              std::is_trivially_copyable_v<Closure>);
+
+namespace detail {
+
+inline auto format_character(char32_t c) -> std::string {
+    switch (c) {
+        case U' ':
+            return "#\\space";
+        case U'\n':
+            return "#\\newline";
+        case U'\t':
+            return "#\\tab";
+        default:
+            if (c > U' ' && c < 0x7F) return std::format("#\\{}", static_cast<char>(c));
+            return std::format("#\\x{:x}", static_cast<uint32_t>(c));
+    }
+}
+
+}  // namespace detail
+
+// Text a value is written as by the REPL, empty for unspecified values. Symbols are written by
+// id, as values do not know the table they were interned in.
+inline auto format_value(const Value& value) -> std::string {
+    if (value.is_fixnum()) return std::format("{}", value.as_fixnum());
+    switch (value.tag()) {
+        case Value::Tag::pair: {
+            // along the cdrs without recursion, so long lists do not overflow the stack
+            std::string out{"("};
+            out += format_value(value.as_pair()->car);
+            Value rest = value.as_pair()->cdr;
+            for (; rest.is_pair(); rest = rest.as_pair()->cdr) {
+                out += ' ';
+                out += format_value(rest.as_pair()->car);
+            }
+            if (!rest.is_empty_list()) out += " . " + format_value(rest);
+            return out + ')';
+        }
+        case Value::Tag::closure:
+            return std::format("#<procedure {}>", value.as_closure()->function->name);
+        case Value::Tag::box:
+            return "#<box>";
+        case Value::Tag::immediate:
+            break;
+    }
+    if (value.is_unspecified()) return "";
+    if (value.is_empty_list()) return "()";
+    if (value.is_boolean()) return value.as_boolean() ? "#t" : "#f";
+    if (value.is_character()) return detail::format_character(value.as_character());
+    if (value.is_symbol()) return std::format("#<symbol {}>", value.as_symbol());
+    return "#<unknown>";
+}
+
+}  // namespace vm
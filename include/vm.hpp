@@ -0,0 +1,520 @@
+// vm.hpp
+// stack VM running compiled programs
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <format>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "bytecode.hpp"
+#include "heap.hpp"
+#include "value.hpp"
+
+namespace vm {
+
+struct RuntimeError {
+    std::string message;
+};
+
+// How the VM goes from one instruction to the next: a switch in a loop, or threaded code that
+// jumps straight from the end of each instruction to the next one's through a table of label
+// addresses, which GCC and Clang support. Threaded dispatch predicts better, since every
+// instruction ends in its own indirect branch rather than all of them sharing the switch's.
+enum class Dispatch : uint8_t { switch_loop, threaded };
+
+#if defined(__GNUC__)
+inline constexpr bool has_threaded_dispatch = true;
+#else
+inline constexpr bool has_threaded_dispatch = false;
+#endif
+
+inline constexpr Dispatch default_dispatch =
+    has_threaded_dispatch ? Dispatch::threaded : Dispatch::switch_loop;
+
+namespace detail {
+
+inline auto add_overflows(int64_t a, int64_t b, int64_t& result) -> bool {
+#if defined(__GNUC__)
+    return __builtin_add_overflow(a, b, &result);
+#else
+    if ((b > 0 && a > INT64_MAX - b) || (b < 0 && a < INT64_MIN - b)) return true;
+    result = a + b;
+    return false;
+#endif
+}
+
+inline auto sub_overflows(int64_t a, int64_t b, int64_t& result) -> bool {
+#if defined(__GNUC__)
+    return __builtin_sub_overflow(a, b, &result);
+#else
+    if ((b < 0 && a > INT64_MAX + b) || (b > 0 && a < INT64_MIN + b)) return true;
+    result = a - b;
+    return false;
+#endif
+}
+
+inline auto mul_overflows(int64_t a, int64_t b, int64_t& result) -> bool {
+#if defined(__GNUC__)
+    return __builtin_mul_overflow(a, b, &result);
+#else
+    if (a != 0 && b != 0 &&
+        ((a == -1 && b == INT64_MIN) || (b == -1 && a == INT64_MIN) ||
+         (a != -1 && b != -1 && (a * b) / b != a))) {
+        return true;
+    }
+    result = a * b;
+    return false;
+#endif
+}
+
+}  // namespace detail
+
+// Vm
+// Runs compiled programs on a value stack of fixed size. Each call takes the callee's local slots
+// and the most operand stack it can use from the stack at once, checked against its end once per
+// call rather than on every push. Tail calls replace the caller's frame, so loops written as tail
+// recursion run in constant space.
+//
+// Pairs, closures and boxes live in a gc::Heap whose roots are the globals and the stack. Every
+// frame keeps its closure in the slot below its locals, so the collector finds and updates it
+// there, and the running closure is read back from that slot after each allocation.
+class Vm {
+   private:
+    struct Frame {
+        const bytecode::Instruction* return_ip;
+        Value* base;
+    };
+
+    std::vector<Value> m_stack;
+    Value* m_sp;  // top of the stack as of the last allocation, for the collector
+    std::vector<Frame> m_frames{};  // of the callers of the running function
+    std::size_t m_max_depth;
+    std::vector<Value> m_globals{};
+    gc::Heap m_heap;
+    uint64_t m_executed{0};
+
+    // Closure of function, taking its captures from the frame at base
+    auto make_closure(const bytecode::Function& function, const Value* base) -> const Closure* {
+        auto* closure = m_heap.make_closure(function);
+        // read after allocating, which may have moved the enclosing closure
+        const auto* enclosing = base[-1].as_closure();
+        for (std::size_t i = 0; i < function.captures.size(); i++) {
+            auto capture = function.captures[i];
+            closure->captures[i] =
+                capture.from_local ? base[capture.index] : enclosing->captures[capture.index];
+        }
+        return closure;
+    }
+
+   public:
+    static constexpr std::size_t default_stack_size = std::size_t{1} << 20U;
+    static constexpr std::size_t default_max_depth = std::size_t{1} << 18U;
+
+    explicit Vm(std::size_t stack_size = default_stack_size,
+                std::size_t max_depth = default_max_depth,
+                std::size_t nursery_size = gc::Heap::default_nursery_size)
+        : m_stack(stack_size), m_sp{m_stack.data()}, m_max_depth{max_depth}, m_heap{nursery_size} {
+        m_frames.reserve(max_depth);
+        m_heap.add_stack(m_stack.data(), &m_sp);
+    }
+
+    // Run the entry point of program, returning the value of its last form. With
+    // count_instructions, instructions_executed() is the number of instructions the run took.
+    template <Dispatch dispatch = default_dispatch, bool count_instructions = false>
+    auto run(const bytecode::Program& program) -> std::expected<Value, RuntimeError>;
+
+    [[nodiscard]] auto instructions_executed() const -> uint64_t { return m_executed; }
+    // Values a run returns live in this heap, until the next run allocates
+    [[nodiscard]] auto heap() const -> const gc::Heap& { return m_heap; }
+};
+
+// Every instruction is a case of the switch, and for threaded dispatch also a label whose address
+// is in the table, so both dispatch modes share the instructions' code
+#if defined(__GNUC__)
+#define ALENVERS_VM_CASE(name) \
+    case bytecode::Op::name:   \
+    op_##name:
+#define ALENVERS_VM_LABEL(name) &&op_##name
+#else
+#define ALENVERS_VM_CASE(name) case bytecode::Op::name:
+#endif
+
+// End of an instruction: decode the next one and jump to it, or go back to the switch
+#if defined(__GNUC__)
+#define ALENVERS_VM_NEXT()                                                      \
+    {                                                                           \
+        if constexpr (dispatch == Dispatch::threaded) {                         \
+            instruction = *ip++;                                                \
+            if constexpr (count_instructions) m_executed++;                     \
+            goto* labels[static_cast<std::size_t>(bytecode::op_of(instruction))]; \
+        } else {                                                                \
+            continue;                                                           \
+        }                                                                       \
+    }
+#else
+#define ALENVERS_VM_NEXT() continue
+#endif
+
+// The top two values of the stack as the tagged words a and b of the fixnum operands of name,
+// checked with one test of their tag bits; pops the second
+#define ALENVERS_VM_FIXNUMS(name)                                                  \
+    const auto a = static_cast<int64_t>(sp[-2].bits());                            \
+    const auto b = static_cast<int64_t>(sp[-1].bits());                            \
+    if (((a | b) & 1) != 0) {                                                      \
+        return fail(std::format("{} expects fixnums, not {} and {}", name,         \
+                                format_value(sp[-2]), format_value(sp[-1])));      \
+    }                                                                              \
+    sp--
+
+// Publish the stack top to the collector before an allocation, and after it reload the running
+// closure, which the allocation may have moved
+#define ALENVERS_VM_ALLOCATE(allocation) \
+    m_sp = sp;                           \
+    allocation;                          \
+    closure = base[-1].as_closure()
+
+// The top value of the stack, as the pair operand of name
+#define ALENVERS_VM_PAIR(name)                                                              \
+    if (!sp[-1].is_pair()) {                                                                 \
+        return fail(std::format("{} expects a pair, not {}", name, format_value(sp[-1]))); \
+    }                                                                                        \
+    const auto* pair = sp[-1].as_pair()
+
+template <Dispatch dispatch, bool count_instructions>
+auto Vm::run(const bytecode::Program& program) -> std::expected<Value, RuntimeError> {
+    static_assert(dispatch == Dispatch::switch_loop || has_threaded_dispatch,
+                  "threaded dispatch needs labels as values");
+    using bytecode::Instruction;
+
+    auto fail = [this](std::string message) -> std::expected<Value, RuntimeError> {
+        m_frames.clear();
+        return std::unexpected(RuntimeError{std::move(message)});
+    };
+
+#if defined(__GNUC__)
+    // in the order of bytecode::Op
+    static const void* const labels[] = {  // NOLINT
+        ALENVERS_VM_LABEL(push_fixnum),   ALENVERS_VM_LABEL(push_constant),
+        ALENVERS_VM_LABEL(push_unspecified), ALENVERS_VM_LABEL(pop),
+        ALENVERS_VM_LABEL(load_local),    ALENVERS_VM_LABEL(store_local),
+        ALENVERS_VM_LABEL(make_box),      ALENVERS_VM_LABEL(load_boxed),
+        ALENVERS_VM_LABEL(store_boxed),   ALENVERS_VM_LABEL(load_captured),
+        ALENVERS_VM_LABEL(load_captured_boxed), ALENVERS_VM_LABEL(load_global),
+        ALENVERS_VM_LABEL(store_global),  ALENVERS_VM_LABEL(jump),
+        ALENVERS_VM_LABEL(jump_if_false), ALENVERS_VM_LABEL(make_closure),
+        ALENVERS_VM_LABEL(call),          ALENVERS_VM_LABEL(tail_call),
+        ALENVERS_VM_LABEL(return_),       ALENVERS_VM_LABEL(add),
+        ALENVERS_VM_LABEL(sub),           ALENVERS_VM_LABEL(mul),
+        ALENVERS_VM_LABEL(quotient),      ALENVERS_VM_LABEL(remainder),
+        ALENVERS_VM_LABEL(num_eq),        ALENVERS_VM_LABEL(lt),
+        ALENVERS_VM_LABEL(gt),            ALENVERS_VM_LABEL(le),
+        ALENVERS_VM_LABEL(ge),            ALENVERS_VM_LABEL(cons),
+        ALENVERS_VM_LABEL(car),           ALENVERS_VM_LABEL(cdr),
+        ALENVERS_VM_LABEL(is_pair),       ALENVERS_VM_LABEL(is_null),
+        ALENVERS_VM_LABEL(list),
+    };
+    static_assert(std::size(labels) == static_cast<std::size_t>(bytecode::Op::op_count));
+#endif
+
+    m_heap.remove_roots(m_globals);
+    m_globals.assign(program.globals.size(), Value::undefined());
+    m_heap.add_roots(m_globals);
+    m_frames.clear();
+    m_executed = 0;
+
+    const auto& entry = program.functions[program.entry];
+    if (1 + entry.frame_size + entry.max_stack > m_stack.size()) return fail("stack overflow");
+    m_sp = m_stack.data();
+    const Closure* closure = m_heap.make_closure(entry);
+    m_stack[0] = Value::closure(closure);
+    Value* base = m_stack.data() + 1;
+    Value* sp = std::fill_n(base, entry.frame_size, Value{});
+    const Value* stack_end = m_stack.data() + m_stack.size();
+    const Instruction* code = entry.code.data();
+    const Instruction* ip = code;
+    Instruction instruction{};
+
+    // Why a call cannot be made: not an error message, so that the result of callee_of has no
+    // destructor for a threaded jump out of the instruction to skip
+    enum class CallError : uint8_t { not_a_procedure, arity, stack_overflow };
+
+    // Check a call of argc arguments and return the function it calls
+    auto callee_of = [&](uint32_t argc) -> std::expected<const bytecode::Function*, CallError> {
+        auto callee = *(sp - argc - 1);
+        if (!callee.is_closure()) return std::unexpected(CallError::not_a_procedure);
+        const auto* function = callee.as_closure()->function;
+        if (function->arity != argc) return std::unexpected(CallError::arity);
+        if (stack_end - sp < static_cast<std::ptrdiff_t>(function->frame_size - argc +
+                                                           function->max_stack)) {
+            return std::unexpected(CallError::stack_overflow);
+        }
+        return function;
+    };
+    auto fail_call = [&](uint32_t argc, CallError error) -> std::expected<Value, RuntimeError> {
+        auto callee = *(sp - argc - 1);
+        switch (error) {
+            case CallError::not_a_procedure:
+                return fail(std::format("{} is not a procedure", format_value(callee)));
+            case CallError::arity: {
+                const auto* function = callee.as_closure()->function;
+                return fail(std::format("{} takes {} arguments, not {}", function->name,
+                                        function->arity, argc));
+            }
+            case CallError::stack_overflow:
+                break;
+        }
+        return fail("stack overflow");
+    };
+
+    for (;;) {
+        instruction = *ip++;
+        if constexpr (count_instructions) m_executed++;
+
+        switch (bytecode::op_of(instruction)) {
+            ALENVERS_VM_CASE(push_fixnum) {
+                *sp++ = Value::fixnum(bytecode::immediate_of(instruction));
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(push_constant) {
+                *sp++ =
+                    Value::fixnum(closure->function->constants[bytecode::operand_of(instruction)]);
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(push_unspecified) {
+                *sp++ = Value{};
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(pop) {
+                sp--;
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(load_local) {
+                *sp++ = base[bytecode::operand_of(instruction)];
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(store_local) {
+                base[bytecode::operand_of(instruction)] = *--sp;
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(make_box) {
+                ALENVERS_VM_ALLOCATE(base[bytecode::operand_of(instruction)] =
+                                         Value::box(m_heap.make_box(Value::undefined())));
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(load_boxed) {
+                auto value = base[bytecode::operand_of(instruction)].as_box()->value;
+                if (value.is_undefined()) {
+                    return fail("variable used before its definition");
+                }
+                *sp++ = value;
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(store_boxed) {
+                auto* box = base[bytecode::operand_of(instruction)].as_box();
+                m_heap.store(box, box->value, *--sp);
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(load_captured) {
+                *sp++ = closure->captures[bytecode::operand_of(instruction)];
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(load_captured_boxed) {
+                auto value = closure->captures[bytecode::operand_of(instruction)].as_box()->value;
+                if (value.is_undefined()) {
+                    return fail("variable used before its definition");
+                }
+                *sp++ = value;
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(load_global) {
+                auto global = bytecode::operand_of(instruction);
+                if (m_globals[global].is_undefined()) {
+                    return fail(std::format("{} is not defined", program.globals[global]));
+                }
+                *sp++ = m_globals[global];
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(store_global) {
+                m_globals[bytecode::operand_of(instruction)] = *--sp;
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(jump) {
+                ip = code + bytecode::operand_of(instruction);
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(jump_if_false) {
+                if ((--sp)->is_false()) ip = code + bytecode::operand_of(instruction);
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(make_closure) {
+                const auto& function = program.functions[bytecode::operand_of(instruction)];
+                const Closure* made{};
+                ALENVERS_VM_ALLOCATE(made = make_closure(function, base));
+                *sp++ = Value::closure(made);
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(call) {
+                auto argc = bytecode::operand_of(instruction);
+                auto function = callee_of(argc);
+                if (!function) return fail_call(argc, function.error());
+                if (m_frames.size() == m_max_depth) return fail("recursion too deep");
+                m_frames.push_back(Frame{ip, base});
+
+                closure = (sp - argc - 1)->as_closure();
+                base = sp - argc;
+                sp = std::fill_n(sp, (*function)->frame_size - argc, Value{});
+                code = (*function)->code.data();
+                ip = code;
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(tail_call) {
+                // the callee and its arguments take the place of the caller's frame
+                auto argc = bytecode::operand_of(instruction);
+                auto function = callee_of(argc);
+                if (!function) return fail_call(argc, function.error());
+
+                closure = (sp - argc - 1)->as_closure();
+                std::copy(sp - argc - 1, sp, base - 1);
+                sp = std::fill_n(base + argc, (*function)->frame_size - argc, Value{});
+                code = (*function)->code.data();
+                ip = code;
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(return_) {
+                Value result = sp[-1];
+                if (m_frames.empty()) return result;
+                sp = base - 1;
+                *sp++ = result;
+
+                auto frame = m_frames.back();
+                m_frames.pop_back();
+                base = frame.base;
+                closure = base[-1].as_closure();
+                code = closure->function->code.data();
+                ip = frame.return_ip;
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(add) {
+                // tagged fixnums add and subtract as they are, and overflow where the fixnums do
+                ALENVERS_VM_FIXNUMS("+");
+                int64_t result{};
+                if (detail::add_overflows(a, b, result)) return fail("fixnum overflow in +");
+                sp[-1] = Value::from_bits(static_cast<uint64_t>(result));
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(sub) {
+                ALENVERS_VM_FIXNUMS("-");
+                int64_t result{};
+                if (detail::sub_overflows(a, b, result)) return fail("fixnum overflow in -");
+                sp[-1] = Value::from_bits(static_cast<uint64_t>(result));
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(mul) {
+                // one untagged factor makes a tagged product
+                ALENVERS_VM_FIXNUMS("*");
+                int64_t result{};
+                if (detail::mul_overflows(a >> 1, b, result)) return fail("fixnum overflow in *");
+                sp[-1] = Value::from_bits(static_cast<uint64_t>(result));
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(quotient) {
+                // the tags cancel out; only the most negative fixnum over -1 overflows
+                ALENVERS_VM_FIXNUMS("quotient");
+                if (b == 0) return fail("quotient by zero");
+                auto result = a / b;
+                if (!Value::fits_fixnum(result)) return fail("fixnum overflow in quotient");
+                sp[-1] = Value::fixnum(result);
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(remainder) {
+                // 2x % 2y is 2 (x % y), a tagged remainder
+                ALENVERS_VM_FIXNUMS("remainder");
+                if (b == 0) return fail("remainder by zero");
+                sp[-1] = Value::from_bits(static_cast<uint64_t>(a % b));
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(num_eq) {
+                // tagged fixnums compare as they are
+                ALENVERS_VM_FIXNUMS("=");
+                sp[-1] = Value::boolean(a == b);
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(lt) {
+                ALENVERS_VM_FIXNUMS("<");
+                sp[-1] = Value::boolean(a < b);
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(gt) {
+                ALENVERS_VM_FIXNUMS(">");
+                sp[-1] = Value::boolean(a > b);
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(le) {
+                ALENVERS_VM_FIXNUMS("<=");
+                sp[-1] = Value::boolean(a <= b);
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(ge) {
+                ALENVERS_VM_FIXNUMS(">=");
+                sp[-1] = Value::boolean(a >= b);
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(cons) {
+                Pair* pair{};
+                ALENVERS_VM_ALLOCATE(pair = m_heap.make_pair(sp[-2], sp[-1]));
+                sp--;
+                sp[-1] = Value::pair(pair);
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(car) {
+                ALENVERS_VM_PAIR("car");
+                sp[-1] = pair->car;
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(cdr) {
+                ALENVERS_VM_PAIR("cdr");
+                sp[-1] = pair->cdr;
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(is_pair) {
+                sp[-1] = Value::boolean(sp[-1].is_pair());
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(is_null) {
+                sp[-1] = Value::boolean(sp[-1].is_empty_list());
+                ALENVERS_VM_NEXT();
+            }
+            ALENVERS_VM_CASE(list) {
+                // consed from the last element, which each allocation may move
+                auto count = bytecode::operand_of(instruction);
+                auto list = Value::empty_list();
+                for (auto i = count; i > 0; i--) {
+                    ALENVERS_VM_ALLOCATE(
+                        list = Value::pair(m_heap.make_pair(*(sp - count + i - 1), list)));
+                }
+                sp -= count;
+                *sp++ = list;
+                ALENVERS_VM_NEXT();
+            }
+            case bytecode::Op::op_count:
+                break;
+        }
+        return fail("invalid instruction");
+    }
+}
+
+#undef ALENVERS_VM_CASE
+#undef ALENVERS_VM_LABEL
+#undef ALENVERS_VM_NEXT
+#undef ALENVERS_VM_FIXNUMS
+#undef ALENVERS_VM_ALLOCATE
+#undef ALENVERS_VM_PAIR
+
+}  // namespace vm
@@ -0,0 +1,91 @@
+// work_pool.hpp
+// a fixed set of tasks run on worker threads that steal from each other
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace work {
+
+namespace detail {
+
+// The tasks a worker has left, which other workers may steal from
+class Queue {
+   private:
+    std::mutex m_mutex;
+    std::deque<std::size_t> m_tasks;
+
+   public:
+    void push(std::size_t task) { m_tasks.push_back(task); }
+
+    // the owner works through its tasks in the order they were dealt
+    auto pop() -> std::optional<std::size_t> {
+        std::scoped_lock lock{m_mutex};
+        if (m_tasks.empty()) return std::nullopt;
+        auto task = m_tasks.front();
+        m_tasks.pop_front();
+        return task;
+    }
+
+    // a thief takes the task the owner would have reached last
+    auto steal() -> std::optional<std::size_t> {
+        std::scoped_lock lock{m_mutex};
+        if (m_tasks.empty()) return std::nullopt;
+        auto task = m_tasks.back();
+        m_tasks.pop_back();
+        return task;
+    }
+};
+
+}  // namespace detail
+
+// Run task(i) for every i in [0, count) on up to threads threads, the calling thread included,
+// and return once all have run. The indices are dealt round robin, so tasks ordered by cost, most
+// expensive first, start at the same time on different workers; a worker that runs out steals
+// from the others, so one slow task holds up only the worker running it. The first exception a
+// task throws is rethrown once the workers are done, and the tasks not yet started are skipped.
+template <typename Task>
+void run_stealing(std::size_t count, unsigned threads, Task task) {
+    auto workers = std::clamp<std::size_t>(threads, 1, std::max<std::size_t>(count, 1));
+    std::vector<detail::Queue> queues(workers);
+    for (std::size_t i = 0; i < count; i++) queues[i % workers].push(i);
+
+    std::mutex error_mutex{};
+    std::exception_ptr error{};
+    auto next_task = [&queues, workers](std::size_t self) -> std::optional<std::size_t> {
+        if (auto own = queues[self].pop()) return own;
+        for (std::size_t i = 1; i < workers; i++) {
+            if (auto stolen = queues[(self + i) % workers].steal()) return stolen;
+        }
+        return std::nullopt;  // tasks are never added, so every queue stays empty
+    };
+    auto work = [&](std::size_t self) {
+        while (auto i = next_task(self)) {
+            try {
+                task(*i);
+            } catch (...) {
+                std::scoped_lock lock{error_mutex};
+                if (!error) error = std::current_exception();
+                for (auto& queue : queues) {
+                    while (queue.steal()) {}
+                }
+            }
+        }
+    };
+
+    {
+        std::vector<std::jthread> pool{};
+        for (std::size_t i = 1; i < workers; i++) pool.emplace_back(work, i);
+        work(0);
+    }
+    if (error) std::rethrow_exception(error);
+}
+
+}  // namespace work
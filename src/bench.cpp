@@ -0,0 +1,1380 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cwctype>
+#include <expected>
+#include <filesystem>
+#include <format>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <spanstream>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "arena.hpp"
+#include "buffered_source.hpp"
+#include "bytecode.hpp"
+#include "compiler.hpp"
+#include "form_index.hpp"
+#include "heap.hpp"
+#include "lexer.hpp"
+#include "lexer_stats.hpp"
+#include "match_char.hpp"
+#include "number.hpp"
+#include "parallel_lex.hpp"
+#include "reader.hpp"
+#include "relex.hpp"
+#include "simd_scan.hpp"
+#include "source_map.hpp"
+#include "static_lexer.hpp"
+#include "stream_lexer.hpp"
+#include "symbol_table.hpp"
+#include "token.hpp"
+#include "token_buffer.hpp"
+#include "token_cache.hpp"
+#include "utf8.hpp"
+#include "util.hpp"
+#include "vm.hpp"
+
+// Every allocation of the process, for the allocations per token the corpus benchmarks report
+namespace {
+std::atomic<std::size_t> allocation_count{0};
+}  // namespace
+
+auto operator new(std::size_t size) -> void* {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size == 0 ? 1 : size)) return p;  // NOLINT
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept { std::free(p); }  // NOLINT
+
+void operator delete(void* p, std::size_t /*size*/) noexcept { std::free(p); }  // NOLINT
+
+namespace {
+
+// the fold expression + locale based classification the table replaced, kept as a baseline
+namespace legacy {
+
+template <const char... match>
+auto match_char(const char c) -> bool {
+    return ((c == match) || ...);
+}
+
+auto is_delimiter(const char c) -> bool {
+    return std::iswspace(c) || match_char<'(', ')', '"', ';'>(c);
+}
+
+auto is_special_initial(const char c) -> bool {
+    return match_char<'!', '$', '%', '&', '*', '/', ':', '<', '=', '>', '?', '@', '^', '_', '~'>(c);
+}
+
+auto is_initial(const char c) -> bool { return std::isalpha(c) || is_special_initial(c); }
+
+auto is_explicit_sign(const char c) -> bool { return match_char<'+', '-'>(c); }
+
+auto is_special_subsequent(const char c) -> bool {
+    return is_explicit_sign(c) || match_char<'.', '@'>(c);
+}
+
+auto is_subsequent(const char c) -> bool {
+    return is_initial(c) || std::isdigit(c) || is_special_subsequent(c);
+}
+
+// The std::visit over lexer::State automaton the transition tables replaced, span mode only
+class VariantLexer {
+   private:
+    struct InitState {};
+    struct IdentifierState {};
+    struct ErrorState {};
+    using State = std::variant<InitState, IdentifierState, ErrorState>;
+    using Result = std::expected<token::TokenView, lexer::LexError>;
+
+    struct LexResult {
+        std::optional<Result> token;
+        State state;
+    };
+
+    std::string_view m_src;
+    std::size_t m_it{0};
+    std::size_t m_lexeme{0};
+    State m_state{};
+
+    auto advance_state() -> LexResult {
+        if (m_it == m_src.size()) {
+            return LexResult{.token{token::Eof{.offset = m_it}}, .state{InitState{}}};
+        }
+        auto event = m_src[m_it];
+
+        if (std::holds_alternative<InitState>(m_state) && ::match_char::is_whitespace(event)) {
+            const char* first = m_src.data() + m_it;
+            m_it += scan::skip_whitespace(first, m_src.data() + m_src.size()) - first;
+            return LexResult{.token{std::nullopt}, .state{InitState{}}};
+        }
+        if (std::holds_alternative<IdentifierState>(m_state) &&
+            ::match_char::is_subsequent(event)) {
+            const char* first = m_src.data() + m_it;
+            m_it += scan::skip_subsequent(first, m_src.data() + m_src.size()) - first;
+            return LexResult{.token{std::nullopt}, .state{IdentifierState{}}};
+        }
+
+        auto result = std::visit(
+            util::overloads{
+                [this, event](const InitState&) -> LexResult {
+                    if (::match_char::is_initial(event)) {
+                        m_lexeme = m_it++;
+                        return LexResult{.token{std::nullopt}, .state{IdentifierState{}}};
+                    }
+                    switch (event) {
+                        case '(':
+                            return LexResult{.token{token::LParen{.offset = m_it++}},
+                                             .state{InitState{}}};
+                        case ')':
+                            return LexResult{.token{token::RParen{.offset = m_it++}},
+                                             .state{InitState{}}};
+                        default:
+                            m_lexeme = m_it++;
+                            return LexResult{.token{std::nullopt}, .state{ErrorState{}}};
+                    }
+                },
+                [this](const IdentifierState&) -> LexResult {
+                    return LexResult{
+                        .token{token::IdentifierView{
+                            .offset = m_lexeme, .lexeme{m_src.substr(m_lexeme, m_it - m_lexeme)}}},
+                        .state{InitState{}}};
+                },
+                [this, event](const ErrorState&) -> LexResult {
+                    if (::match_char::is_delimiter(event)) {
+                        return LexResult{
+                            .token{std::unexpected(lexer::InvalidTokenError{
+                                .offset = m_lexeme,
+                                .lexeme{std::string{m_src.substr(m_lexeme, m_it - m_lexeme)}}})},
+                            .state{InitState{}}};
+                    }
+                    m_it++;
+                    return LexResult{.token{std::nullopt}, .state{ErrorState{}}};
+                },
+            },
+            m_state);
+
+        m_state = result.state;
+        return result;
+    }
+
+   public:
+    explicit VariantLexer(std::string_view src) : m_src{src} {}
+
+    auto next() -> Result {
+        while (true) {
+            auto result = advance_state();
+            if (result.token) return *result.token;
+        }
+    }
+};
+
+}  // namespace legacy
+
+auto scheme_source(std::size_t size) -> std::string {
+    const std::string unit{
+        "(define (fib-iter a b n)\n"
+        "  (if (= n 0)\n"
+        "      b\n"
+        "      (fib-iter b (+ a b) (- n 1))))\n"};
+    std::string src{};
+    src.reserve(size + unit.size());
+    while (src.size() < size) src += unit;
+    src.resize(size);
+    return src;
+}
+
+constexpr std::size_t corpus_size = std::size_t{1} << 16U;
+
+template <typename Classify>
+void classify_bytes(benchmark::State& state, Classify classify) {
+    auto src = scheme_source(corpus_size);
+    for (auto _ : state) {
+        std::size_t matches{0};
+        for (char c : src) {
+            matches += classify(c) ? 1 : 0;
+        }
+        benchmark::DoNotOptimize(matches);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+}
+
+void BM_is_subsequent_legacy(benchmark::State& state) {
+    classify_bytes(state, legacy::is_subsequent);
+}
+
+void BM_is_subsequent_table(benchmark::State& state) {
+    classify_bytes(state, match_char::is_subsequent);
+}
+
+void BM_is_delimiter_legacy(benchmark::State& state) {
+    classify_bytes(state, legacy::is_delimiter);
+}
+
+void BM_is_delimiter_table(benchmark::State& state) {
+    classify_bytes(state, match_char::is_delimiter);
+}
+
+// the fib sample with each form nested and indented as deeply as real code tends to be
+auto indented_source(std::size_t size) -> std::string {
+    const std::string unit{
+        "(define (fib a)\n"
+        "                (define (fib-iter a b n)\n"
+        "                                (if (= n 0)\n"
+        "                                                b\n"
+        "                                                (fib-iter b (+ a b) (- n 1))\n"
+        "                                )\n"
+        "                )\n"
+        "                (fib-iter 1 1 a))\n"};
+    std::string src{};
+    src.reserve(size + unit.size());
+    while (src.size() < size) src += unit;
+    return src;
+}
+
+void BM_lex_indented(benchmark::State& state) {
+    auto src = indented_source(corpus_size);
+    for (auto _ : state) {
+        std::size_t tokens{0};
+        for (const auto& tok : lexer::Lexer<std::string_view>{src}) {
+            benchmark::DoNotOptimize(tok);
+            tokens++;
+        }
+        benchmark::DoNotOptimize(tokens);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+}
+
+// The same source with CollectStats, against BM_lex_indented for the cost of the counters
+void BM_lex_indented_stats(benchmark::State& state) {
+    auto src = indented_source(corpus_size);
+    for (auto _ : state) {
+        std::size_t tokens{0};
+        auto lexed = lexer::Lexer<std::string_view, symbol::NoInterning, lexer::CollectStats>{src};
+        for (const auto& tok : lexed) {
+            benchmark::DoNotOptimize(tok);
+            tokens++;
+        }
+        benchmark::DoNotOptimize(lexed.stats());
+        benchmark::DoNotOptimize(tokens);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+}
+
+// The same source pushed to a StreamLexer in chunks of state.range(0) bytes
+void BM_stream_lex_indented(benchmark::State& state) {
+    auto src = indented_source(corpus_size);
+    auto chunk = static_cast<std::size_t>(state.range(0));
+    for (auto _ : state) {
+        std::size_t tokens{0};
+        lexer::StreamLexer stream{[&tokens](const lexer::StreamResult& tok) {
+            benchmark::DoNotOptimize(tok);
+            tokens++;
+        }};
+        for (std::size_t from = 0; from < src.size(); from += chunk) {
+            stream.feed(std::span{src}.subspan(from, std::min(chunk, src.size() - from)));
+        }
+        stream.finish();
+        benchmark::DoNotOptimize(tokens);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+}
+
+auto crlf_source(std::size_t size) -> std::string {
+    std::string src{};
+    for (char c : scheme_source(size)) {
+        if (c == '\n') src += '\r';
+        src += c;
+    }
+    return src;
+}
+
+template <typename Lex>
+void lex_tokens(benchmark::State& state, const std::string& src, Lex lex) {
+    for (auto _ : state) {
+        std::size_t tokens{0};
+        for (const auto& tok : lex(src)) {
+            benchmark::DoNotOptimize(tok);
+            tokens++;
+        }
+        benchmark::DoNotOptimize(tokens);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+}
+
+// CR/LF folded into a separate adaptor in front of the lexer, as lexer::lex used to do
+void BM_lex_crlf_normaliser(benchmark::State& state) {
+    lex_tokens(state, crlf_source(corpus_size), [](const std::string& src) {
+        return util::newline_normaliser_adapter(src) | lexer::lex;
+    });
+}
+
+void BM_lex_crlf(benchmark::State& state) {
+    lex_tokens(state, crlf_source(corpus_size),
+               [](const std::string& src) { return src | lexer::lex; });
+}
+
+// Forms over a vocabulary whose identifier frequencies follow a Zipf distribution, like real code
+// where a few names (define, if, let) dominate and most are rare
+auto repetitive_source(std::size_t size) -> std::string {
+    constexpr std::size_t vocabulary = 2000;
+    std::vector<std::string> names{"define", "lambda", "if", "let", "cond", "else"};
+    for (std::size_t i = names.size(); i < vocabulary; i++) {
+        names.push_back(std::format("name-{}-{}", i % 7 == 0 ? "helper" : "value", i));
+    }
+
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    auto next = [&seed] {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        return static_cast<double>(seed >> 11U) / static_cast<double>(1ULL << 53U);
+    };
+
+    std::string src{};
+    while (src.size() < size) {
+        src += '(';
+        for (int i = 0; i < 4; i++) {
+            // inverse transform of a 1/rank distribution
+            auto rank = static_cast<std::size_t>(std::pow(static_cast<double>(vocabulary), next()));
+            src += names[rank - 1];
+            src += ' ';
+        }
+        src += ")\n";
+    }
+    return src;
+}
+
+void BM_lex_identifiers_no_interning(benchmark::State& state) {
+    lex_tokens(state, repetitive_source(corpus_size),
+               [](const std::string& src) { return src | lexer::lex; });
+}
+
+template <typename Symbols>
+void lex_interning(benchmark::State& state) {
+    auto src = repetitive_source(corpus_size);
+    for (auto _ : state) {
+        Symbols symbols{};
+        for (const auto& tok : src | lexer::lex(symbols)) benchmark::DoNotOptimize(tok);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+}
+
+void BM_lex_identifiers_symbol_table(benchmark::State& state) {
+    lex_interning<symbol::SymbolTable>(state);
+}
+
+void BM_lex_identifiers_shared_symbol_table(benchmark::State& state) {
+    lex_interning<symbol::SharedSymbolTable>(state);
+}
+
+// Count the uses of every identifier that names the same thing as one of the first few, keeping
+// only what each representation needs: the lexeme or the symbol id
+template <bool by_symbol>
+void identifier_equality(benchmark::State& state) {
+    auto src = repetitive_source(corpus_size);
+    symbol::SymbolTable symbols{};
+    std::vector<std::string_view> lexemes{};
+    std::vector<symbol::Id> ids{};
+    for (const auto& tok : src | lexer::lex(symbols)) {
+        if (tok && std::holds_alternative<token::IdentifierView>(*tok)) {
+            lexemes.push_back(std::get<token::IdentifierView>(*tok).lexeme);
+            ids.push_back(std::get<token::IdentifierView>(*tok).symbol_id);
+        }
+    }
+
+    constexpr std::size_t targets = 64;
+    for (auto _ : state) {
+        std::size_t matches{0};
+        for (std::size_t target = 0; target < targets; target++) {
+            if constexpr (by_symbol) {
+                for (auto id : ids) matches += id == ids[target] ? 1 : 0;
+            } else {
+                for (auto lexeme : lexemes) matches += lexeme == lexemes[target] ? 1 : 0;
+            }
+        }
+        benchmark::DoNotOptimize(matches);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * targets * ids.size()));
+}
+
+void BM_identifier_equality_lexeme(benchmark::State& state) { identifier_equality<false>(state); }
+
+void BM_identifier_equality_symbol(benchmark::State& state) { identifier_equality<true>(state); }
+
+// Collecting the pull iterator's tokens, which is what a batch consumer had to do before
+void BM_collect_token_vector(benchmark::State& state) {
+    auto src = scheme_source(corpus_size);
+    std::size_t bytes{0};
+    for (auto _ : state) {
+        std::vector<std::expected<token::TokenView, lexer::LexError>> tokens{};
+        for (const auto& tok : src | lexer::lex) tokens.push_back(tok);
+        bytes = tokens.size() * sizeof(tokens[0]);
+        benchmark::DoNotOptimize(tokens.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+    state.counters["bytes_per_token"] = static_cast<double>(sizeof(lexer::Lexer<std::string_view>::Iterator::value_type));
+    state.counters["token_bytes"] = static_cast<double>(bytes);
+}
+
+void BM_tokenize_all(benchmark::State& state) {
+    auto src = scheme_source(corpus_size);
+    std::size_t bytes{0};
+    std::size_t tokens{0};
+    for (auto _ : state) {
+        auto buffer = lexer::tokenize_all(src);
+        bytes = buffer.memory_usage();
+        tokens = buffer.size();
+        benchmark::DoNotOptimize(buffer.kinds().data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+    state.counters["bytes_per_token"] = static_cast<double>(bytes) / static_cast<double>(tokens);
+    state.counters["source_bytes_per_token"] =
+        static_cast<double>(src.size()) / static_cast<double>(tokens);
+}
+
+// A downstream pass that only needs kinds: maximum paren nesting depth
+template <bool structure_of_arrays>
+void paren_depth(benchmark::State& state) {
+    auto src = scheme_source(corpus_size);
+    auto buffer = lexer::tokenize_all(src);
+    std::vector<std::expected<token::TokenView, lexer::LexError>> tokens{};
+    for (const auto& tok : src | lexer::lex) tokens.push_back(tok);
+
+    for (auto _ : state) {
+        int depth{0};
+        int max_depth{0};
+        if constexpr (structure_of_arrays) {
+            for (auto kind : buffer.kinds()) {
+                depth += kind == token::Kind::lparen ? 1 : kind == token::Kind::rparen ? -1 : 0;
+                max_depth = std::max(depth, max_depth);
+            }
+        } else {
+            for (const auto& tok : tokens) {
+                if (!tok) continue;
+                depth += std::holds_alternative<token::LParen>(*tok)   ? 1
+                         : std::holds_alternative<token::RParen>(*tok) ? -1
+                                                                       : 0;
+                max_depth = std::max(depth, max_depth);
+            }
+        }
+        benchmark::DoNotOptimize(max_depth);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * buffer.size()));
+}
+
+// Loading the tokens of the same source from a token cache entry: hashing the source, mapping the
+// entry and checking its hash, against lexing it in BM_tokenize_all
+void BM_load_token_cache(benchmark::State& state) {
+    auto src = scheme_source(corpus_size);
+    auto directory = std::filesystem::temp_directory_path() / "alenvers_bench_token_cache";
+    token_cache::TokenCache cache{directory};
+    cache.store(src, token_cache::content_hash(src));
+    for (auto _ : state) {
+        auto tokens = cache.load(src);
+        if (!tokens) state.SkipWithError("no cache entry");
+        benchmark::DoNotOptimize(tokens->kinds().data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+    std::filesystem::remove_all(directory);
+}
+
+// The content hash on its own, which a cache hit pays over the source and over the entry
+void BM_content_hash(benchmark::State& state) {
+    auto src = scheme_source(corpus_size);
+    for (auto _ : state) benchmark::DoNotOptimize(token_cache::content_hash(src));
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+}
+
+// The structural pass that finds the top-level forms, over the corpus BM_tokenize_all lexes
+void BM_index_forms(benchmark::State& state) {
+    auto src = scheme_source(corpus_size);
+    std::size_t forms{0};
+    for (auto _ : state) {
+        lexer::FormIndex index{src};
+        forms = index.size();
+        benchmark::DoNotOptimize(index[0].data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+    state.counters["forms"] = static_cast<double>(forms);
+}
+
+// Indexing the forms and lexing only the one in the middle, as a caller needing one definition of
+// a library would, against lexing all of it in BM_tokenize_all
+void BM_index_and_lex_one_form(benchmark::State& state) {
+    auto src = scheme_source(corpus_size);
+    for (auto _ : state) {
+        lexer::FormIndex index{src};
+        auto buffer = lexer::tokenize_all(index[index.size() / 2]);
+        benchmark::DoNotOptimize(buffer.kinds().data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+}
+
+void BM_paren_depth_token_vector(benchmark::State& state) { paren_depth<false>(state); }
+
+void BM_paren_depth_token_buffer(benchmark::State& state) { paren_depth<true>(state); }
+
+// One large source lexed on state.range(0) threads
+void BM_parallel_lex(benchmark::State& state) {
+    auto src = scheme_source(std::size_t{64} << 20U);
+    auto threads = static_cast<unsigned>(state.range(0));
+    for (auto _ : state) {
+        auto buffer = lexer::parallel_lex(src, threads);
+        benchmark::DoNotOptimize(buffer.size());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+}
+
+// A one char edit in the middle of a source of state.range(0) lines, typed and undone
+void BM_relex_single_char(benchmark::State& state) {
+    auto src = indented_source(static_cast<std::size_t>(state.range(0)) * 36);
+    auto middle = static_cast<uint32_t>(src.find("fib-iter", src.size() / 2) + 3);
+    auto edited = src;
+    edited.insert(middle, "x");
+
+    auto tokens = lexer::tokenize_all(src);
+    for (auto _ : state) {
+        lexer::relex(tokens, lexer::Edit{middle, 0, 1}, edited);
+        lexer::relex(tokens, lexer::Edit{middle, 1, 0}, src);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * 2));
+}
+
+// The same edit re-lexed from scratch
+void BM_relex_from_scratch(benchmark::State& state) {
+    auto src = indented_source(static_cast<std::size_t>(state.range(0)) * 36);
+    for (auto _ : state) benchmark::DoNotOptimize(lexer::tokenize_all(src).size());
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+
+// The same corpus through the variant automaton and through the transition tables
+template <typename Source>
+void lex_automaton_legacy(benchmark::State& state, Source make_source) {
+    auto src = make_source(corpus_size);
+    for (auto _ : state) {
+        legacy::VariantLexer tokens{src};
+        std::size_t count{0};
+        for (auto tok = tokens.next(); !tok || !std::holds_alternative<token::Eof>(*tok);
+             tok = tokens.next()) {
+            benchmark::DoNotOptimize(tok);
+            count++;
+        }
+        benchmark::DoNotOptimize(count);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+}
+
+template <typename Source>
+void lex_automaton_table(benchmark::State& state, Source make_source) {
+    auto src = make_source(corpus_size);
+    for (auto _ : state) {
+        std::size_t count{0};
+        for (const auto& tok : lexer::Lexer<std::string_view>{src}) {
+            benchmark::DoNotOptimize(tok);
+            count++;
+        }
+        benchmark::DoNotOptimize(count);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+}
+
+void BM_automaton_variant_dense(benchmark::State& state) {
+    lex_automaton_legacy(state, scheme_source);
+}
+
+void BM_automaton_table_dense(benchmark::State& state) { lex_automaton_table(state, scheme_source); }
+
+void BM_automaton_variant_indented(benchmark::State& state) {
+    lex_automaton_legacy(state, indented_source);
+}
+
+void BM_automaton_table_indented(benchmark::State& state) {
+    lex_automaton_table(state, indented_source);
+}
+
+// Cost of resolving a diagnostic: index every line of the source, then locate one offset
+void BM_source_map_locate(benchmark::State& state) {
+    auto src = indented_source(corpus_size);
+    for (auto _ : state) {
+        lexer::SourceMap map{src};
+        benchmark::DoNotOptimize(map.locate(src.size() - 1));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+}
+
+template <auto Skip>
+void skip_whitespace_runs(benchmark::State& state) {
+    std::string src(corpus_size, ' ');
+    for (std::size_t i = 64; i < src.size(); i += 64) src[i] = 'x';
+    for (auto _ : state) {
+        const char* it = src.data();
+        const char* end = src.data() + src.size();
+        while (it != end) {
+            it = Skip(it, end);
+            if (it != end) it++;
+        }
+        benchmark::DoNotOptimize(it);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+}
+
+void BM_skip_whitespace_scalar(benchmark::State& state) {
+    skip_whitespace_runs<scan::scalar::skip_whitespace>(state);
+}
+
+void BM_skip_whitespace_simd(benchmark::State& state) {
+    skip_whitespace_runs<scan::skip_whitespace>(state);
+}
+
+// Data files of numbers, rows of eight: integers, decimals, or a mix of every literal syntax
+enum class NumericCorpus : uint8_t { integers, decimals, mixed };
+
+auto numeric_source(std::size_t size, NumericCorpus corpus) -> std::string {
+    uint64_t seed = 0x2545F4914F6CDD1DULL;
+    auto next = [&seed] {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        return seed >> 16U;
+    };
+    auto integer = [&next] {
+        return std::format("{}", static_cast<int64_t>(next() % 2000001) - 1000000);
+    };
+    auto decimal = [&next] {
+        return std::format("{}.{}", static_cast<int64_t>(next() % 20001) - 10000, next() % 1000000);
+    };
+    auto mixed = [&] {
+        switch (next() % 6) {
+            case 0:
+                return integer();
+            case 1:
+                return decimal();
+            case 2:
+                return std::format("{}/{}", next() % 1000, next() % 999 + 1);
+            case 3:
+                return std::format("#x{:X}", next() % 0x100000);
+            case 4:
+                return std::format("{}e{}", next() % 1000, static_cast<int>(next() % 41) - 20);
+            default:
+                return std::format("#e{}", decimal());
+        }
+    };
+
+    std::string src{};
+    while (src.size() < size) {
+        src += '(';
+        for (int i = 0; i < 8; i++) {
+            src += corpus == NumericCorpus::integers ? integer()
+                   : corpus == NumericCorpus::decimals ? decimal()
+                                                       : mixed();
+            src += ' ';
+        }
+        src += ")\n";
+    }
+    return src;
+}
+
+// Lexing numeric data, literals converted to values in the same pass
+void BM_lex_numbers(benchmark::State& state) {
+    auto src = numeric_source(corpus_size, static_cast<NumericCorpus>(state.range(0)));
+    std::size_t tokens{0};
+    for (auto _ : state) {
+        tokens = 0;
+        for (const auto& tok : lexer::Lexer<std::string_view>{src}) {
+            benchmark::DoNotOptimize(tok);
+            tokens++;
+        }
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * tokens));
+}
+
+// Converting the number lexemes of the mixed corpus: copied into a std::string for std::stod,
+// as a lexer that only yields text leaves the caller to, against from_chars on the source bytes
+template <bool via_string>
+void convert_numbers(benchmark::State& state) {
+    auto src = numeric_source(corpus_size, NumericCorpus::mixed);
+    auto buffer = lexer::tokenize_all(src);
+    std::vector<std::string_view> lexemes{};
+    for (std::size_t i = 0; i < buffer.size(); i++) {
+        if (buffer.kind(i) == token::Kind::number) lexemes.push_back(buffer.lexeme(i));
+    }
+
+    for (auto _ : state) {
+        for (auto lexeme : lexemes) {
+            if constexpr (via_string) {
+                // stod reads neither prefixes nor rationals; skip past them to keep it converting
+                auto text = std::string{lexeme.substr(lexeme.starts_with('#') ? 2 : 0)};
+                benchmark::DoNotOptimize(std::stod(text));
+            } else {
+                benchmark::DoNotOptimize(number::parse(lexeme));
+            }
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * lexemes.size()));
+}
+
+void BM_convert_numbers_stod(benchmark::State& state) { convert_numbers<true>(state); }
+
+void BM_convert_numbers_from_chars(benchmark::State& state) { convert_numbers<false>(state); }
+
+// Reader allocating every pair and atom on its own, the baseline for the arena reader
+namespace boxed {
+
+struct Node;
+using NodePtr = std::unique_ptr<Node>;
+
+struct Node {
+    std::variant<std::monostate, std::string, number::ValueView, std::pair<NodePtr, NodePtr>> value;
+};
+
+template <typename It>
+auto read(It& it) -> NodePtr {
+    auto tok = *it;
+    ++it;
+    if (!tok) return nullptr;
+    if (const auto* identifier = std::get_if<token::IdentifierView>(&*tok)) {
+        return std::make_unique<Node>(Node{std::string{identifier->lexeme}});
+    }
+    if (const auto* num = std::get_if<token::NumberView>(&*tok)) {
+        return std::make_unique<Node>(Node{num->value});
+    }
+    if (!std::holds_alternative<token::LParen>(*tok)) return nullptr;
+
+    auto list = std::make_unique<Node>();
+    Node* tail = list.get();
+    while (*it && !std::holds_alternative<token::RParen>(**it) &&
+           !std::holds_alternative<token::Eof>(**it)) {
+        auto car = read(it);
+        tail->value = std::pair{std::move(car), std::make_unique<Node>()};
+        tail = std::get<std::pair<NodePtr, NodePtr>>(tail->value).second.get();
+    }
+    ++it;
+    return list;
+}
+
+}  // namespace boxed
+
+// Reading every datum of a data file of numbers, with the allocations it takes per token. The
+// arena is reset and reused between iterations, as a program reading file after file would.
+template <bool use_arena>
+void read_datums(benchmark::State& state) {
+    auto src = numeric_source(static_cast<std::size_t>(state.range(0)), NumericCorpus::mixed);
+    auto tokens =
+        static_cast<std::size_t>(std::ranges::distance(lexer::Lexer<std::string_view>{src}));
+
+    arena::Arena arena{};
+    std::vector<reader::Datum> datums{};
+    std::vector<boxed::NodePtr> nodes{};
+    std::size_t allocations{0};
+    for (auto _ : state) {
+        auto before = allocation_count.load(std::memory_order_relaxed);
+        if constexpr (use_arena) {
+            arena.reset();
+            datums.clear();
+            for (const auto& datum : std::string_view{src} | lexer::lex | reader::read(arena)) {
+                datums.push_back(*datum);
+            }
+        } else {
+            nodes.clear();
+            auto lexed = lexer::Lexer<std::string_view>{src};
+            for (auto it = lexed.begin(); !(*it && std::holds_alternative<token::Eof>(**it));) {
+                nodes.push_back(boxed::read(it));
+            }
+        }
+        allocations += allocation_count.load(std::memory_order_relaxed) - before;
+        benchmark::ClobberMemory();
+    }
+    auto iterations = static_cast<double>(state.iterations());
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * tokens));
+    state.counters["allocs"] = static_cast<double>(allocations) / iterations;
+    state.counters["allocs_per_token"] =
+        static_cast<double>(allocations) / (iterations * static_cast<double>(tokens));
+}
+
+void BM_read_boxed(benchmark::State& state) { read_datums<false>(state); }
+
+void BM_read_arena(benchmark::State& state) { read_datums<true>(state); }
+
+// Heap values with the shape of datum, symbols and numbers other than fixnums becoming 0, as a
+// reader producing values of the VM would allocate them: every list one pair per element
+auto to_heap(gc::Heap& heap, const reader::Datum& datum) -> vm::Value {
+    if (datum.tag() == reader::Tag::integer) return vm::Value::fixnum(datum.as_integer());
+    if (!datum.is_pair()) return datum.is_nil() ? vm::Value::empty_list() : vm::Value::fixnum(0);
+    gc::Root car{heap, to_heap(heap, datum.as_pair().car)};
+    auto cdr = to_heap(heap, datum.as_pair().cdr);
+    return vm::Value::pair(heap.make_pair(*car, cdr));
+}
+
+auto pair_count(const reader::Datum& datum) -> std::size_t {
+    std::size_t count{0};
+    for (const auto* it = &datum; it->is_pair(); it = &it->as_pair().cdr) {
+        count += 1 + pair_count(it->as_pair().car);
+    }
+    return count;
+}
+
+namespace refcounted {
+
+struct Pair;
+using Value = std::variant<int64_t, std::shared_ptr<const Pair>>;
+
+struct Pair {
+    Value car;
+    Value cdr;
+};
+
+auto from_datum(const reader::Datum& datum) -> Value {
+    if (datum.tag() == reader::Tag::integer) return datum.as_integer();
+    if (!datum.is_pair()) return int64_t{0};
+    return std::make_shared<const Pair>(
+        Pair{from_datum(datum.as_pair().car), from_datum(datum.as_pair().cdr)});
+}
+
+}  // namespace refcounted
+
+// Allocating the lists of a program as the reader reads them, most of them dropped at once and
+// one in every keep_every kept alive until live_forms more have been kept, as an evaluator
+// holding on to a few results would. Reports the collector's pauses and how much survives them.
+template <bool use_gc>
+void allocate_lists(benchmark::State& state) {
+    constexpr std::size_t live_forms = 64;
+    constexpr std::size_t keep_every = 16;
+    arena::Arena arena{};
+    std::vector<reader::Datum> datums{};
+    for (const auto& datum : scheme_source(std::size_t{1} << 20U) | lexer::lex |
+                                 reader::read(arena)) {
+        if (datum) datums.push_back(*datum);
+    }
+
+    gc::Heap heap{};
+    std::vector<vm::Value> live(live_forms, vm::Value::empty_list());
+    heap.add_roots(live);
+    std::vector<refcounted::Value> live_refcounted(live_forms);
+    std::size_t kept{0};
+    for (auto _ : state) {
+        for (std::size_t i = 0; i < datums.size(); i++) {
+            if constexpr (use_gc) {
+                auto value = to_heap(heap, datums[i]);
+                if (i % keep_every == 0) live[kept++ % live_forms] = value;
+                benchmark::DoNotOptimize(value);
+            } else {
+                auto value = refcounted::from_datum(datums[i]);
+                if (i % keep_every == 0) live_refcounted[kept++ % live_forms] = std::move(value);
+                benchmark::DoNotOptimize(value);
+            }
+        }
+    }
+    if constexpr (use_gc) {
+        const auto& stats = heap.stats();
+        auto minor = static_cast<double>(stats.minor_collections);
+        state.counters["minor_collections"] = minor;
+        state.counters["major_collections"] = static_cast<double>(stats.major_collections);
+        state.counters["minor_pause_mean_us"] =
+            minor == 0 ? 0 : static_cast<double>(stats.minor_pause_total.count()) / minor / 1e3;
+        state.counters["minor_pause_max_us"] =
+            static_cast<double>(stats.minor_pause_max.count()) / 1e3;
+        state.counters["promoted_bytes"] = static_cast<double>(stats.bytes_promoted);
+    }
+    std::size_t pairs{0};
+    for (const auto& datum : datums) pairs += pair_count(datum);
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * pairs));
+}
+
+void BM_lists_refcounted(benchmark::State& state) { allocate_lists<false>(state); }
+
+void BM_lists_gc(benchmark::State& state) { allocate_lists<true>(state); }
+
+// Programs for the VM: non-tail calls, deep argument evaluation, and a tail recursive loop
+constexpr std::string_view fib_program{
+    "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))) (fib 25)"};
+using namespace lexer::literals;
+constexpr auto tak_tokens =
+    "(define (tak x y z)\n"
+    "  (if (< y x) (tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y)) z))\n"
+    "(tak 18 12 6)"_scm;
+constexpr std::string_view tak_program = tak_tokens.source();
+constexpr std::string_view loop_program{
+    "(let loop ((i 0) (acc 0)) (if (= i 1000000) acc (loop (+ i 1) (+ acc i))))"};
+
+auto compile_program(std::string_view src) -> bytecode::Program {
+    arena::Arena arena{};
+    std::vector<reader::Datum> forms{};
+    for (const auto& datum : src | lexer::lex | reader::read(arena)) forms.push_back(*datum);
+    return *compiler::compile(forms);
+}
+
+// Running a program, with the instructions it executes per second and the time each takes on
+// average, which is dominated by dispatch for the short instructions of these programs
+template <vm::Dispatch dispatch>
+void run_vm(benchmark::State& state, std::string_view src) {
+    auto program = compile_program(src);
+    vm::Vm machine{};
+    // counting slows the run down, so count once and time runs that do not
+    (void)machine.run<dispatch, true>(program);
+    auto instructions = static_cast<double>(machine.instructions_executed());
+    for (auto _ : state) benchmark::DoNotOptimize(machine.run<dispatch>(program));
+    state.SetItemsProcessed(static_cast<int64_t>(static_cast<double>(state.iterations()) *
+                                                 instructions));
+    state.counters["time_per_instruction"] = benchmark::Counter(
+        static_cast<double>(state.iterations()) * instructions,
+        benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+template <vm::Dispatch dispatch>
+void BM_vm_fib(benchmark::State& state) {
+    run_vm<dispatch>(state, fib_program);
+}
+
+template <vm::Dispatch dispatch>
+void BM_vm_tak(benchmark::State& state) {
+    run_vm<dispatch>(state, tak_program);
+}
+
+template <vm::Dispatch dispatch>
+void BM_vm_loop(benchmark::State& state) {
+    run_vm<dispatch>(state, loop_program);
+}
+
+// Reading a program embedded in the binary, lexed at startup or while compiling
+template <std::ranges::view Tokens>
+void read_embedded(benchmark::State& state, Tokens tokens) {
+    arena::Arena arena{};
+    for (auto _ : state) {
+        for (const auto& datum : tokens | reader::read(arena)) benchmark::DoNotOptimize(datum);
+        arena.reset();
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * tak_program.size()));
+}
+
+void BM_read_embedded_lexed(benchmark::State& state) {
+    read_embedded(state, tak_program | lexer::lex);
+}
+
+void BM_read_embedded_static(benchmark::State& state) { read_embedded(state, tak_tokens); }
+
+// Reproducible corpora for the throughput matrix below. Every generator is driven by its own
+// fixed-seed LCG and no standard distribution, whose output differs between standard libraries,
+// so a corpus is the same bytes on every platform and commit; change the seed or the generator
+// only together with corpus_version.
+constexpr std::string_view corpus_version = "1";
+
+class Lcg {
+   private:
+    uint64_t m_seed;
+
+   public:
+    explicit Lcg(uint64_t seed) : m_seed{seed} {}
+    auto operator()(uint64_t bound) -> uint64_t {
+        m_seed = m_seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (m_seed >> 33U) % bound;
+    }
+};
+
+// The variant a VM value would be without tagging, for comparison with vm::Value
+namespace variant_value {
+
+struct Unspecified {};
+struct EmptyList {};
+struct Pair;
+
+using Value = std::variant<Unspecified, EmptyList, bool, int64_t, Pair*>;
+
+struct Pair {
+    Value car;
+    Value cdr;
+};
+
+}  // namespace variant_value
+
+constexpr std::size_t value_count = 4096;
+
+// Fixnums, or with mixed one in four of them a #f, an empty list or a pair instead
+auto variant_values(bool mixed, std::vector<variant_value::Pair>& pairs)
+    -> std::vector<variant_value::Value> {
+    pairs.assign(value_count, variant_value::Pair{int64_t{1}, variant_value::EmptyList{}});
+    std::vector<variant_value::Value> values{};
+    Lcg next{0x9E3779B97F4A7C15ULL};
+    for (std::size_t i = 0; i < value_count; i++) {
+        switch (mixed ? next(12) : 3) {
+            case 0:
+                values.emplace_back(false);
+                break;
+            case 1:
+                values.emplace_back(variant_value::EmptyList{});
+                break;
+            case 2:
+                values.emplace_back(&pairs[i]);
+                break;
+            default:
+                values.emplace_back(static_cast<int64_t>(i));
+        }
+    }
+    return values;
+}
+
+auto tagged_values(bool mixed, std::vector<vm::Pair>& pairs) -> std::vector<vm::Value> {
+    pairs.assign(value_count, vm::Pair{vm::Value::fixnum(1), vm::Value::empty_list()});
+    std::vector<vm::Value> values{};
+    Lcg next{0x9E3779B97F4A7C15ULL};
+    for (std::size_t i = 0; i < value_count; i++) {
+        switch (mixed ? next(12) : 3) {
+            case 0:
+                values.push_back(vm::Value::boolean(false));
+                break;
+            case 1:
+                values.push_back(vm::Value::empty_list());
+                break;
+            case 2:
+                values.push_back(vm::Value::pair(&pairs[i]));
+                break;
+            default:
+                values.push_back(vm::Value::fixnum(static_cast<int64_t>(i)));
+        }
+    }
+    return values;
+}
+
+// Summing fixnums with the VM's checks: both operands fixnums, and no overflow
+void BM_value_add_variant(benchmark::State& state) {
+    std::vector<variant_value::Pair> pairs{};
+    auto values = variant_values(false, pairs);
+    for (auto _ : state) {
+        variant_value::Value sum = int64_t{0};
+        for (const auto& value : values) {
+            const auto* a = std::get_if<int64_t>(&sum);
+            const auto* b = std::get_if<int64_t>(&value);
+            int64_t result{};
+            if (a == nullptr || b == nullptr || vm::detail::add_overflows(*a, *b, result)) {
+                state.SkipWithError("not a fixnum sum");
+                break;
+            }
+            sum = result;
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * value_count));
+    state.counters["value_bytes"] = sizeof(variant_value::Value);
+}
+
+void BM_value_add_tagged(benchmark::State& state) {
+    std::vector<vm::Pair> pairs{};
+    auto values = tagged_values(false, pairs);
+    for (auto _ : state) {
+        auto sum = vm::Value::fixnum(0);
+        for (const auto& value : values) {
+            auto a = static_cast<int64_t>(sum.bits());
+            auto b = static_cast<int64_t>(value.bits());
+            int64_t result{};
+            if (((a | b) & 1) != 0 || vm::detail::add_overflows(a, b, result)) {
+                state.SkipWithError("not a fixnum sum");
+                break;
+            }
+            sum = vm::Value::from_bits(static_cast<uint64_t>(result));
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * value_count));
+    state.counters["value_bytes"] = sizeof(vm::Value);
+}
+
+// Branching on the type of mixed values: counting true ones and adding up fixnums and the cars
+// of pairs
+void BM_value_dispatch_variant(benchmark::State& state) {
+    std::vector<variant_value::Pair> pairs{};
+    auto values = variant_values(true, pairs);
+    for (auto _ : state) {
+        int64_t total{0};
+        int64_t truthy{0};
+        for (const auto& value : values) {
+            std::visit(util::overloads{
+                           [&](int64_t n) { total += n; },
+                           [&](variant_value::Pair* pair) {
+                               if (const auto* n = std::get_if<int64_t>(&pair->car)) total += *n;
+                           },
+                           [](auto /*other*/) {},
+                       },
+                       value);
+            const auto* boolean = std::get_if<bool>(&value);
+            truthy += boolean == nullptr || *boolean ? 1 : 0;
+        }
+        benchmark::DoNotOptimize(total);
+        benchmark::DoNotOptimize(truthy);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * value_count));
+}
+
+void BM_value_dispatch_tagged(benchmark::State& state) {
+    std::vector<vm::Pair> pairs{};
+    auto values = tagged_values(true, pairs);
+    for (auto _ : state) {
+        int64_t total{0};
+        int64_t truthy{0};
+        for (const auto& value : values) {
+            if (value.is_fixnum()) {
+                total += value.as_fixnum();
+            } else if (value.is_pair() && value.as_pair()->car.is_fixnum()) {
+                total += value.as_pair()->car.as_fixnum();
+            }
+            truthy += value.is_false() ? 0 : 1;
+        }
+        benchmark::DoNotOptimize(total);
+        benchmark::DoNotOptimize(truthy);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * value_count));
+}
+
+// Short atoms in randomly nested lists: mostly paren tokens
+auto paren_source(std::size_t size) -> std::string {
+    Lcg next{0xA0761D6478BD642FULL};
+    std::string src{};
+    int depth{0};
+    while (src.size() < size || depth > 0) {
+        auto roll = next(8);
+        if (roll < 3 && src.size() < size) {
+            src += '(';
+            depth++;
+        } else if (roll < 6 && depth > 0) {
+            src += ')';
+            depth--;
+        } else {
+            src += static_cast<char>('a' + next(26));
+            src += ' ';
+        }
+    }
+    return src;
+}
+
+// Forms separated by long runs of spaces, tabs and blank lines
+auto whitespace_source(std::size_t size) -> std::string {
+    constexpr std::string_view blanks = " \t\n  \n\t\t ";
+    Lcg next{0xE7037ED1A0B428DBULL};
+    std::string src{};
+    while (src.size() < size) {
+        src += "(define x";
+        for (auto run = next(60) + 4; run > 0; run--) src += blanks[next(blanks.size())];
+        src += "(f x))";
+        for (auto run = next(60) + 4; run > 0; run--) src += blanks[next(blanks.size())];
+    }
+    return src;
+}
+
+// Identifiers interleaved with chars the lexer cannot read yet, so that most lexemes end in an
+// InvalidTokenError and resynchronisation
+auto error_source(std::size_t size) -> std::string {
+    constexpr std::array<std::string_view, 8> lexemes{"1x", "#t", "'a", "[b]", "|c|", "\"s",
+                                                      "x{", "ok"};
+    Lcg next{0x8EBC6AF09C88C6E3ULL};
+    std::string src{};
+    while (src.size() < size) {
+        src += '(';
+        for (int i = 0; i < 6; i++) {
+            src += lexemes[next(lexemes.size())];
+            src += ' ';
+        }
+        src += ")\n";
+    }
+    return src;
+}
+
+// Forms of identifiers in Greek, CJK and arrows as well as ASCII, so that most lexemes take the
+// path that validates UTF-8
+auto utf8_source(std::size_t size) -> std::string {
+    constexpr std::array<std::string_view, 8> words{"\xCE\xBB",           // λ
+                                                    "x\xE2\x86\x92y",       // x→y
+                                                    "\xE6\x97\xA5\xE6\x9C\xAC",  // 日本
+                                                    "define",
+                                                    "\xCE\xB1\xCE\xB2\xCE\xB3",  // αβγ
+                                                    "list->\xE2\x88\x91",    // list->∑
+                                                    "x",
+                                                    "-\xCF\x80"};           // -π
+    Lcg next{0x589965CC75374CC3ULL};
+    std::string src{};
+    while (src.size() < size) {
+        src += '(';
+        for (auto count = next(6) + 1; count > 0; count--) {
+            src += words[next(words.size())];
+            src += ' ';
+        }
+        src += ")\n";
+    }
+    return src;
+}
+
+struct Corpus {
+    std::string_view name;
+    std::string (*generate)(std::size_t);
+};
+
+constexpr std::array<Corpus, 6> corpora{{
+    {"identifiers", repetitive_source},
+    {"parens", paren_source},
+    {"whitespace", whitespace_source},
+    {"crlf", crlf_source},
+    {"errors", error_source},
+    {"utf8", utf8_source},
+}};
+
+// How the lexer is given the source: as a std::string or string_view (both span mode), through
+// a stream's istreambuf_iterator or an io::buffered_source over its stream buffer (owning mode),
+// or behind util::newline_normaliser_adapter
+enum class SourceKind : uint8_t { string, string_view, istreambuf, buffered, normaliser };
+
+constexpr std::array<std::pair<SourceKind, std::string_view>, 5> source_kinds{{
+    {SourceKind::string, "string"},
+    {SourceKind::string_view, "string_view"},
+    {SourceKind::istreambuf, "istreambuf"},
+    {SourceKind::buffered, "buffered"},
+    {SourceKind::normaliser, "normaliser"},
+}};
+
+template <typename Tokens>
+auto count_tokens(Tokens&& tokens) -> std::size_t {
+    std::size_t count{0};
+    for (const auto& tok : tokens) {
+        benchmark::DoNotOptimize(tok);
+        count++;
+    }
+    return count;
+}
+
+auto lex_source(std::string& src, SourceKind kind) -> std::size_t {
+    switch (kind) {
+        case SourceKind::string:
+            return count_tokens(src | lexer::lex);
+        case SourceKind::string_view:
+            return count_tokens(lexer::Lexer<std::string_view>{src});
+        case SourceKind::istreambuf: {
+            std::ispanstream stream{std::span<char>{src}};
+            return count_tokens(std::ranges::subrange{std::istreambuf_iterator<char>{stream},
+                                                      std::istreambuf_iterator<char>{}} |
+                                lexer::lex);
+        }
+        case SourceKind::buffered: {
+            std::ispanstream stream{std::span<char>{src}};
+            return count_tokens(io::buffered_source{*stream.rdbuf()} | lexer::lex);
+        }
+        case SourceKind::normaliser:
+            return count_tokens(util::newline_normaliser_adapter(src) | lexer::lex);
+    }
+    return 0;
+}
+
+void lex_corpus(benchmark::State& state, const Corpus& corpus, SourceKind kind) {
+    auto src = corpus.generate(corpus_size);
+    std::size_t tokens{0};
+    std::size_t allocations{0};
+    for (auto _ : state) {
+        auto before = allocation_count.load(std::memory_order_relaxed);
+        tokens = lex_source(src, kind);
+        allocations += allocation_count.load(std::memory_order_relaxed) - before;
+    }
+    auto iterations = static_cast<double>(state.iterations());
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * tokens));
+    state.counters["allocs_per_token"] =
+        static_cast<double>(allocations) / (iterations * static_cast<double>(tokens));
+}
+
+// Validating a corpus as UTF-8 on its own, which for ASCII is the vector scan for a high bit
+void validate_corpus(benchmark::State& state, const Corpus& corpus) {
+    auto src = corpus.generate(corpus_size);
+    for (auto _ : state) benchmark::DoNotOptimize(utf8::is_valid(src));
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * src.size()));
+}
+
+// BM_lex/<corpus>/<source kind> for every pair, and each corpus's hash in the context of the
+// report, so that results of two runs are only compared over the same input
+[[maybe_unused]] const bool corpus_benchmarks = [] {
+    benchmark::AddCustomContext("corpus_version", std::string{corpus_version});
+    for (const auto& corpus : corpora) {
+        auto hash = symbol::hash(corpus.generate(corpus_size));
+        benchmark::AddCustomContext(std::format("corpus_{}_fnv1a", corpus.name),
+                                    std::format("{:08x}", hash));
+        for (auto [kind, kind_name] : source_kinds) {
+            auto name = std::format("BM_lex/{}/{}", corpus.name, kind_name);
+            benchmark::RegisterBenchmark(name.c_str(), lex_corpus, corpus, kind);
+        }
+        auto name = std::format("BM_validate_utf8/{}", corpus.name);
+        benchmark::RegisterBenchmark(name.c_str(), validate_corpus, corpus);
+    }
+    return true;
+}();
+
+}  // namespace
+
+BENCHMARK(BM_is_subsequent_legacy);
+BENCHMARK(BM_is_subsequent_table);
+BENCHMARK(BM_is_delimiter_legacy);
+BENCHMARK(BM_is_delimiter_table);
+BENCHMARK(BM_lex_indented);
+BENCHMARK(BM_lex_indented_stats);
+BENCHMARK(BM_stream_lex_indented)->Arg(16)->Arg(4096)->Arg(65536);
+BENCHMARK(BM_skip_whitespace_scalar);
+BENCHMARK(BM_skip_whitespace_simd);
+BENCHMARK(BM_lex_crlf_normaliser);
+BENCHMARK(BM_lex_crlf);
+BENCHMARK(BM_lex_identifiers_no_interning);
+BENCHMARK(BM_lex_identifiers_symbol_table);
+BENCHMARK(BM_lex_identifiers_shared_symbol_table);
+BENCHMARK(BM_identifier_equality_lexeme);
+BENCHMARK(BM_identifier_equality_symbol);
+BENCHMARK(BM_collect_token_vector);
+BENCHMARK(BM_tokenize_all);
+BENCHMARK(BM_load_token_cache);
+BENCHMARK(BM_content_hash);
+BENCHMARK(BM_index_forms);
+BENCHMARK(BM_index_and_lex_one_form);
+BENCHMARK(BM_paren_depth_token_vector);
+BENCHMARK(BM_paren_depth_token_buffer);
+BENCHMARK(BM_source_map_locate);
+BENCHMARK(BM_automaton_variant_dense);
+BENCHMARK(BM_automaton_table_dense);
+BENCHMARK(BM_automaton_variant_indented);
+BENCHMARK(BM_automaton_table_indented);
+BENCHMARK(BM_lex_numbers)
+    ->Arg(static_cast<int>(NumericCorpus::integers))
+    ->Arg(static_cast<int>(NumericCorpus::decimals))
+    ->Arg(static_cast<int>(NumericCorpus::mixed));
+BENCHMARK(BM_convert_numbers_stod);
+BENCHMARK(BM_convert_numbers_from_chars);
+// a node per allocation would take gigabytes at 100 MiB, so the baseline stops short of it
+BENCHMARK(BM_value_add_variant);
+BENCHMARK(BM_value_add_tagged);
+BENCHMARK(BM_value_dispatch_variant);
+BENCHMARK(BM_value_dispatch_tagged);
+BENCHMARK(BM_lists_refcounted)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_lists_gc)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_vm_fib, vm::Dispatch::switch_loop);
+BENCHMARK_TEMPLATE(BM_vm_tak, vm::Dispatch::switch_loop);
+BENCHMARK_TEMPLATE(BM_vm_loop, vm::Dispatch::switch_loop);
+#if defined(__GNUC__)
+BENCHMARK_TEMPLATE(BM_vm_fib, vm::Dispatch::threaded);
+BENCHMARK_TEMPLATE(BM_vm_tak, vm::Dispatch::threaded);
+BENCHMARK_TEMPLATE(BM_vm_loop, vm::Dispatch::threaded);
+#endif
+BENCHMARK(BM_read_embedded_lexed);
+BENCHMARK(BM_read_embedded_static);
+BENCHMARK(BM_read_boxed)->Arg(1 << 20)->Arg(16 << 20)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_read_arena)
+    ->Arg(1 << 20)
+    ->Arg(16 << 20)
+    ->Arg(100 << 20)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_relex_single_char)->Arg(5000)->Arg(50000);
+BENCHMARK(BM_relex_from_scratch)->Arg(5000)->Arg(50000);
+BENCHMARK(BM_parallel_lex)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
@@ -1,42 +1,324 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
 #include <filesystem>
 #include <format>
-#include <fstream>
 #include <iostream>
-#include <iterator>
+#include <numeric>
+#include <optional>
 #include <print>
 #include <ranges>
+#include <span>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
 
+#include "arena.hpp"
+#include "compiler.hpp"
 #include "lexer.hpp"
+#include "mapped_file.hpp"
+#include "reader.hpp"
+#include "static_lexer.hpp"
+#include "token_cache.hpp"
+#include "vm.hpp"
+#include "work_pool.hpp"
 
-auto main() -> int {
-    try {
-        std::string testa {
-            "(define (fib a)\n\
+namespace {
+
+using namespace lexer::literals;
+
+// The fib example, lexed while compiling
+constexpr auto fib_example = "(define (fib a)\n\
                (define (fib-iter a b n)\n\
                  (if (= n 0)\n\
                   b\n\
                   (fib-iter b (+ a b) (- n 1))\n\
                  )\n\
                )\n\
-               (fib 1 1 a))"};
+               (fib-iter 1 1 a))\n\
+             (fib 80)"_scm;
+
+// A lexer that counts what it does, for --stats
+template <typename R>
+using InstrumentedLexer = lexer::Lexer<R, symbol::NoInterning, lexer::CollectStats>;
+
+// The lexer's counters, once it has lexed the program, if it keeps them
+template <typename Tokens>
+void report_stats(const Tokens& tokens) {
+    if constexpr (requires { tokens.stats(); }) {
+        std::println(stderr, "{}", lexer::format_stats(tokens.stats()));
+    }
+}
+
+// Read, compile and run the program of tokens, printing the value of its last form or the first
+// error
+template <std::ranges::view Tokens>
+auto run(Tokens tokens) -> bool {
+    arena::Arena arena{};
+    auto datums = std::move(tokens) | reader::read(arena);
+    std::vector<reader::Datum> forms{};
+    for (const auto& datum : datums) {
+        if (!datum) {
+            std::println(stderr, "{}", datums.base().source_map().locate(datum.error()));
+            report_stats(datums.base());
+            return false;
+        }
+        forms.push_back(*datum);
+    }
+    report_stats(datums.base());
+
+    auto program = compiler::compile(forms);
+    if (!program) {
+        std::println(stderr, "Error: {}", program.error().message);
+        return false;
+    }
+
+    vm::Vm machine{};
+    auto result = machine.run(*program);
+    if (!result) {
+        std::println(stderr, "Error: {}", result.error().message);
+        return false;
+    }
+    if (auto text = vm::format_value(*result); !text.empty()) std::println("{}", text);
+    return true;
+}
+
+template <std::ranges::view Tokens>
+void print_tokens(Tokens tokens) {
+    for (const auto& it : tokens) {
+        if (it) std::println("{}", tokens.source_map().locate(*it));
+        else std::println("{}", tokens.source_map().locate(it.error()));
+    }
+    report_stats(tokens);
+}
+
+// Lists or runs the program of tokens, as main was asked to
+template <std::ranges::view Tokens>
+auto list_or_run(Tokens tokens, bool list) -> bool {
+    if (!list) return run(std::move(tokens));
+    print_tokens(std::move(tokens));
+    return true;
+}
+
+// Files of a batch smaller than this are checked together, in tasks of up to this many bytes, so
+// that thousands of small files do not cost thousands of tasks
+constexpr std::uintmax_t batch_bytes = std::uintmax_t{1} << 18U;
+
+struct FileResult {
+    std::string error{};  // empty if the file checked
+    std::size_t bytes{0};
+    std::size_t forms{0};
+    bool cached{false};
+    lexer::Stats stats{};
+};
+
+// Read and compile the program of tokens into result
+template <std::ranges::view Tokens>
+void check_tokens(Tokens tokens, FileResult& result) {
+    arena::Arena arena{};
+    auto datums = std::move(tokens) | reader::read(arena);
+    std::vector<reader::Datum> forms{};
+    for (const auto& datum : datums) {
+        if (!datum) {
+            result.error = std::format("{}", datums.base().source_map().locate(datum.error()));
+            break;
+        }
+        forms.push_back(*datum);
+    }
+    if constexpr (requires { datums.base().stats(); }) result.stats = datums.base().stats();
+    result.forms = forms.size();
+
+    if (result.error.empty()) {
+        auto program = compiler::compile(forms);
+        if (!program) result.error = std::format("Error: {}", program.error().message);
+    }
+}
+
+// Lex, read and compile the program in path, without running it, its tokens from cache if given
+template <lexer::StatsPolicy Instrument>
+auto check_file(const std::filesystem::path& path, const token_cache::TokenCache* cache)
+    -> FileResult {
+    FileResult result{};
+    try {
+        io::mapped_file file{path};
+        std::string_view src{file.data(), file.size()};
+        result.bytes = src.size();
+        if (cache != nullptr) {
+            auto tokens = cache->tokens(src);
+            result.cached = tokens.from_cache();
+            check_tokens(std::move(tokens), result);
+        } else {
+            check_tokens(lexer::Lexer<std::string_view, symbol::NoInterning, Instrument>{src},
+                         result);
+        }
+    } catch (const std::system_error& err) {
+        result.error = std::format("Could not read source: {}", err.what());
+    } catch (const std::exception& err) {
+        // reported against this file alone, rather than ending the batch
+        result.error = std::format("Could not check source: {}", err.what());
+    }
+    return result;
+}
+
+// The files named by args, a directory standing for the .scm files under it in path order
+auto batch_paths(std::span<char*> args) -> std::vector<std::filesystem::path> {
+    std::vector<std::filesystem::path> paths{};
+    for (std::filesystem::path arg : args) {
+        if (!std::filesystem::is_directory(arg)) {
+            paths.push_back(std::move(arg));
+            continue;
+        }
+        auto first = paths.size();
+        for (const auto& entry : std::filesystem::recursive_directory_iterator{arg}) {
+            if (entry.is_regular_file() && entry.path().extension() == ".scm") {
+                paths.push_back(entry.path());
+            }
+        }
+        std::sort(paths.begin() + static_cast<std::ptrdiff_t>(first), paths.end());
+    }
+    return paths;
+}
+
+// Check every file on a work-stealing pool, one thread per core, then print a line per file in
+// the order of paths and the totals. The largest files are dealt out first, each a task of its
+// own, so that they run side by side and the small ones fill in around them.
+auto check_batch(std::span<const std::filesystem::path> paths, bool stats,
+                 const token_cache::TokenCache* cache) -> bool {
+    auto started = std::chrono::steady_clock::now();
+
+    std::vector<std::uintmax_t> sizes{};
+    for (const auto& path : paths) {
+        std::error_code err{};
+        auto size = std::filesystem::file_size(path, err);
+        sizes.push_back(err ? 0 : size);
+    }
+    std::vector<std::size_t> by_size(paths.size());
+    std::iota(by_size.begin(), by_size.end(), std::size_t{0});
+    std::ranges::stable_sort(by_size, std::greater{}, [&sizes](std::size_t i) { return sizes[i]; });
+
+    std::vector<std::vector<std::size_t>> tasks{};
+    std::uintmax_t task_bytes{0};
+    for (auto i : by_size) {
+        if (tasks.empty() || task_bytes + sizes[i] > batch_bytes) {
+            tasks.emplace_back();
+            task_bytes = 0;
+        }
+        tasks.back().push_back(i);
+        task_bytes += sizes[i];
+    }
+
+    std::vector<FileResult> results(paths.size());
+    auto threads = std::max(std::thread::hardware_concurrency(), 1U);
+    work::run_stealing(tasks.size(), threads, [&](std::size_t task) {
+        for (auto i : tasks[task]) {
+            results[i] = stats ? check_file<lexer::CollectStats>(paths[i], cache)
+                               : check_file<lexer::NoStats>(paths[i], cache);
+        }
+    });
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+
+    std::size_t failed{0};
+    std::size_t bytes{0};
+    std::size_t cached{0};
+    lexer::Stats total{};
+    for (std::size_t i = 0; i < paths.size(); i++) {
+        const auto& result = results[i];
+        if (result.error.empty()) {
+            std::println("{}: ok, {} forms", paths[i].string(), result.forms);
+        } else {
+            std::println("{}: {}", paths[i].string(), result.error);
+            failed++;
+        }
+        bytes += result.bytes;
+        cached += result.cached ? 1 : 0;
+        total += result.stats;
+    }
+    auto mebibytes = static_cast<double>(bytes) / (1024.0 * 1024.0);
+    std::println("{} files, {} failed, {} bytes in {:.1f} ms ({:.1f} MiB/s) on {} threads",
+                 paths.size(), failed, bytes, elapsed.count() * 1000.0,
+                 mebibytes / elapsed.count(), std::min<std::size_t>(threads, tasks.size()));
+    if (cache != nullptr) {
+        std::println("{} files from the token cache, {} lexed", cached, paths.size() - cached);
+    }
+    if (stats) std::println(stderr, "{}", lexer::format_stats(total));
+    return failed == 0;
+}
 
-        auto file = std::basic_ifstream<char>{std::filesystem::path{"test.txt"}};
-        auto testb = std::ranges::subrange{std::istreambuf_iterator<char>{file},
-                                                 std::istreambuf_iterator<char>{}};
+}  // namespace
 
-        for (const auto& it : testa | lexer::lex) {
-            if (it) std::println("{}", *it);
-            else std::println("{}", it.error());
+// lisp_interpreter [--tokens] [--stats | --cache=dir] [file]
+// Runs the program in file, "-" for stdin, and prints the value of its last form; without a file
+// runs the fib example below. With --tokens, lists the program's tokens instead. With --stats,
+// lexes the program at run time, the fib example too, and prints what lexing it took to stderr.
+//
+// lisp_interpreter [--stats | --cache=dir] path path...
+// Given several paths, or a directory, checks each file, or each .scm file under the directory,
+// on all cores: lexes, reads and compiles it without running it. Prints a line per file, in the
+// order given, then the totals, and fails if any file did.
+//
+// With --cache=dir, files are not lexed if dir holds their tokens from an earlier run; those that
+// are lexed have their tokens saved there. This leaves nothing for --stats to count.
+auto main(int argc, char** argv) -> int {
+    auto args = std::span{argv, static_cast<std::size_t>(argc)}.subspan(1);
+    bool tokens = false;
+    bool stats = false;
+    std::optional<std::filesystem::path> cache_directory{};
+    while (!args.empty() && std::string_view{args.front()}.starts_with("--")) {
+        std::string_view flag = args.front();
+        if (flag == "--tokens") {
+            tokens = true;
+        } else if (flag == "--stats") {
+            stats = true;
+        } else if (flag.starts_with("--cache=")) {
+            cache_directory = flag.substr(std::string_view{"--cache="}.size());
+        } else {
+            std::println(stderr, "Unknown option {}", flag);
+            return 1;
         }
+        args = args.subspan(1);
+    }
 
-        std::println("\n=== File test... ===\n");
-        
-        for (const auto& it : testb | lexer::lex) {
-            if (it) std::println("{}", *it);
-            else std::println("{}", it.error());
+    if (stats && cache_directory) {
+        std::println(stderr, "--stats counts lexing, which --cache skips");
+        return 1;
+    }
+
+    try {
+        std::optional<token_cache::TokenCache> cache{};
+        if (cache_directory) cache.emplace(*cache_directory);
+
+        if (args.size() > 1 || (args.size() == 1 && std::filesystem::is_directory(args.front()))) {
+            if (tokens) {
+                std::println(stderr, "--tokens lists the tokens of one file");
+                return 1;
+            }
+            return check_batch(batch_paths(args), stats, cache ? &*cache : nullptr) ? 0 : 1;
         }
+        if (args.empty()) {
+            if (stats) {
+                auto src = fib_example.source();
+                return list_or_run(InstrumentedLexer<std::string_view>{src}, tokens) ? 0 : 1;
+            }
+            return list_or_run(fib_example, tokens) ? 0 : 1;
+        }
+
+        // source file given on the command line, "-" for stdin
+        std::string_view path = args.front();
+        auto testb = path == "-" ? io::mapped_file{io::standard_input}
+                                 : io::mapped_file{std::filesystem::path{path}};
+        std::string_view src{testb.data(), testb.size()};
+        if (stats) return list_or_run(InstrumentedLexer<std::string_view>{src}, tokens) ? 0 : 1;
+        if (cache) return list_or_run(cache->tokens(src), tokens) ? 0 : 1;
+        return list_or_run(src | lexer::lex, tokens) ? 0 : 1;
 
+    } catch (const std::system_error& err) {
+        std::cerr << "Could not read source: " << err.what() << '\n';
+        return 1;
     } catch (...) {
         std::cerr << "Something went very wrong, please contact the developer.\n";
         return 1;
@@ -1,9 +1,58 @@
 #include <gtest/gtest.h>
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <ranges>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <variant>
+#include <vector>
 
+#include "arena.hpp"
+#include "buffered_source.hpp"
+#include "compiler.hpp"
+#include "form_index.hpp"
+#include "heap.hpp"
 #include "lexer.hpp"
+#include "lexer_automaton.hpp"
+#include "lexer_stats.hpp"
+#include "mapped_file.hpp"
+#include "match_char.hpp"
+#include "number.hpp"
+#include "parallel_lex.hpp"
+#include "reader.hpp"
+#include "relex.hpp"
+#include "simd_scan.hpp"
+#include "source_map.hpp"
+#include "static_lexer.hpp"
+#include "stream_lexer.hpp"
+#include "symbol_table.hpp"
 #include "token.hpp"
+#include "token_buffer.hpp"
+#include "token_cache.hpp"
+#include "utf8.hpp"
+#include "work_pool.hpp"
+#include "util.hpp"
+#include "vm.hpp"
 
 TEST(lexer_test, parentheses_pair) {
     std::string s{"()"};
@@ -33,18 +82,18 @@ TEST(lexer_test, simple_identifiers) {
     it++;
 
     EXPECT_TRUE(*it);    
-    EXPECT_TRUE(std::holds_alternative<token::Identifier>(**it));
-    EXPECT_STREQ(std::get<token::Identifier>(**it).lexeme.c_str(), "among");
+    EXPECT_TRUE(std::holds_alternative<token::IdentifierView>(**it));
+    EXPECT_EQ(std::get<token::IdentifierView>(**it).lexeme, "among");
     it++;
 
     EXPECT_TRUE(*it);    
-    EXPECT_TRUE(std::holds_alternative<token::Identifier>(**it));
-    EXPECT_STREQ(std::get<token::Identifier>(**it).lexeme.c_str(), "us");
+    EXPECT_TRUE(std::holds_alternative<token::IdentifierView>(**it));
+    EXPECT_EQ(std::get<token::IdentifierView>(**it).lexeme, "us");
     it++;
 
     EXPECT_TRUE(*it);    
-    EXPECT_TRUE(std::holds_alternative<token::Identifier>(**it));
-    EXPECT_STREQ(std::get<token::Identifier>(**it).lexeme.c_str(), "sussy");
+    EXPECT_TRUE(std::holds_alternative<token::IdentifierView>(**it));
+    EXPECT_EQ(std::get<token::IdentifierView>(**it).lexeme, "sussy");
     it++;
 
     EXPECT_TRUE(*it);
@@ -65,16 +114,16 @@ TEST(lexer_test, line_whitespace) {
     EXPECT_TRUE(std::holds_alternative<token::LParen>(**it));
     it++;
     
-    EXPECT_TRUE(std::holds_alternative<token::Identifier>(**it));
-    EXPECT_STREQ(std::get<token::Identifier>(**it).lexeme.c_str(), "among");
+    EXPECT_TRUE(std::holds_alternative<token::IdentifierView>(**it));
+    EXPECT_EQ(std::get<token::IdentifierView>(**it).lexeme, "among");
     it++;
 
-    EXPECT_TRUE(std::holds_alternative<token::Identifier>(**it));
-    EXPECT_STREQ(std::get<token::Identifier>(**it).lexeme.c_str(), "us");
+    EXPECT_TRUE(std::holds_alternative<token::IdentifierView>(**it));
+    EXPECT_EQ(std::get<token::IdentifierView>(**it).lexeme, "us");
     it++;
 
-    EXPECT_TRUE(std::holds_alternative<token::Identifier>(**it));
-    EXPECT_STREQ(std::get<token::Identifier>(**it).lexeme.c_str(), "sussy");
+    EXPECT_TRUE(std::holds_alternative<token::IdentifierView>(**it));
+    EXPECT_EQ(std::get<token::IdentifierView>(**it).lexeme, "sussy");
     it++;    
     
     EXPECT_TRUE(std::holds_alternative<token::RParen>(**it));
@@ -83,3 +132,1111 @@ TEST(lexer_test, line_whitespace) {
     EXPECT_TRUE(std::holds_alternative<token::Eof>(**it));
     EXPECT_TRUE(it == stream.end());    
 }
+
+TEST(lexer_test, line_breaks) {
+    // \r\n, \r and \n each end exactly one line, with or without a contiguous source
+    std::string s{"(\r\namong\r us\r\n sussy\n)\n"};
+    std::istringstream stream{s};
+    auto input_only = std::ranges::subrange{std::istreambuf_iterator<char>{stream},
+                                            std::istreambuf_iterator<char>{}};
+
+    auto lines = [](auto&& tokens) {
+        std::vector<uint_fast32_t> result{};
+        for (const auto& tok : tokens) {
+            result.push_back(tokens.source_map().locate(token::offset_of(*tok)).line_number);
+        }
+        return result;
+    };
+
+    std::vector<uint_fast32_t> expected{1, 2, 3, 4, 5, 6};
+    EXPECT_EQ(lines(s | lexer::lex), expected);
+    EXPECT_EQ(lines(input_only | lexer::lex), expected);
+}
+
+TEST(lexer_test, span_mode_identifiers) {
+    std::string_view s{"(among us)"};
+    auto stream = lexer::Lexer<std::string_view>{s};
+    auto it = stream.begin();
+
+    EXPECT_TRUE(std::holds_alternative<token::LParen>(**it));
+    it++;
+
+    EXPECT_TRUE(std::holds_alternative<token::IdentifierView>(**it));
+    EXPECT_EQ(std::get<token::IdentifierView>(**it).lexeme, "among");
+    EXPECT_EQ(std::get<token::IdentifierView>(**it).lexeme.data(), s.data() + 1);
+    it++;
+
+    EXPECT_TRUE(std::holds_alternative<token::IdentifierView>(**it));
+    EXPECT_EQ(std::get<token::IdentifierView>(**it).lexeme, "us");
+    EXPECT_EQ(std::get<token::IdentifierView>(**it).lexeme.data(), s.data() + 7);
+    it++;
+
+    EXPECT_TRUE(std::holds_alternative<token::RParen>(**it));
+}
+
+TEST(scan_test, kernels_agree_with_char_classes) {
+    // every byte value at every lane position, followed and preceded by a long matching run
+    for (unsigned byte = 0; byte < 256; byte++) {
+        for (std::size_t pos = 0; pos < 70; pos++) {
+            std::string ws(80, ' ');
+            ws[pos] = static_cast<char>(byte);
+            std::string ident(80, 'a');
+            ident[pos] = static_cast<char>(byte);
+
+            const char* ws_end = ws.data() + ws.size();
+            const char* ident_end = ident.data() + ident.size();
+            EXPECT_EQ(scan::skip_whitespace(ws.data(), ws_end),
+                      scan::scalar::skip_whitespace(ws.data(), ws_end));
+            EXPECT_EQ(scan::skip_subsequent(ident.data(), ident_end),
+                      scan::scalar::skip_subsequent(ident.data(), ident_end));
+            EXPECT_EQ(scan::find_line_break(ident.data(), ident_end),
+                      scan::scalar::find_line_break(ident.data(), ident_end));
+            if (pos < scan::structural_block_size) {
+                EXPECT_EQ(scan::classify_block(ws.data()), scan::scalar::classify_block(ws.data()));
+            }
+        }
+    }
+}
+
+TEST(lexer_test, bulk_scan_positions_match_char_by_char) {
+    std::string s{
+        "(define (fib-iter a b n)\n"
+        "                  (if (= n 0)\n\n"
+        "    \t  b\n"
+        "                      (fib-iter b (+ a b) (- n 1))))\n"
+        "        an-identifier-that-is-longer-than-one-vector-of-thirty-two-bytes x\n"};
+    auto bulk = lexer::Lexer<std::string_view>{s};
+    auto per_char = util::newline_normaliser_adapter(s) | lexer::lex;
+
+    // the indexed source map of the span lexer and the recorded one of the per-char lexer agree
+    auto it = per_char.begin();
+    for (const auto& tok : bulk) {
+        ASSERT_TRUE(it != per_char.end());
+        EXPECT_EQ(tok.has_value(), (*it).has_value());
+        if (tok && *it) {
+            EXPECT_EQ(token::offset_of(*tok), token::offset_of(**it));
+            EXPECT_EQ(bulk.source_map().locate(token::offset_of(*tok)),
+                      per_char.source_map().locate(token::offset_of(**it)));
+        }
+        it++;
+    }
+    EXPECT_TRUE(it == per_char.end());
+}
+
+TEST(lexer_test, buffered_source_matches_span_mode) {
+    using namespace std::string_literals;
+    // a NUL of the input reads as itself, not as the sentinel ending a block, and a block of 2, 3
+    // or 7 bytes starts at the second # of #e#x10
+    std::string s{
+        "(define (fib-iter a b n)\r\n    \t(if (= n #e#x10) b\r\r\n"
+        "  an-identifier-longer-than-some-blocks 1x #(1.5 -3/4) \xCE\xBB\xCE)\n"
+        "  with\0nul \0 .\0"s};
+    ASSERT_TRUE(s.ends_with("with\0nul \0 .\0"s));
+    auto describe = [](const auto& tok) -> std::string {
+        if (!tok) {
+            const auto& err = std::get<lexer::InvalidTokenError>(tok.error());
+            return std::format("error {} {}", err.offset, err.lexeme);
+        }
+        auto lexeme = std::visit(
+            [](const auto& t) -> std::string {
+                if constexpr (requires { t.lexeme; }) return std::string{t.lexeme};
+                else return {};
+            },
+            *tok);
+        return std::format("{} {} {}", tok->index(), token::offset_of(*tok), lexeme);
+    };
+    auto span = lexer::Lexer<std::string_view>{s};
+    std::vector<std::string> expected{};
+    std::vector<token::Location> locations{};
+    for (const auto& tok : span) {
+        expected.push_back(describe(tok));
+        if (tok) locations.push_back(span.source_map().locate(token::offset_of(*tok)));
+    }
+
+    // tokens and line breaks straddle block boundaries at every small block size
+    for (std::size_t block_size : {1, 2, 3, 5, 16, 1 << 16}) {
+        std::istringstream stream{s};
+        auto buffered = io::buffered_source{*stream.rdbuf(), block_size} | lexer::lex;
+        std::vector<std::string> tokens{};
+        std::vector<token::Location> buffered_locations{};
+        for (const auto& tok : buffered) {
+            tokens.push_back(describe(tok));
+            if (tok) {
+                buffered_locations.push_back(
+                    buffered.source_map().locate(token::offset_of(*tok)));
+            }
+        }
+        EXPECT_EQ(tokens, expected) << block_size;
+        EXPECT_EQ(buffered_locations, locations) << block_size;
+    }
+
+    // from a pipe, read as it comes
+    std::array<int, 2> fds{};
+    ASSERT_EQ(pipe(fds.data()), 0);
+    ASSERT_EQ(write(fds[1], s.data(), s.size()), static_cast<ssize_t>(s.size()));
+    close(fds[1]);
+    std::vector<std::string> piped{};
+    for (const auto& tok : io::buffered_source{fds[0], 7} | lexer::lex) {
+        piped.push_back(describe(tok));
+    }
+    close(fds[0]);
+    EXPECT_EQ(piped, expected);
+}
+
+TEST(automaton_test, transitions_follow_char_classes) {
+    using lexer_automaton::Action;
+    for (unsigned byte = 0; byte < 256; byte++) {
+        auto c = static_cast<char>(byte);
+        auto from_init = lexer_automaton::transition(lexer_automaton::init, c);
+        auto from_identifier = lexer_automaton::transition(lexer_automaton::identifier, c);
+        auto from_error = lexer_automaton::transition(lexer_automaton::error, c);
+
+        EXPECT_EQ(from_init.next == lexer_automaton::identifier,
+                  match_char::is_initial(c) || match_char::is_non_ascii(c));
+        EXPECT_EQ(from_identifier.action == Action::extend_lexeme, match_char::is_subsequent(c));
+        EXPECT_EQ(from_error.action == Action::emit_error, match_char::is_delimiter(c));
+    }
+}
+
+TEST(lexer_test, source_end_delimits_lexemes) {
+    for (std::string_view s : {"(among us", "(among 1x"}) {
+        auto tokens = lexer::Lexer<std::string_view>{s};
+        auto it = tokens.begin();
+        it++;
+        it++;
+        EXPECT_EQ((*it).has_value(), s.ends_with("us"));
+        EXPECT_EQ(*it ? token::offset_of(**it) : token::offset_of((*it).error()), 7);
+        it++;
+        ASSERT_TRUE(*it);
+        EXPECT_TRUE(std::holds_alternative<token::Eof>(**it));
+    }
+}
+
+TEST(number_test, parses_literals) {
+    using number::Rational;
+    using number::ValueView;
+    std::vector<std::pair<std::string_view, ValueView>> cases{
+        {"42", int64_t{42}},
+        {"-17", int64_t{-17}},
+        {"#x1F", int64_t{31}},
+        {"#b-101", int64_t{-5}},
+        {"#e#o17", int64_t{15}},
+        {"-6/4", Rational{-3, 2}},
+        {"4/2", int64_t{2}},
+        {"1.5", 1.5},
+        {"-.5e1", -5.0},
+        {"#i1/4", 0.25},
+        {"#e1.25", Rational{5, 4}},
+        {"#e1e3", int64_t{1000}},
+        {"-9223372036854775808", std::numeric_limits<int64_t>::min()},
+        {"9223372036854775808", number::BasicBig<std::string_view>{"9223372036854775808"}},
+        {"#e1.5e-9223372036854775808",
+         number::BasicBig<std::string_view>{"#e1.5e-9223372036854775808"}},
+        {"#e1e9223372036854775807", number::BasicBig<std::string_view>{"#e1e9223372036854775807"}},
+        {"#e0e-9223372036854775808", int64_t{0}},
+        {"+inf.0", std::numeric_limits<double>::infinity()},
+    };
+    for (const auto& [text, expected] : cases) {
+        auto value = number::parse(text);
+        ASSERT_TRUE(value) << text;
+        EXPECT_EQ(*value, expected) << text;
+        EXPECT_TRUE(number::is_literal(text)) << text;
+    }
+
+    for (std::string_view text : {"+", "...", "1/0", "#x1.5", "1e", "#e+inf.0", "#x#b1", "#t"}) {
+        EXPECT_FALSE(number::parse(text)) << text;
+        EXPECT_FALSE(number::is_literal(text)) << text;
+    }
+}
+
+TEST(lexer_test, numbers_and_peculiar_identifiers) {
+    std::string s{"(- n 1) (+ .5 ... -x 1x)"};
+    std::vector<std::string_view> identifiers{};
+    std::vector<number::Value> numbers{};
+    std::vector<std::string> errors{};
+    // owning mode: big numbers keep their text as std::string
+    std::istringstream stream{s};
+    for (const auto& tok : std::ranges::subrange{std::istreambuf_iterator<char>{stream},
+                                                 std::istreambuf_iterator<char>{}} |
+                               lexer::lex) {
+        if (!tok) {
+            errors.push_back(std::get<lexer::InvalidTokenError>(tok.error()).lexeme);
+        } else if (const auto* num = std::get_if<token::Number>(&*tok)) {
+            numbers.push_back(num->value);
+        }
+    }
+    for (const auto& tok : s | lexer::lex) {
+        if (tok && std::holds_alternative<token::IdentifierView>(*tok)) {
+            identifiers.push_back(std::get<token::IdentifierView>(*tok).lexeme);
+        }
+    }
+
+    EXPECT_EQ(identifiers, (std::vector<std::string_view>{"-", "n", "+", "...", "-x"}));
+    EXPECT_EQ(numbers, (std::vector<number::Value>{int64_t{1}, 0.5}));
+    EXPECT_EQ(errors, std::vector<std::string>{"1x"});
+}
+
+TEST(lexer_test, numbers_go_on_past_a_hash) {
+    // a # continues a number but not an identifier, so a run of identifier chars cannot be
+    // skipped from it
+    std::string s{"(f #e#x10 #x#e10 1#) #e#x10"};
+    std::vector<number::ValueView> span_numbers{};
+    std::vector<std::string> span_errors{};
+    for (const auto& tok : s | lexer::lex) {
+        if (!tok) {
+            span_errors.push_back(std::get<lexer::InvalidTokenError>(tok.error()).lexeme);
+        } else if (const auto* num = std::get_if<token::NumberView>(&*tok)) {
+            span_numbers.push_back(num->value);
+        }
+    }
+    EXPECT_EQ(span_numbers, (std::vector<number::ValueView>(3, int64_t{16})));
+    EXPECT_EQ(span_errors, std::vector<std::string>{"1#"});
+
+    std::vector<number::Value> owned_numbers{};
+    std::vector<std::string> owned_errors{};
+    std::istringstream stream{s};
+    for (const auto& tok : std::ranges::subrange{std::istreambuf_iterator<char>{stream},
+                                                 std::istreambuf_iterator<char>{}} |
+                               lexer::lex) {
+        if (!tok) {
+            owned_errors.push_back(std::get<lexer::InvalidTokenError>(tok.error()).lexeme);
+        } else if (const auto* num = std::get_if<token::Number>(&*tok)) {
+            owned_numbers.push_back(num->value);
+        }
+    }
+    EXPECT_EQ(owned_numbers, (std::vector<number::Value>(3, int64_t{16})));
+    EXPECT_EQ(owned_errors, std::vector<std::string>{"1#"});
+}
+
+TEST(lexer_test, utf8_identifiers) {
+    // λ, x→y, -λ and 日本 are identifiers; an overlong '/', a truncated λ and 1λ are not
+    std::string s{
+        "(\xCE\xBB x\xE2\x86\x92y -\xCE\xBB)\n"
+        "  \xE6\x97\xA5\xE6\x9C\xAC \xC0\xAF \xCE z 1\xCE\xBB"};
+    std::vector<std::string> identifiers{};
+    std::vector<std::string> errors{};
+    std::vector<token::Location> locations{};
+    auto tokens = s | lexer::lex;
+    for (const auto& tok : tokens) {
+        if (!tok) {
+            errors.push_back(std::get<lexer::InvalidTokenError>(tok.error()).lexeme);
+        } else if (const auto* id = std::get_if<token::IdentifierView>(&*tok)) {
+            identifiers.emplace_back(id->lexeme);
+            locations.push_back(tokens.source_map().locate(id->offset));
+        }
+    }
+
+    EXPECT_EQ(identifiers, (std::vector<std::string>{"\xCE\xBB", "x\xE2\x86\x92y", "-\xCE\xBB",
+                                                     "\xE6\x97\xA5\xE6\x9C\xAC", "z"}));
+    EXPECT_EQ(errors, (std::vector<std::string>{"\xC0\xAF", "\xCE", "1\xCE\xBB"}));
+    // columns count code points
+    EXPECT_EQ(locations, (std::vector<token::Location>{{1, 2}, {1, 4}, {1, 8}, {2, 3}, {2, 10}}));
+
+    // owning mode records the continuation bytes for the same columns
+    std::istringstream stream{s};
+    auto owned = std::ranges::subrange{std::istreambuf_iterator<char>{stream},
+                                       std::istreambuf_iterator<char>{}} |
+                 lexer::lex;
+    std::vector<token::Location> owned_locations{};
+    for (const auto& tok : owned) {
+        if (tok && std::holds_alternative<token::Identifier>(*tok)) {
+            owned_locations.push_back(owned.source_map().locate(token::offset_of(*tok)));
+        }
+    }
+    EXPECT_EQ(owned_locations, locations);
+}
+
+TEST(lexer_test, collects_stats) {
+    std::string s{"(a 12 #q . 1x)\n"};
+    auto count = [](const lexer::Stats& stats, token::Kind kind) {
+        return stats.tokens[static_cast<std::size_t>(kind)];
+    };
+    auto check = [&](const lexer::Stats& stats) {
+        EXPECT_EQ(stats.bytes, s.size());
+        EXPECT_EQ(stats.token_count(), 8);
+        EXPECT_EQ(count(stats, token::Kind::lparen), 1);
+        EXPECT_EQ(count(stats, token::Kind::identifier), 1);
+        EXPECT_EQ(count(stats, token::Kind::number), 1);
+        EXPECT_EQ(count(stats, token::Kind::dot), 1);
+        EXPECT_EQ(count(stats, token::Kind::eof), 1);
+        // #q and 1x
+        EXPECT_EQ(stats.resynchronisations(), 2);
+        EXPECT_EQ(stats.resynchronised_bytes, 4);
+        EXPECT_GT(stats.steps[lexer_automaton::hash_prefix], 0);
+        EXPECT_GE(stats.steps[lexer_automaton::init], 8);
+    };
+
+    auto tokens = lexer::Lexer<std::string_view, symbol::NoInterning, lexer::CollectStats>{s};
+    EXPECT_EQ(std::ranges::distance(tokens), 8);
+    check(tokens.stats());
+
+    // a stream advances through the input one byte at a time, which is timed on its own
+    std::istringstream stream{s};
+    using Stream = std::ranges::subrange<std::istreambuf_iterator<char>>;
+    auto streamed = lexer::Lexer<Stream, symbol::NoInterning, lexer::CollectStats>{
+        Stream{std::istreambuf_iterator<char>{stream}, std::istreambuf_iterator<char>{}}};
+    EXPECT_EQ(std::ranges::distance(streamed), 8);
+    check(streamed.stats());
+    EXPECT_LE(streamed.stats().input, streamed.stats().lexing);
+    EXPECT_EQ(tokens.stats().steps, streamed.stats().steps);
+}
+
+TEST(utf8_test, validates_and_counts) {
+    std::string s(100, 'a');
+    s += "\xCE\xBB\xE2\x86\x92\xF0\x9F\x98\x80";
+    s += std::string(40, 'b');
+    EXPECT_TRUE(utf8::is_valid(s));
+    EXPECT_EQ(utf8::count_code_points(s), 143);
+    // the first bad byte is found past vectors of ASCII
+    auto bad = s + "\xF0\x9F\x98";
+    EXPECT_EQ(utf8::validate(bad.data(), bad.data() + bad.size()), bad.data() + s.size());
+    EXPECT_EQ(scan::skip_ascii(s.data(), s.data() + s.size()), s.data() + 100);
+}
+
+TEST(lexer_test, vector_open_and_dot) {
+    std::vector<std::string> texts{};
+    for (const auto& tok : std::string_view{"#(1 #x2) (a . .b) #( #"} | lexer::lex) {
+        texts.push_back(tok ? token::text_of(*tok)
+                            : std::get<lexer::InvalidTokenError>(tok.error()).lexeme);
+    }
+    EXPECT_EQ(texts, (std::vector<std::string>{"#(", "1", "2", ")", "(", "a", ".", ".b", ")", "#(",
+                                               "#", "EOF"}));
+}
+
+TEST(stream_lexer_test, chunks_split_anywhere_lex_like_whole_source) {
+    std::vector<std::string> inputs{
+        "(among us sussy)",
+        "(\r\namong\r us\r\n sussy\n)\n",
+        "(define (fib-iter a b n)\n  (if (= n 0)\n\n    \t  b\n      (fib-iter b (+ a b) (- n 1))))",
+        "(- n 1) (+ .5 ... -x 1x) #e1.5 123456789012345678901234567890",
+        "(define (f x)\n  (+ x 1.5 #t))\r\n",
+        "#(1 #x2 #) (a . b) . #",
+        "(\xCE\xBB x\xE2\x86\x92y -\xCE\xBB)\n  \xE6\x97\xA5\xE6\x9C\xAC \xC0\xAF \xCE z 1\xCE\xBB",
+    };
+
+    // a token and where it is, as text
+    auto describe = [](const auto& tok, const lexer::SourceMap& source_map) {
+        auto location = source_map.locate(tok ? token::offset_of(*tok)
+                                              : token::offset_of(tok.error()));
+        auto text = tok ? token::text_of(*tok)
+                        : std::get<lexer::InvalidTokenError>(tok.error()).lexeme;
+        return std::format("{} {} {}:{}", tok.has_value(), text, location.line_number,
+                           location.col_number);
+    };
+
+    for (const auto& s : inputs) {
+        std::vector<std::string> expected{};
+        auto whole = lexer::Lexer<std::string_view>{s};
+        for (const auto& tok : whole) expected.push_back(describe(tok, whole.source_map()));
+
+        auto lex_in_chunks = [&s, &describe](std::span<const std::size_t> cuts) {
+            std::vector<std::string> tokens{};
+            const lexer::SourceMap* source_map{nullptr};
+            lexer::StreamLexer stream{[&](const lexer::StreamResult& tok) {
+                tokens.push_back(describe(tok, *source_map));
+            }};
+            source_map = &stream.source_map();
+
+            std::size_t from{0};
+            for (auto cut : cuts) {
+                stream.feed(std::span{s}.subspan(from, cut - from));
+                from = cut;
+            }
+            stream.feed(std::span{s}.subspan(from));
+            stream.finish();
+            return tokens;
+        };
+
+        for (std::size_t cut = 0; cut <= s.size(); cut++) {
+            std::array<std::size_t, 1> cuts{cut};
+            EXPECT_EQ(lex_in_chunks(cuts), expected) << s << " cut at " << cut;
+        }
+        std::vector<std::size_t> every_byte(s.size());
+        std::iota(every_byte.begin(), every_byte.end(), std::size_t{0});
+        EXPECT_EQ(lex_in_chunks(every_byte), expected) << s;
+    }
+}
+
+TEST(source_map_test, locates_offsets) {
+    // \r\n, \r and \n each end one line; columns count bytes from 1
+    std::string_view s{"ab\r\ncd\re\n\nf"};
+    lexer::SourceMap map{s};
+
+    EXPECT_EQ(map.line_count(), 5);
+    EXPECT_EQ(map.locate(0), (token::Location{1, 1}));
+    EXPECT_EQ(map.locate(1), (token::Location{1, 2}));
+    EXPECT_EQ(map.locate(4), (token::Location{2, 1}));
+    EXPECT_EQ(map.locate(7), (token::Location{3, 1}));
+    EXPECT_EQ(map.locate(9), (token::Location{4, 1}));
+    EXPECT_EQ(map.locate(10), (token::Location{5, 1}));
+
+    auto tokens = std::string_view{"(among\n  us)"} | lexer::lex;
+    std::vector<std::string> formatted{};
+    for (const auto& tok : tokens) {
+        formatted.push_back(std::format("{}", tokens.source_map().locate(*tok)));
+    }
+    EXPECT_EQ(formatted[2], "['us', line: 2, column: 3]");
+}
+
+TEST(mapped_file_test, maps_regular_files) {
+    auto path = std::filesystem::temp_directory_path() / "alenvers_mapped_file_test.scm";
+    std::ofstream{path} << "(among us)";
+
+    auto file = io::mapped_file{path};
+    EXPECT_TRUE(file.is_mapped());
+    EXPECT_EQ(std::string_view(file.data(), file.size()), "(among us)");
+
+    auto stream = file | lexer::lex;
+    auto it = stream.begin();
+    EXPECT_TRUE(std::holds_alternative<token::LParen>(**it));
+    it++;
+    EXPECT_EQ(std::get<token::IdentifierView>(**it).lexeme, "among");
+
+    std::filesystem::remove(path);
+}
+
+TEST(mapped_file_test, maps_from_the_current_offset) {
+    auto path = std::filesystem::temp_directory_path() / "alenvers_mapped_file_offset_test.scm";
+    std::string contents(10000, ' ');
+    contents.replace(5000, 7, "(sussy)");
+    std::ofstream{path} << contents;
+
+    // an offset past the first page, and not on a page boundary
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);  // NOLINT
+    ASSERT_NE(fd, -1);
+    ASSERT_EQ(lseek(fd, 4999, SEEK_SET), 4999);
+    auto file = io::mapped_file{fd};
+    EXPECT_EQ(lseek(fd, 0, SEEK_CUR), 10000);
+    close(fd);
+    EXPECT_TRUE(file.is_mapped());
+    EXPECT_EQ(std::string_view(file.data(), file.size()), std::string_view{contents}.substr(4999));
+
+    std::filesystem::remove(path);
+}
+
+TEST(mapped_file_test, reads_pipes_into_buffer) {
+    std::array<int, 2> fds{};
+    ASSERT_EQ(pipe(fds.data()), 0);
+    std::string_view src{"(sussy)"};
+    ASSERT_EQ(write(fds[1], src.data(), src.size()), static_cast<ssize_t>(src.size()));
+    close(fds[1]);
+
+    auto file = io::mapped_file{fds[0]};
+    close(fds[0]);
+    EXPECT_FALSE(file.is_mapped());
+    EXPECT_EQ(std::string_view(file.data(), file.size()), src);
+
+    auto moved = std::move(file);
+    EXPECT_EQ(std::string_view(moved.data(), moved.size()), src);
+}
+
+TEST(token_cache_test, loads_entries_and_rebuilds_bad_ones) {
+    auto directory = std::filesystem::temp_directory_path() / "alenvers_token_cache_test";
+    std::filesystem::remove_all(directory);
+    token_cache::TokenCache cache{directory};
+    std::string s{"(define (f x) (f x 1.5 #q))\n#(x f)"};
+
+    EXPECT_FALSE(cache.tokens(s).from_cache());
+    auto loaded = cache.tokens(s);
+    EXPECT_TRUE(loaded.from_cache());
+
+    // the tokens of tokenize_all, with each name stored once
+    auto buffer = lexer::tokenize_all(s);
+    EXPECT_TRUE(std::ranges::equal(loaded.kinds(), buffer.kinds()));
+    EXPECT_TRUE(std::ranges::equal(loaded.offsets(), buffer.offsets()));
+    EXPECT_EQ(loaded.name_count(), 3);
+    std::vector<std::string> lexemes{};
+    for (const auto& tok : loaded) {
+        if (!tok) {
+            lexemes.push_back(std::get<lexer::InvalidTokenError>(tok.error()).lexeme);
+        } else if (const auto* id = std::get_if<token::IdentifierView>(&*tok)) {
+            lexemes.emplace_back(id->lexeme);
+        } else if (const auto* n = std::get_if<token::NumberView>(&*tok)) {
+            EXPECT_EQ(n->value, number::ValueView{1.5});
+        }
+    }
+    EXPECT_EQ(lexemes, (std::vector<std::string>{"define", "f", "x", "f", "x", "#q", "x", "f"}));
+
+    symbol::SymbolTable symbols{};
+    symbols.intern("x");
+    loaded.intern_into(symbols);
+    auto define = std::next(loaded.begin());
+    EXPECT_EQ(std::get<token::IdentifierView>(**define).symbol_id, symbols.find("define"));
+
+    // a corrupt entry is rebuilt, as is a truncated one
+    auto path = cache.entry_path(token_cache::content_hash(s));
+    {
+        std::fstream entry{path, std::ios::in | std::ios::out | std::ios::binary};
+        entry.seekp(-1, std::ios::end);
+        entry.put('?');
+    }
+    EXPECT_FALSE(cache.load(s));
+    EXPECT_FALSE(cache.tokens(s).from_cache());
+    EXPECT_TRUE(cache.tokens(s).from_cache());
+    std::filesystem::resize_file(path, 40);
+    EXPECT_FALSE(cache.load(s));
+
+    // so is a whole entry, hashes and all, with a token the source does not have
+    auto forge = [&](token::Kind kind, uint32_t payload) {
+        auto bytes = token_cache::serialise(s, token_cache::content_hash(s));
+        token_cache::detail::Header header{};
+        std::memcpy(&header, bytes.data(), sizeof(header));
+        char* body = bytes.data() + sizeof(header);
+        std::size_t tokens = header.token_count;
+        const char* kinds = body + (2 * tokens + header.name_count + 1) * sizeof(uint32_t);
+        const char* found = std::find(kinds, kinds + tokens, static_cast<char>(kind));
+        auto i = static_cast<std::size_t>(found - kinds);
+        std::memcpy(body + (tokens + i) * sizeof(uint32_t), &payload, sizeof(payload));
+        header.body_hash = token_cache::content_hash({body, bytes.size() - sizeof(header)});
+        std::memcpy(bytes.data(), &header, sizeof(header));
+        std::ofstream{path, std::ios::binary | std::ios::trunc}.write(
+            bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    };
+    forge(token::Kind::identifier, 2);
+    EXPECT_TRUE(cache.load(s));
+    forge(token::Kind::identifier, 3);
+    EXPECT_FALSE(cache.load(s));
+    forge(token::Kind::number, static_cast<uint32_t>(s.size()));
+    EXPECT_FALSE(cache.load(s));
+    forge(token::Kind::number, 4);
+    EXPECT_FALSE(cache.load(s));
+    EXPECT_FALSE(cache.tokens(s).from_cache());
+    EXPECT_TRUE(cache.tokens(s).from_cache());
+
+    // a changed source has an entry of its own
+    EXPECT_FALSE(cache.tokens(s + " y").from_cache());
+    EXPECT_TRUE(cache.tokens(s + " y").from_cache());
+    std::filesystem::remove_all(directory);
+}
+
+TEST(symbol_test, lexer_interns_identifiers) {
+    symbol::SymbolTable symbols{};
+    std::string s{"(define x define y x)"};
+
+    std::vector<token::IdentifierView> identifiers{};
+    for (const auto& tok : s | lexer::lex(symbols)) {
+        if (tok && std::holds_alternative<token::IdentifierView>(*tok)) {
+            identifiers.push_back(std::get<token::IdentifierView>(*tok));
+        }
+    }
+
+    ASSERT_EQ(identifiers.size(), 5);
+    EXPECT_EQ(symbols.size(), 3);
+    EXPECT_TRUE(token::same_symbol(identifiers[0], identifiers[2]));
+    EXPECT_TRUE(token::same_symbol(identifiers[1], identifiers[4]));
+    EXPECT_FALSE(token::same_symbol(identifiers[1], identifiers[3]));
+    EXPECT_EQ(symbols.name(identifiers[3].symbol_id), "y");
+    EXPECT_EQ(symbols.find("define"), identifiers[0].symbol_id);
+    EXPECT_EQ(symbols.find("lambda"), symbol::no_symbol);
+}
+
+TEST(symbol_test, ids_are_stable_across_growth) {
+    symbol::SymbolTable symbols{};
+    std::vector<symbol::Id> ids{};
+    for (int i = 0; i < 10000; i++) ids.push_back(symbols.intern(std::format("sym-{}", i)));
+    for (int i = 0; i < 10000; i++) {
+        EXPECT_EQ(symbols.intern(std::format("sym-{}", i)), ids[i]);
+        EXPECT_EQ(symbols.name(ids[i]), std::format("sym-{}", i));
+    }
+}
+
+TEST(symbol_test, shared_table_agrees_across_threads) {
+    symbol::SharedSymbolTable symbols{};
+    constexpr int thread_count = 4;
+    constexpr int name_count = 2000;
+    std::vector<std::vector<symbol::Id>> ids(thread_count);
+
+    {
+        std::vector<std::jthread> threads{};
+        for (int t = 0; t < thread_count; t++) {
+            threads.emplace_back([&symbols, &ids, t] {
+                for (int i = 0; i < name_count; i++) {
+                    ids[t].push_back(symbols.intern(std::format("sym-{}", i)));
+                }
+            });
+        }
+    }
+
+    EXPECT_EQ(symbols.size(), name_count);
+    for (int t = 1; t < thread_count; t++) EXPECT_EQ(ids[t], ids[0]);
+    for (int i = 0; i < name_count; i++) {
+        EXPECT_EQ(symbols.name(ids[0][i]), std::format("sym-{}", i));
+    }
+}
+
+TEST(token_buffer_test, tokenize_all) {
+    std::string s{"(among us)\n(sus 1)"};
+    auto buffer = lexer::tokenize_all(s);
+
+    using token::Kind;
+    std::vector<Kind> kinds{Kind::lparen,     Kind::identifier, Kind::identifier, Kind::rparen,
+                            Kind::lparen,     Kind::identifier, Kind::number,     Kind::rparen,
+                            Kind::eof};
+    ASSERT_TRUE(std::ranges::equal(buffer.kinds(), kinds));
+
+    std::vector<uint32_t> offsets{0, 1, 7, 9, 11, 12, 16, 17, 18};
+    EXPECT_TRUE(std::ranges::equal(buffer.offsets(), offsets));
+
+    EXPECT_EQ(buffer.lexeme(1), "among");
+    EXPECT_EQ(buffer.lexeme(2), "us");
+    EXPECT_EQ(buffer.lexeme(6), "1");
+    EXPECT_EQ(std::get<int64_t>(buffer.number_value(6)), 1);
+    EXPECT_EQ(buffer.lexeme(7), ")");
+
+    // the reservation made while lexing is given back
+    EXPECT_EQ(buffer.memory_usage(), buffer.size() * 9);
+}
+
+TEST(token_buffer_test, tokenize_all_interned) {
+    symbol::SymbolTable symbols{};
+    std::string s{"(among us among)"};
+    auto buffer = lexer::tokenize_all(s, symbols);
+
+    ASSERT_EQ(buffer.size(), 6);
+    EXPECT_TRUE(buffer.interned());
+    EXPECT_EQ(buffer.symbol(1), buffer.symbol(3));
+    EXPECT_NE(buffer.symbol(1), buffer.symbol(2));
+    EXPECT_EQ(symbols.name(buffer.symbol(2)), "us");
+}
+
+TEST(static_lexer_test, matches_runtime_lexer) {
+    using namespace lexer::literals;
+    constexpr auto tokens = "(define (f x)\n  (+ x -1/2 #x1F 1e3)) #(a . ...) -> #e1.5"_scm;
+    static_assert("(\xCE\xBB -\xCE\xBB)"_scm.refs()[2].kind == token::Kind::identifier);
+    static_assert(tokens.refs().size() == 22);
+    static_assert(tokens.refs()[9].kind == token::Kind::number && tokens.refs()[9].payload == 4);
+
+    auto expected = lexer::tokenize_all(tokens.source());
+    EXPECT_TRUE(std::ranges::equal(tokens.refs(), std::views::iota(0UZ, expected.size()), {},
+                                   [](const token::TokenRef& tok) {
+                                       return std::tuple{tok.kind, tok.offset, tok.payload};
+                                   },
+                                   [&expected](std::size_t i) {
+                                       auto tok = expected[i];
+                                       return std::tuple{tok.kind, tok.offset, tok.payload};
+                                   }));
+
+    auto runtime = tokens.source() | lexer::lex;
+    EXPECT_TRUE(std::ranges::equal(tokens, runtime, [](const auto& a, const auto& b) {
+        return a.has_value() && b.has_value() && a->index() == b->index() &&
+               token::offset_of(*a) == token::offset_of(*b);
+    }));
+}
+
+TEST(static_lexer_test, reads_static_tokens) {
+    using namespace lexer::literals;
+    arena::Arena arena{};
+    auto datums = "(a (b . c) 1.5) #(1 2)"_scm | reader::read(arena);
+    std::vector<std::string> texts{};
+    for (const auto& datum : datums) {
+        ASSERT_TRUE(datum);
+        texts.push_back(reader::write(*datum));
+    }
+    EXPECT_EQ(texts, (std::vector<std::string>{"(a (b . c) 1.5)", "#(1 2)"}));
+}
+
+TEST(parallel_lex_test, chunks_stitch_to_sequential_tokens) {
+    std::string s{};
+    for (int i = 0; i < 200; i++) s += std::format("(define (f{} x)\n  (+ x 1.5 #t))\r\n", i);
+    auto expected = lexer::tokenize_all(s);
+
+    auto same_tokens = [&expected](const token::TokenBuffer& buffer) {
+        return std::ranges::equal(buffer.kinds(), expected.kinds()) &&
+               std::ranges::equal(buffer.offsets(), expected.offsets()) &&
+               std::ranges::equal(buffer.payloads(), expected.payloads());
+    };
+
+    // cuts after whitespace, as parallel_lex makes them
+    token::TokenBuffer whitespace_cuts{s};
+    lexer::detail::tokenize_chunks<symbol::NoInterning>(
+        whitespace_cuts, lexer::detail::chunk_bounds(s, 7), nullptr);
+    EXPECT_TRUE(same_tokens(whitespace_cuts));
+
+    // cuts inside identifiers, errors and whitespace runs, and empty chunks, must resynchronise
+    for (std::size_t step : {3UL, 5UL, 17UL, 1000UL}) {
+        std::vector<std::size_t> bounds{};
+        for (std::size_t cut = 0; cut < s.size(); cut += step) bounds.push_back(cut);
+        bounds.push_back(s.size());
+        bounds.push_back(s.size());
+        token::TokenBuffer buffer{s};
+        lexer::detail::tokenize_chunks<symbol::NoInterning>(buffer, bounds, nullptr);
+        EXPECT_TRUE(same_tokens(buffer)) << "chunks of " << step << " bytes";
+    }
+}
+
+TEST(parallel_lex_test, interns_into_shared_table) {
+    symbol::SharedSymbolTable symbols{};
+    std::string s{"(among us among)"};
+    auto buffer = lexer::parallel_lex(s, symbols, 4);
+
+    ASSERT_EQ(buffer.size(), 6);
+    EXPECT_TRUE(buffer.interned());
+    EXPECT_EQ(buffer.symbol(1), buffer.symbol(3));
+    EXPECT_EQ(symbols.name(buffer.symbol(2)), "us");
+    EXPECT_EQ(buffer.kind(5), token::Kind::eof);
+}
+
+TEST(work_pool_test, runs_every_task_once) {
+    // a few slow tasks first, as a batch deals them, then many quick ones to steal
+    constexpr std::size_t count = 1000;
+    std::vector<std::atomic<int>> runs(count);
+    std::atomic<std::size_t> busy_work{0};
+    work::run_stealing(count, 8, [&](std::size_t i) {
+        std::size_t spins = i < 4 ? 200000 : 10;
+        for (std::size_t j = 0; j < spins; j++) busy_work.fetch_add(1, std::memory_order_relaxed);
+        runs[i]++;
+    });
+    EXPECT_TRUE(std::ranges::all_of(runs, [](const auto& n) { return n == 1; }));
+
+    std::size_t serial{0};
+    work::run_stealing(count, 1, [&serial](std::size_t /*i*/) { serial++; });
+    EXPECT_EQ(serial, count);
+    work::run_stealing(0, 8, [](std::size_t /*i*/) { FAIL(); });
+
+    EXPECT_THROW(work::run_stealing(count, 4,
+                                    [](std::size_t i) {
+                                        if (i == 500) throw std::runtime_error{"task failed"};
+                                    }),
+                 std::runtime_error);
+}
+
+TEST(relex_test, matches_lexing_from_scratch) {
+    std::string s{};
+    for (int i = 0; i < 50; i++) s += std::format("(define (f{} x)\n  (+ x 1 #t))\n", i);
+
+    struct Case {
+        uint32_t offset;
+        uint32_t removed;
+        std::string_view inserted;
+    };
+    std::vector<Case> cases{
+        {0, 0, "x"},         {0, 1, ""},     {1, 0, "re"},   {3, 2, " "},
+        {7, 1, ")"},         {14, 0, "\r"},  {20, 5, "a b"}, {100, 300, "(z"},
+        {static_cast<uint32_t>(s.size()), 0, " tail"}, {0, static_cast<uint32_t>(s.size()), "()"},
+    };
+    for (const auto& [offset, removed, inserted] : cases) {
+        auto tokens = lexer::tokenize_all(s);
+        std::string edited = s;
+        edited.replace(offset, removed, inserted);
+
+        auto relexed = lexer::relex(
+            tokens,
+            lexer::Edit{offset, removed, static_cast<uint32_t>(inserted.size())},
+            edited);
+        auto expected = lexer::tokenize_all(edited);
+        EXPECT_TRUE(std::ranges::equal(tokens.kinds(), expected.kinds())) << offset;
+        EXPECT_TRUE(std::ranges::equal(tokens.offsets(), expected.offsets())) << offset;
+        EXPECT_TRUE(std::ranges::equal(tokens.payloads(), expected.payloads())) << offset;
+        EXPECT_EQ(tokens.source(), edited);
+        if (removed < 10) {
+            EXPECT_LT(relexed.new_count, 10) << offset;
+        }
+    }
+}
+
+TEST(relex_test, lexer_resumes_inside_a_lexeme) {
+    std::string_view s{"(among us)"};
+    auto tokens = lexer::Lexer<std::string_view>{s};
+    auto it = tokens.begin_at(
+        lexer::Checkpoint{.offset = 3, .lexeme_offset = 1, .state{lexer::IdentifierState{}}});
+
+    ASSERT_TRUE((*it).has_value());
+    EXPECT_EQ(std::get<token::IdentifierView>(**it).lexeme, "among");
+    EXPECT_EQ(std::get<token::IdentifierView>(**it).offset, 1);
+}
+
+TEST(form_index_test, spans_top_level_forms) {
+    std::vector<std::string_view> forms{
+        "(define s \"a (string) with ; and \\\" in it, longer than a block of sixty-four\")",
+        "(display #\\( #\\) #\\\\)",
+        "top-level-atom",
+        "#(1 2)",
+        "'x",
+        "\"top ) string\"",
+        "#\\;",
+        "(f)",
+        "(s \")))) a string with parens only, running on past one block ((((((\")",
+        "(g)",
+        ")",
+        "tail",
+        "(unclosed (list\n"};
+    std::string body = std::format(
+        "{}   \n; a comment with ( and \" in it\r\n{}\t{} {} {}\r\n{}\n{} {}\n"
+        "{}\n  ;; (\n{}{} {}\n\n; (another \"\r\n{}",
+        forms[0], forms[1], forms[2], forms[3], forms[4], forms[5], forms[6], forms[7], forms[8],
+        forms[9], forms[10], forms[11], forms[12]);
+
+    // shifted across the block boundaries, and the vector kernels the scalar one
+    for (std::size_t shift = 0; shift < 2 * scan::structural_block_size; shift++) {
+        std::string s = std::string(shift, ' ') + body;
+        lexer::FormIndex index{s};
+        ASSERT_EQ(index.size(), forms.size()) << "shifted by " << shift;
+        for (std::size_t n = 0; n < forms.size(); n++) {
+            EXPECT_EQ(index[n], forms[n]) << "shifted by " << shift;
+            EXPECT_EQ(s.substr(index.offset(n), forms[n].size()), forms[n]);
+        }
+    }
+    EXPECT_TRUE(lexer::FormIndex{" ; only a comment\n \t"}.empty());
+}
+
+TEST(form_index_test, forms_lex_and_read_on_their_own) {
+    std::string s{};
+    for (int i = 0; i < 200; i++) s += std::format("(define (f{} x)\n  (g x 1.5 -3/6))\r\n", i);
+    lexer::FormIndex index{s};
+    ASSERT_EQ(index.size(), 200U);
+
+    // the tokens of each form, moved by its offset, are those of the whole source
+    auto whole = lexer::tokenize_all(s);
+    std::vector<uint32_t> offsets{};
+    for (std::size_t n = 0; n < index.size(); n++) {
+        for (const auto& tok : index[n] | lexer::lex) {
+            ASSERT_TRUE(tok);
+            if (!std::holds_alternative<token::Eof>(*tok)) {
+                offsets.push_back(index.offset(n) + token::offset_of(*tok));
+            }
+        }
+    }
+    offsets.push_back(static_cast<uint32_t>(s.size()));
+    EXPECT_TRUE(std::ranges::equal(offsets, whole.offsets()));
+
+    arena::Arena arena{};
+    std::vector<std::string> datums{};
+    for (const auto& datum : index[150] | lexer::lex | reader::read(arena)) {
+        ASSERT_TRUE(datum);
+        datums.push_back(reader::write(*datum));
+    }
+    EXPECT_EQ(datums, (std::vector<std::string>{"(define (f150 x) (g x 1.5 -1/2))"}));
+}
+
+TEST(reader_test, reads_nested_datums) {
+    arena::Arena arena{};
+    std::vector<std::string> datums{};
+    for (const auto& datum :
+         std::string_view{"(define (f x) (g x 1.5 -3/6))\n#(a (b . c) #() ())\n(a b . (c d)) x"} |
+             lexer::lex | reader::read(arena)) {
+        ASSERT_TRUE(datum);
+        datums.push_back(reader::write(*datum));
+    }
+    EXPECT_EQ(datums, (std::vector<std::string>{"(define (f x) (g x 1.5 -1/2))",
+                                                "#(a (b . c) #() ())", "(a b c d)", "x"}));
+}
+
+TEST(reader_test, lists_are_contiguous_pairs) {
+    arena::Arena arena{};
+    auto datums = std::string{"(1 2 3 4)"} | lexer::lex | reader::read(arena);
+    auto it = datums.begin();
+    ASSERT_TRUE(*it);
+    const auto* first = &(*it)->as_pair();
+    const auto* pair = first;
+    for (int64_t n = 1; n <= 4; n++, pair++) {
+        EXPECT_EQ(pair->car.as_integer(), n);
+        EXPECT_EQ(pair->cdr.is_nil(), n == 4);
+        if (n < 4) {
+            EXPECT_EQ(&pair->cdr.as_pair(), pair + 1);
+        }
+    }
+    EXPECT_EQ(arena.bytes_used(), 4 * sizeof(reader::Pair));
+
+    arena.reset();
+    EXPECT_EQ(arena.bytes_used(), 0);
+    EXPECT_EQ(arena.block_count(), 1);
+}
+
+TEST(reader_test, errors_end_their_datum) {
+    arena::Arena arena{};
+    std::vector<std::string> results{};
+    for (const auto& datum :
+         std::string_view{"(a (1x b) c) ok ) (. a) (a . b c) #(a . b) (a . b) (x (y"} |
+             lexer::lex | reader::read(arena)) {
+        results.push_back(datum ? reader::write(*datum)
+                                : std::to_string(token::offset_of(datum.error())));
+    }
+    EXPECT_EQ(results, (std::vector<std::string>{"4", "ok", "16", "19", "31", "38", "(a . b)",
+                                                 "54"}));
+}
+
+namespace {
+
+// Value of the last form of src as the REPL writes it, or the error
+template <vm::Dispatch dispatch = vm::default_dispatch>
+auto run_program(std::string_view src, vm::Vm& machine) -> std::string {
+    arena::Arena arena{};
+    std::vector<reader::Datum> forms{};
+    for (const auto& datum : src | lexer::lex | reader::read(arena)) forms.push_back(*datum);
+    auto program = compiler::compile(forms);
+    if (!program) return program.error().message;
+    auto result = machine.run<dispatch>(*program);
+    return result ? vm::format_value(*result) : result.error().message;
+}
+
+template <vm::Dispatch dispatch = vm::default_dispatch>
+auto run_program(std::string_view src) -> std::string {
+    vm::Vm machine{};
+    return run_program<dispatch>(src, machine);
+}
+
+}  // namespace
+
+TEST(vm_test, runs_core_subset) {
+    std::vector<std::pair<std::string_view, std::string_view>> cases{
+        {"(define (fib a)\n"
+         "  (define (fib-iter a b n)\n"
+         "    (if (= n 0) b (fib-iter b (+ a b) (- n 1))))\n"
+         "  (fib-iter 1 1 a))\n"
+         "(fib 50)",
+         "32951280099"},
+        {"(define (tak x y z)\n"
+         "  (if (< y x) (tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y)) z))\n"
+         "(tak 18 12 6)",
+         "7"},
+        {"(let loop ((i 0) (acc 0)) (if (= i 1000) acc (loop (+ i 1) (+ acc i))))", "499500"},
+        {"(define (make-adder n) (lambda (x) (+ x n))) ((make-adder 5) 10)", "15"},
+        {"(define (f) (define a 1) (define (g) (+ a b)) (define b 2) (g)) (f)", "3"},
+        {"(let ((x 1) (y 2)) (let ((x y) (y x)) (- x y)))", "1"},
+        {"(define (f x) (let ((y (* x 2))) (lambda () (+ x y)))) ((f 10))", "30"},
+        {"(begin (- 5) (quotient -7 2) (remainder -7 2))", "-1"},
+        {"(define big 3000000000) (* big 3)", "9000000000"},
+        {"(if (<= 2 1) 1)", ""},
+        {"(define x (if (< 2 1) 1)) x", ""},
+        {"(define (f) (define a (if (< 2 1) 1)) (define (g) a) (g)) (f)", ""},
+        {"(define (f) (define (g) a) (define a (if (< 2 1) 1)) a) (f)", ""},
+        {"(define (+ a b) (* a b)) (+ 3 4)", "12"},
+        {"(list 1 (cons 2 3) (list) (car (cdr (list 4 5))))", "(1 (2 . 3) () 5)"},
+        {"(list (pair? (list)) (null? (list)) (pair? (cons 1 2)))", "(#f #t #t)"},
+    };
+    for (const auto& [src, expected] : cases) {
+        EXPECT_EQ(run_program<vm::Dispatch::switch_loop>(src), expected) << src;
+        if constexpr (vm::has_threaded_dispatch) {
+            EXPECT_EQ(run_program<vm::Dispatch::threaded>(src), expected) << src;
+        }
+    }
+}
+
+TEST(vm_test, tail_calls_run_in_constant_space) {
+    // room for a handful of frames only
+    vm::Vm machine{64, 4};
+    EXPECT_EQ(run_program("(define (even? n) (if (= n 0) 1 (odd? (- n 1))))\n"
+                          "(define (odd? n) (if (= n 0) 0 (even? (- n 1))))\n"
+                          "(even? 100001)",
+                          machine),
+              "0");
+    EXPECT_EQ(run_program("(define (count n) (if (= n 0) 0 (+ 1 (count (- n 1))))) (count 10)",
+                          machine),
+              "recursion too deep");
+}
+
+TEST(vm_test, reports_errors) {
+    std::vector<std::pair<std::string_view, std::string_view>> cases{
+        {"(+ 1 (f))", "f is not defined"},
+        {"(quotient 7 0)", "quotient by zero"},
+        {"(1 2)", "1 is not a procedure"},
+        {"(* 2305843009213693952 2)", "fixnum overflow in *"},
+        {"(+ 4611686018427387903 1)", "fixnum overflow in +"},
+        {"(quotient -4611686018427387904 -1)", "fixnum overflow in quotient"},
+        {"4611686018427387904", "only fixnums are supported: 4611686018427387904"},
+        {"(define (f x) x) (f 1 2)", "f takes 1 arguments, not 2"},
+        {"(< 1 (lambda () 1))", "< expects fixnums, not 1 and #<procedure lambda>"},
+        {"(lambda (x . y) x)", "rest parameters are not supported: (lambda (x . y) x)"},
+        {"(car +)", "primitive procedures can only be called: +"},
+        {"(+ 1.5 2)", "only fixnums are supported: 1.5"},
+        {"(cdr 5)", "cdr expects a pair, not 5"},
+        {"(car)", "expects one argument: (car)"},
+        {"(define (f) (define (g) b) (define a (g)) (define b 1) a) (f)",
+         "variable used before its definition"},
+    };
+    for (const auto& [src, expected] : cases) EXPECT_EQ(run_program(src), expected) << src;
+}
+
+TEST(value_test, tagged_words) {
+    for (auto n : {int64_t{0}, int64_t{-1}, vm::Value::min_fixnum, vm::Value::max_fixnum}) {
+        EXPECT_EQ(vm::Value::fixnum(n).as_fixnum(), n);
+        EXPECT_TRUE(vm::Value::fixnum(n).is_fixnum());
+    }
+    EXPECT_FALSE(vm::Value::fits_fixnum(vm::Value::max_fixnum + 1));
+    EXPECT_EQ(vm::Value::character(U'a').as_character(), U'a');
+    EXPECT_EQ(vm::Value::symbol(42), vm::Value::symbol(42));
+    EXPECT_FALSE(vm::Value::symbol(42) == vm::Value::character(42));
+    EXPECT_FALSE(vm::Value::empty_list().is_object());
+
+    vm::Pair pair{vm::Value::character(U' '), vm::Value::empty_list()};
+    auto value = vm::Value::pair(&pair);
+    EXPECT_TRUE(value.is_pair() && value.is_object() && !value.is_fixnum());
+    EXPECT_EQ(value.as_pair(), &pair);
+    EXPECT_EQ(vm::format_value(value), "(#\\space)");
+    EXPECT_EQ(vm::format_value(vm::Value::character(U'x')), "#\\x");
+    EXPECT_EQ(vm::format_value(vm::Value::character(U'\u00e9')), "#\\xe9");
+    EXPECT_EQ(vm::format_value(vm::Value::boolean(false)), "#f");
+}
+
+TEST(vm_test, collects_while_running) {
+    // a nursery of a few hundred pairs, so that most allocations collect
+    vm::Vm machine{1 << 16, 1 << 14, 1 << 14};
+    std::string_view lists{
+        "(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))\n"
+        "(define (sum l acc) (if (null? l) acc (sum (cdr l) (+ acc (car l)))))\n"
+        "(define (map f l) (if (null? l) (list) (cons (f (car l)) (map f (cdr l)))))\n"
+        "(define (f k)\n"
+        "  (define xs (build 5000 (list)))\n"
+        "  (define (scale x) (* x k))\n"
+        "  (sum (map scale xs) 0))\n"
+        "(list (f 2) (sum (build 300000 (list)) 0))"};
+    EXPECT_EQ(run_program(lists, machine), "(25005000 45000150000)");
+    EXPECT_GT(machine.heap().stats().minor_collections, 100U);
+    EXPECT_GT(machine.heap().stats().major_collections, 0U);
+}
+
+namespace {
+
+auto list_length(const vm::Value& list) -> std::size_t {
+    std::size_t length{0};
+    for (auto it = list; it.is_pair(); it = it.as_pair()->cdr) length++;
+    return length;
+}
+
+}  // namespace
+
+TEST(heap_test, roots_survive_collections) {
+    gc::Heap heap{1 << 12};
+    gc::Root list{heap, vm::Value::empty_list()};
+    for (int64_t i = 0; i < 10000; i++) {
+        *list = vm::Value::pair(heap.make_pair(vm::Value::fixnum(i), *list));
+        // garbage between the pairs that are kept
+        heap.make_pair(vm::Value::fixnum(i), vm::Value::fixnum(i));
+    }
+    EXPECT_GT(heap.stats().minor_collections, 10U);
+    EXPECT_EQ(list_length(*list), 10000U);
+    EXPECT_EQ(vm::format_value(list->as_pair()->car), "9999");
+
+    heap.collect_major();
+    EXPECT_EQ(list_length(*list), 10000U);
+    // only the kept pairs are left, each a header and two values
+    EXPECT_EQ(heap.stats().old_bytes, 10000 * (sizeof(gc::Header) + sizeof(vm::Pair)));
+}
+
+TEST(heap_test, remembers_old_objects_pointing_to_young) {
+    gc::Heap heap{1 << 12};
+    gc::Root box{heap, vm::Value::box(heap.make_box(vm::Value{}))};
+    heap.collect_minor();
+    auto* old = box->as_box();
+
+    // only the box refers to the pair, and only its barrier keeps the pair alive
+    auto* pair = heap.make_pair(vm::Value::fixnum(1), vm::Value::fixnum(2));
+    heap.store(old, old->value, vm::Value::pair(pair));
+    heap.collect_minor();
+    EXPECT_EQ(vm::format_value(box->as_box()->value), "(1 . 2)");
+    for (int i = 0; i < 1000; i++) heap.make_pair(vm::Value{}, vm::Value{});
+    EXPECT_EQ(vm::format_value(box->as_box()->value), "(1 . 2)");
+}
+
+TEST(heap_test, objects_too_big_for_the_nursery_start_old) {
+    gc::Heap heap{1 << 12};
+    bytecode::Function function{.name = "f"};
+    function.captures.resize(1000, bytecode::Capture{true, 0});
+    auto* made = heap.make_closure(function);
+    gc::Root closure{heap, vm::Value::closure(made)};
+    made->captures[999] =
+        vm::Value::pair(heap.make_pair(vm::Value::fixnum(3), vm::Value::fixnum(4)));
+    for (int i = 0; i < 1000; i++) heap.make_pair(vm::Value{}, vm::Value{});
+    heap.collect_major();
+    EXPECT_EQ(vm::format_value(closure->as_closure()->captures[999]), "(3 . 4)");
+}